@@ -86,6 +86,22 @@ namespace HL {
     /// Remove in a zone allocator is a no-op.
     inline int remove (void *) { return 0; }
 
+    /// Grow an object in place, which is only possible when it is
+    /// the last one allocated from the current arena.
+    inline bool extend (void * ptr, size_t oldSize, size_t newSize) {
+      oldSize = HL::align<HL::MallocInfo::Alignment>(oldSize);
+      newSize = HL::align<HL::MallocInfo::Alignment>(newSize);
+      if ((_currentArena == NULL) || ((char *) ptr + oldSize != _currentArena->arenaSpace)) {
+	return false;
+      }
+      if (_sizeRemaining < (ssize_t) (newSize - oldSize)) {
+	return false;
+      }
+      _sizeRemaining -= (newSize - oldSize);
+      _currentArena->arenaSpace += (newSize - oldSize);
+      return true;
+    }
+
 
   private:
 
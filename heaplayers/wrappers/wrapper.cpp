@@ -41,6 +41,8 @@ extern "C" {
   void * xxmalloc (size_t);
   void   xxfree (void *);
   void * xxrealloc (void *, size_t);
+  void * xxmemalign (size_t, size_t);
+  void * xxcalloc (size_t, size_t);
 
   // Takes a pointer and returns how much space it holds.
   size_t xxmalloc_usable_size (void *);
@@ -144,16 +146,8 @@ extern "C" void * MYCDECL CUSTOM_MALLOC(size_t sz)
 
 extern "C" void * MYCDECL CUSTOM_CALLOC(size_t nelem, size_t elsize)
 {
-  size_t n = nelem * elsize;
-  if (elsize && nelem != n / elsize) {
-    return NULL;
-  }
-  void * ptr = CUSTOM_MALLOC(n);
-  // Zero out the malloc'd block.
-  if (ptr != NULL) {
-    memset (ptr, 0, n);
-  }
-  return ptr;
+  // Overflow checking and zeroing are done by xxcalloc.
+  return xxcalloc(nelem, elsize);
 }
 
 
@@ -201,18 +195,7 @@ extern "C" void * MYCDECL CUSTOM_MEMALIGN (size_t alignment, size_t size)
   if (alignment == sizeof(double)) {
     return CUSTOM_MALLOC (size);
   } else {
-    // Try to just allocate an object of the requested size.
-    // If it happens to be aligned properly, just return it.
-    void * ptr = CUSTOM_MALLOC(size);
-    if (((size_t) ptr & (alignment - 1)) == (size_t) ptr) {
-      // It is already aligned just fine; return it.
-      return ptr;
-    }
-    // It was not aligned as requested: free the object and allocate a big one.
-    CUSTOM_FREE(ptr);
-    ptr = CUSTOM_MALLOC (size + 2 * alignment);
-    void * alignedPtr = (void *) (((size_t) ptr + alignment - 1) & ~(alignment - 1));
-    return alignedPtr;
+    return xxmemalign (alignment, size);
   }
 }
 
@@ -225,7 +208,9 @@ extern "C" void * MYCDECL CUSTOM_ALIGNED_ALLOC(size_t alignment, size_t size)
   // memalign(), except for the added restriction that size should be
   // a multiple of alignment." Rather than check and potentially fail,
   // we just enforce this by rounding up the size, if necessary.
-  size = size + alignment - (size % alignment);
+  if (size % alignment) {
+    size = size + alignment - (size % alignment);
+  }
   return CUSTOM_MEMALIGN(alignment, size);
 }
 
@@ -248,56 +233,8 @@ extern "C" size_t MYCDECL CUSTOM_GOODSIZE (size_t sz) {
 
 extern "C" void * MYCDECL CUSTOM_REALLOC (void * ptr, size_t sz)
 {
-#ifdef DETECT_OVERFLOW
+  // DoubleTake resizes objects in place, and keeps their sentinels right.
   return xxrealloc(ptr, sz);
-#else
-	//fprintf(stderr, "custom realloc ptr %p sz %lx\n", ptr, sz); 
-  if (ptr == NULL) {
-    ptr = CUSTOM_MALLOC (sz);
-    return ptr;
-  }
-  if (sz == 0) {
-    CUSTOM_FREE (ptr);
-#if defined(__APPLE__)
-    // 0 size = free. We return a small object.  This behavior is
-    // apparently required under Mac OS X and optional under POSIX.
-    return CUSTOM_MALLOC(1);
-#else
-    // For POSIX, don't return anything.
-    return NULL;
-#endif
-  }
-
-  size_t objSize = CUSTOM_GETSIZE (ptr);
-
-  void * buf = CUSTOM_MALLOC(sz);
-
-  if (buf != NULL) {
-#if 0
-		// Bug found by Tongping Liu.
-		// We can't do this for doubletake since doubletake 
-		// relies on those malloc-related information to capture buffer overflows.
-		// Since it didn't notify doubletake about this trick, 
-		// doubletake will report a lot of false negatives.
-    if (objSize == CUSTOM_GETSIZE(buf)) {
-      // The objects are the same actual size.
-      // Free the new object and return the original.
-      CUSTOM_FREE (buf);
-      return ptr;
-    }
-#endif
-    // Copy the contents of the original object
-    // up to the size of the new block.
-    size_t minSize = (objSize < sz) ? objSize : sz;
-    memcpy (buf, ptr, minSize);
-  }
-
-  // Free the old block.
-  CUSTOM_FREE (ptr);
-
-  // Return a pointer to the new one.
-  return buf;
-#endif
 }
 
 #if defined(linux)
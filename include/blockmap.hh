@@ -0,0 +1,188 @@
+#if !defined(DOUBLETAKE_BLOCKMAP_H)
+#define DOUBLETAKE_BLOCKMAP_H
+
+/*
+ * @file   blockmap.h
+ * @brief  Find the heap block covering any heap address in constant time.
+ *         The heap is divided into granules of 64 aligned slots. For each granule,
+ *         we keep a bitmap of slots where a block starts and the block covering
+ *         the first byte of the granule. The block covering an address is the last
+ *         block starting in the granule before this address, or the covering block
+ *         if there is no such block.
+ *         Blocks of different sizes are carved from the same zone, so there is no
+ *         span of a single size class where the start could be computed.
+ *         The start bitmaps also enumerate all blocks without reading the heap.
+ *         The map is not rolled back. Instead, carving a block overwrites the entries
+ *         of its range, and every lookup is checked against the block header.
+ * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <new>
+
+#include "log.hh"
+#include "mm.hh"
+#include "objectheader.hh"
+#include "xdefines.hh"
+
+class blockmap {
+  // Blocks are aligned to 16 bytes on 64-bit systems and 8 bytes on 32-bit systems.
+  enum { SLOT_SIZE = 2 * xdefines::WORD_SIZE };
+  enum { SLOTS_PER_GRANULE = 64 };
+  enum { GRANULE_SIZE = SLOT_SIZE * SLOTS_PER_GRANULE };
+
+  // See AdaptAppHeap: objectHeader + "canary" + Object + "canary".
+  enum { BLOCK_OVERHEAD = sizeof(objectHeader) + 2 * xdefines::SENTINEL_SIZE };
+
+public:
+  blockmap() : _heapStart(0), _heapEnd(0), _starts(NULL), _covers(NULL) {}
+
+  static blockmap& getInstance() {
+    static char buf[sizeof(blockmap)];
+    static blockmap* theOneTrueObject = new (buf) blockmap();
+    return *theOneTrueObject;
+  }
+
+  void initialize(void* addr, size_t size) {
+    size_t granules = size / GRANULE_SIZE;
+
+    _heapStart = (unsigned long)addr;
+    _heapEnd = _heapStart + size;
+
+    // Pages are only touched when the heap grows there.
+    _starts = (uint64_t*)MM::mmapAllocatePrivate(granules * sizeof(uint64_t));
+    _covers = (uint32_t*)MM::mmapAllocatePrivate(granules * sizeof(uint32_t));
+    REQUIRE(_starts != NULL && _covers != NULL, "Failed to allocate the block map");
+  }
+
+  // Record a block occupying [block, block + bytes).
+  void setBlock(void* block, size_t bytes) {
+    unsigned long first = getSlot((unsigned long)block);
+    unsigned long last = getSlot((unsigned long)block + bytes);
+    unsigned long granule = first / SLOTS_PER_GRANULE;
+    unsigned long lastGranule = (last - 1) / SLOTS_PER_GRANULE;
+
+    // Only this block starts in its range. Granules of different threads' zones
+    // may share a word, so the bitmap is updated atomically.
+    __atomic_fetch_or(&_starts[granule], getMask(first), __ATOMIC_RELAXED);
+    clearStarts(first + 1, last);
+
+    for(granule++; granule <= lastGranule; granule++) {
+      _covers[granule] = (uint32_t)first;
+    }
+  }
+
+  // Find the object whose block covers addr. The address can be anywhere in the
+  // block, including its header and sentinels.
+  bool findObjectStart(void* addr, unsigned long* objectStart) {
+    unsigned long address = (unsigned long)addr;
+
+    if(address < _heapStart || address >= _heapEnd) {
+      return false;
+    }
+
+    unsigned long slot = getSlot(address);
+    unsigned long granule = slot / SLOTS_PER_GRANULE;
+    unsigned long index = slot % SLOTS_PER_GRANULE;
+
+    // Starts at or before this slot. When index is 63, the shift gives 0.
+    uint64_t starts = __atomic_load_n(&_starts[granule], __ATOMIC_RELAXED) &
+                      ((((uint64_t)2) << index) - 1);
+    unsigned long blockSlot;
+
+    if(starts != 0) {
+      blockSlot = granule * SLOTS_PER_GRANULE + (SLOTS_PER_GRANULE - 1 - __builtin_clzll(starts));
+    } else {
+      blockSlot = _covers[granule];
+      if(blockSlot == 0) {
+        return false;
+      }
+    }
+
+    // The entry may be left by a block discarded in a rollback, or the address
+    // may be in the bytes between two blocks.
+    objectHeader* o = (objectHeader*)(_heapStart + blockSlot * SLOT_SIZE);
+    if(!o->isGoodObject() || o->getSize() == 0 ||
+       address >= (unsigned long)o + BLOCK_OVERHEAD + o->getSize()) {
+      return false;
+    }
+
+    *objectStart = (unsigned long)(o + 1);
+    return true;
+  }
+
+  // Find the first block starting in [*cursor, end), and move the cursor past it.
+  // Inside a block there is no start, so a whole block is skipped at once.
+  objectHeader* findNextBlock(unsigned long* cursor, unsigned long end) {
+    unsigned long slot = getSlot(*cursor + SLOT_SIZE - 1);
+    unsigned long lastSlot = getSlot(end + SLOT_SIZE - 1);
+
+    while(slot < lastSlot) {
+      unsigned long granule = slot / SLOTS_PER_GRANULE;
+      uint64_t starts = _starts[granule] & ~(getMask(slot) - 1);
+
+      if(starts == 0) {
+        slot = (granule + 1) * SLOTS_PER_GRANULE;
+        continue;
+      }
+
+      slot = granule * SLOTS_PER_GRANULE + __builtin_ctzll(starts);
+      if(slot >= lastSlot) {
+        break;
+      }
+
+      // Skip the entries left by blocks discarded in a rollback.
+      objectHeader* o = (objectHeader*)(_heapStart + slot * SLOT_SIZE);
+      if(o->isGoodObject() && o->getSize() != 0) {
+        *cursor = (unsigned long)o + BLOCK_OVERHEAD + o->getSize();
+        return o;
+      }
+      slot++;
+    }
+
+    *cursor = end;
+    return NULL;
+  }
+
+private:
+  inline unsigned long getSlot(unsigned long addr) { return (addr - _heapStart) / SLOT_SIZE; }
+
+  inline static uint64_t getMask(unsigned long slot) {
+    return ((uint64_t)1) << (slot % SLOTS_PER_GRANULE);
+  }
+
+  // Clear the start bits of slots in [first, last).
+  void clearStarts(unsigned long first, unsigned long last) {
+    while(first < last) {
+      unsigned long granule = first / SLOTS_PER_GRANULE;
+      unsigned long end = (granule + 1) * SLOTS_PER_GRANULE;
+      if(end > last) {
+        end = last;
+      }
+
+      // Bits [first % 64, end - granule * 64) of this granule.
+      uint64_t mask = ~(getMask(first) - 1);
+      if(end - granule * SLOTS_PER_GRANULE < SLOTS_PER_GRANULE) {
+        mask &= getMask(end) - 1;
+      }
+
+      if(__atomic_load_n(&_starts[granule], __ATOMIC_RELAXED) & mask) {
+        __atomic_fetch_and(&_starts[granule], ~mask, __ATOMIC_RELAXED);
+      }
+      first = end;
+    }
+  }
+
+  unsigned long _heapStart;
+  unsigned long _heapEnd;
+
+  // One bit for each slot of a granule where a block starts.
+  uint64_t* _starts;
+
+  // The slot of the block covering the first byte of each granule, or 0.
+  uint32_t* _covers;
+};
+
+#endif
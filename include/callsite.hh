@@ -3,63 +3,52 @@
 
 /*
  * @file   callsite.h
- * @brief  Management of callsites for heap objects.
+ * @brief  Management of callsites for heap objects. A callsite is the id of its
+ *         call stack in the table of interned callsites.
  * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
  */
 
 #include <stdio.h>
 
+#include "callsitetable.hh"
 #include "xdefines.hh"
 
 class CallSite {
 public:
-  CallSite() : _depth(0) {
-    for (auto i = 0; i < xdefines::CALLSITE_MAXIMUM_LENGTH; i++) {
-      _callsite[i] = nullptr;
-    }
-  }
+  CallSite() : _id(callsitetable::NO_CALLSITE) {}
+
+  unsigned int id() { return _id; }
 
-  unsigned long depth() { return _depth; }
+  unsigned long depth() { return callsitetable::getInstance().getDepth(_id); }
 
   void print() {
-    for(auto i = 0; i < (int) _depth; i++) {
-      printf("%p\t", _callsite[i]);
+    void** callsite = getCallsite();
+
+    for(auto i = 0; i < (int) depth(); i++) {
+      printf("%p\t", callsite[i]);
     }
     printf("\n");
   }
 
-  unsigned long get(int index) { return (unsigned long)_callsite[index]; }
+  unsigned long get(int index) { return (unsigned long)getCallsite()[index]; }
 
   // Save callsite
-  void save(int depth, void** addr) {
-    _depth = depth;
-
-    for(int i = 0; i < depth; i++) {
-      _callsite[i] = addr[i];
-    }
-  }
+  void save(int depth, void** addr) { _id = callsitetable::getInstance().intern(depth, addr); }
 
+  // Save callsite, and return whether it is the same as the saved one.
   bool saveAndCheck(int depth, void** addr) {
-    bool isSame = true;
-
-    _depth = depth;
-
-    for(int i = 0; i < depth; i++) {
-      if(_callsite[i] != addr[i]) {
-        isSame = false;
-        _callsite[i] = addr[i];
-      }
-    }
+    unsigned int id = callsitetable::getInstance().intern(depth, addr);
+    bool isSame = (id == _id && id != callsitetable::NO_CALLSITE);
 
+    _id = id;
     return isSame;
   }
 
   // Return the callsite
-  void** getCallsite() { return &_callsite[0]; }
+  void** getCallsite() { return callsitetable::getInstance().getFrames(_id); }
 
 private:
-  unsigned long _depth; // Actual callsite depth
-  void* _callsite[xdefines::CALLSITE_MAXIMUM_LENGTH];
+  unsigned int _id;
 };
 
 #endif
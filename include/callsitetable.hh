@@ -0,0 +1,162 @@
+#if !defined(DOUBLETAKE_CALLSITETABLE_H)
+#define DOUBLETAKE_CALLSITETABLE_H
+
+/*
+ * @file   callsitetable.h
+ * @brief  A global table of interned call stacks, so that a call stack is kept only
+ *         once and heap objects refer to it by a 32-bit id.
+ *         Sites are found by the hash of their frames, with linear probing. A slot is
+ *         claimed by a compare-and-swap on its hash, and it is marked as ready after
+ *         its frames are written, thus threads never take a lock in here. Sites are
+ *         never removed, and the table is outside of the heap, so ids stay valid
+ *         across rollbacks.
+ *         Every site also counts the objects and bytes that are reported at it.
+ * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <new>
+
+#include "hashfuncs.hh"
+#include "log.hh"
+#include "mm.hh"
+#include "xdefines.hh"
+
+class callsitetable {
+  struct site {
+    size_t hash;
+    bool isReady;
+    int depth;
+    void* frames[xdefines::CALLSITE_MAXIMUM_LENGTH];
+    size_t objects;
+    size_t bytes;
+  };
+
+public:
+  // The id of unknown call stacks, when the table is full.
+  enum { NO_CALLSITE = 0 };
+
+  callsitetable() : _sites(NULL), _numSites(0) {}
+
+  static callsitetable& getInstance() {
+    static char buf[sizeof(callsitetable)];
+    static callsitetable* theOneTrueObject = new (buf) callsitetable();
+    return *theOneTrueObject;
+  }
+
+  void initialize() {
+    _sites = (site*)MM::mmapAllocatePrivate(xdefines::CALLSITE_TABLE_SIZE * sizeof(site));
+    REQUIRE(_sites != NULL, "Failed to allocate the table of callsites");
+  }
+
+  // Get the id of a call stack, which is added to the table at its first time.
+  unsigned int intern(int depth, void** frames) {
+    if(_sites == NULL || depth <= 0) {
+      return NO_CALLSITE;
+    }
+    if(depth > xdefines::CALLSITE_MAXIMUM_LENGTH) {
+      depth = xdefines::CALLSITE_MAXIMUM_LENGTH;
+    }
+
+    size_t hash = HashFuncs::hashCallStack(frames, depth);
+    if(hash == 0) {
+      hash = 1;
+    }
+
+    unsigned long mask = xdefines::CALLSITE_TABLE_SIZE - 1;
+    for(unsigned long i = 0; i < xdefines::CALLSITE_TABLE_SIZE; i++) {
+      unsigned long index = (hash + i) & mask;
+      site* s = &_sites[index];
+      size_t key = __atomic_load_n(&s->hash, __ATOMIC_ACQUIRE);
+
+      if(key == 0) {
+        // Keep the table sparse, so that probing stays short.
+        if(__atomic_load_n(&_numSites, __ATOMIC_RELAXED) >= xdefines::CALLSITE_TABLE_SIZE / 4 * 3) {
+          return NO_CALLSITE;
+        }
+
+        if(__atomic_compare_exchange_n(&s->hash, &key, hash, false, __ATOMIC_ACQ_REL,
+                                       __ATOMIC_ACQUIRE)) {
+          s->depth = depth;
+          memcpy(s->frames, frames, depth * sizeof(void*));
+          __atomic_add_fetch(&_numSites, 1, __ATOMIC_RELAXED);
+          __atomic_store_n(&s->isReady, true, __ATOMIC_RELEASE);
+          return index + 1;
+        }
+        // Otherwise, another thread has just claimed this slot, and key is its hash.
+      }
+
+      if(key == hash) {
+        while(!__atomic_load_n(&s->isReady, __ATOMIC_ACQUIRE)) {
+          __asm__ __volatile__("pause");
+        }
+
+        if(s->depth == depth && memcmp(s->frames, frames, depth * sizeof(void*)) == 0) {
+          return index + 1;
+        }
+      }
+    }
+
+    return NO_CALLSITE;
+  }
+
+  int getDepth(unsigned int id) {
+    site* s = getSite(id);
+    return (s != NULL) ? s->depth : 0;
+  }
+
+  void** getFrames(unsigned int id) {
+    site* s = getSite(id);
+    return (s != NULL) ? s->frames : NULL;
+  }
+
+  // Count an object reported at a site.
+  void addObject(unsigned int id, size_t size) {
+    site* s = getSite(id);
+
+    if(s != NULL) {
+      __atomic_add_fetch(&s->objects, 1, __ATOMIC_RELAXED);
+      __atomic_add_fetch(&s->bytes, size, __ATOMIC_RELAXED);
+    }
+  }
+
+  size_t getObjects(unsigned int id) {
+    site* s = getSite(id);
+    return (s != NULL) ? s->objects : 0;
+  }
+
+  size_t getBytes(unsigned int id) {
+    site* s = getSite(id);
+    return (s != NULL) ? s->bytes : 0;
+  }
+
+  // Called when all other threads are stopped.
+  void clearObjects() {
+    if(_sites == NULL) {
+      return;
+    }
+
+    for(unsigned long i = 0; i < xdefines::CALLSITE_TABLE_SIZE; i++) {
+      _sites[i].objects = 0;
+      _sites[i].bytes = 0;
+    }
+  }
+
+private:
+  site* getSite(unsigned int id) {
+    if(_sites == NULL || id == NO_CALLSITE || id > xdefines::CALLSITE_TABLE_SIZE) {
+      return NULL;
+    }
+
+    site* s = &_sites[id - 1];
+    return __atomic_load_n(&s->isReady, __ATOMIC_ACQUIRE) ? s : NULL;
+  }
+
+  site* _sites;
+  size_t _numSites;
+};
+
+#endif
@@ -0,0 +1,79 @@
+#if !defined(DOUBLETAKE_CANARY_H)
+#define DOUBLETAKE_CANARY_H
+
+/*
+ * @file   canary.h
+ * @brief  Fill and verify canary words of freed objects.
+ *         Both kernels work on 64 bytes at a time with SSE2 when it is available.
+ *         The scalar loops are kept for 32-bit builds.
+ * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "xdefines.hh"
+
+// Write "words" canary words starting at ptr.
+inline void fillCanary(void* ptr, size_t words) {
+  unsigned long* addr = (unsigned long*)ptr;
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  // The sentinel word repeats its low 32 bits on both 32-bit and 64-bit builds.
+  const __m128i canary = _mm_set1_epi32((int)(uint32_t)xdefines::SENTINEL_WORD);
+  const size_t wordsPerLoop = 4 * sizeof(__m128i) / sizeof(unsigned long);
+
+  for(; i + wordsPerLoop <= words; i += wordsPerLoop) {
+    __m128i* dest = (__m128i*)&addr[i];
+    _mm_storeu_si128(dest, canary);
+    _mm_storeu_si128(dest + 1, canary);
+    _mm_storeu_si128(dest + 2, canary);
+    _mm_storeu_si128(dest + 3, canary);
+  }
+#endif
+
+  for(; i < words; i++) {
+    addr[i] = xdefines::SENTINEL_WORD;
+  }
+}
+
+// Return the index of the first word in [start, words) which is not a canary,
+// or "words" if all of them are intact.
+inline size_t findCanaryMismatch(const void* ptr, size_t start, size_t words) {
+  const unsigned long* addr = (const unsigned long*)ptr;
+  size_t i = start;
+
+#if defined(__SSE2__)
+  const __m128i canary = _mm_set1_epi32((int)(uint32_t)xdefines::SENTINEL_WORD);
+  const size_t wordsPerLoop = 4 * sizeof(__m128i) / sizeof(unsigned long);
+
+  for(; i + wordsPerLoop <= words; i += wordsPerLoop) {
+    const __m128i* src = (const __m128i*)&addr[i];
+    __m128i eq0 = _mm_cmpeq_epi8(_mm_loadu_si128(src), canary);
+    __m128i eq1 = _mm_cmpeq_epi8(_mm_loadu_si128(src + 1), canary);
+    __m128i eq2 = _mm_cmpeq_epi8(_mm_loadu_si128(src + 2), canary);
+    __m128i eq3 = _mm_cmpeq_epi8(_mm_loadu_si128(src + 3), canary);
+    __m128i eq = _mm_and_si128(_mm_and_si128(eq0, eq1), _mm_and_si128(eq2, eq3));
+
+    // Some byte is different. Find the word in the scalar loop below.
+    if(_mm_movemask_epi8(eq) != 0xFFFF) {
+      break;
+    }
+  }
+#endif
+
+  for(; i < words; i++) {
+    if(addr[i] != xdefines::SENTINEL_WORD) {
+      break;
+    }
+  }
+
+  return i;
+}
+
+#endif
@@ -0,0 +1,145 @@
+#if !defined(DOUBLETAKE_DIRTYPAGES_H)
+#define DOUBLETAKE_DIRTYPAGES_H
+
+/*
+ * @file   dirtypages.h
+ * @brief  Find the heap pages written since the last leak check, with the soft-dirty
+ *         bits of the kernel (Documentation/vm/soft-dirty.txt).
+ *         Writing "4" to /proc/self/clear_refs clears the bits of all pages, and
+ *         the first write to a page sets its bit again, which is bit 55 of its entry
+ *         in /proc/self/pagemap. Unlike a write barrier with mprotect, system calls
+ *         can still write into the heap.
+ *         Kernels without CONFIG_MEM_SOFT_DIRTY never set the bits, so this is
+ *         checked once before it is used.
+ * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
+ */
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <new>
+
+#include "log.hh"
+#include "mm.hh"
+#include "real.hh"
+#include "xdefines.hh"
+
+class dirtypages {
+  enum { PAGEMAP_SOFT_DIRTY = 55 };
+  enum { PAGEMAP_BATCH = 512 };
+
+public:
+  dirtypages() : _isAvailable(false), _pages(NULL), _count(0) {}
+
+  static dirtypages& getInstance() {
+    static char buf[sizeof(dirtypages)];
+    static dirtypages* theOneTrueObject = new (buf) dirtypages();
+    return *theOneTrueObject;
+  }
+
+  // Check whether the kernel tracks soft-dirty bits, and keep a list for the
+  // pages of a heap of the given size.
+  void initialize(size_t heapSize) {
+    char* page = (char*)MM::mmapAllocatePrivate(xdefines::PageSize);
+    bool isDirty;
+
+    // The bit should be cleared, and set by the next write.
+    page[0] = 1;
+    _isAvailable = clear() && readBit((unsigned long)page, &isDirty) && !isDirty;
+    if(_isAvailable) {
+      page[0] = 2;
+      _isAvailable = readBit((unsigned long)page, &isDirty) && isDirty;
+    }
+    Real::munmap(page, xdefines::PageSize);
+
+    if(_isAvailable) {
+      _pages = (unsigned long*)MM::mmapAllocatePrivate(heapSize / xdefines::PageSize *
+                                                       sizeof(unsigned long));
+      REQUIRE(_pages != NULL, "Failed to allocate the list of dirty pages");
+    } else {
+      PRINF("Soft-dirty bits are not supported, every leak check is a full one.\n");
+    }
+  }
+
+  bool isAvailable() { return _isAvailable; }
+
+  // Collect the pages in [begin, end) that are written since the last clear().
+  bool collect(unsigned long begin, unsigned long end) {
+    uint64_t entries[PAGEMAP_BATCH];
+    unsigned long page = aligndown(begin, xdefines::PageSize);
+
+    _count = 0;
+
+    int fd = Real::open("/proc/self/pagemap", O_RDONLY);
+    if(fd < 0) {
+      return false;
+    }
+
+    while(page < end) {
+      size_t pages = (end - page + xdefines::PageSize - 1) / xdefines::PageSize;
+      if(pages > PAGEMAP_BATCH) {
+        pages = PAGEMAP_BATCH;
+      }
+
+      ssize_t bytes = Real::pread(fd, entries, pages * sizeof(uint64_t),
+                                  page / xdefines::PageSize * sizeof(uint64_t));
+      if(bytes != (ssize_t)(pages * sizeof(uint64_t))) {
+        Real::close(fd);
+        return false;
+      }
+
+      for(size_t i = 0; i < pages; i++) {
+        if(entries[i] & ((uint64_t)1 << PAGEMAP_SOFT_DIRTY)) {
+          _pages[_count++] = page + i * xdefines::PageSize;
+        }
+      }
+      page += pages * xdefines::PageSize;
+    }
+
+    Real::close(fd);
+    return true;
+  }
+
+  size_t getCount() { return _count; }
+
+  unsigned long getPage(size_t index) { return _pages[index]; }
+
+  // Clear the soft-dirty bits of all pages of this process.
+  bool clear() {
+    int fd = Real::open("/proc/self/clear_refs", O_WRONLY);
+    if(fd < 0) {
+      return false;
+    }
+
+    bool isCleared = (Real::write(fd, "4", 1) == 1);
+    Real::close(fd);
+    return isCleared;
+  }
+
+private:
+  bool readBit(unsigned long addr, bool* isDirty) {
+    uint64_t entry;
+
+    int fd = Real::open("/proc/self/pagemap", O_RDONLY);
+    if(fd < 0) {
+      return false;
+    }
+
+    ssize_t bytes = Real::pread(fd, &entry, sizeof(entry), addr / xdefines::PageSize * sizeof(entry));
+    Real::close(fd);
+
+    *isDirty = (entry & ((uint64_t)1 << PAGEMAP_SOFT_DIRTY)) ? true : false;
+    return (bytes == sizeof(entry));
+  }
+
+  bool _isAvailable;
+
+  // Addresses of the dirty pages found by collect().
+  unsigned long* _pages;
+  size_t _count;
+};
+
+#endif
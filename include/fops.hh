@@ -21,6 +21,7 @@
 #include "log.hh"
 #include "mm.hh"
 #include "real.hh"
+#include "slab.hh"
 #include "sysrecord.hh"
 #include "spinlock.hh"
 #include "threadstruct.hh"
@@ -121,7 +122,7 @@ public:
 
       // check the file fd.
       if(_filesMap.find(oldfd, sizeof(oldfd), &thisFile)) {
-        fileInfo* newFile = (fileInfo*)InternalHeap::getInstance().malloc(sizeof(fileInfo));
+        fileInfo* newFile = slab<fileInfo>::getInstance().alloc();
         memcpy(newFile, thisFile, sizeof(fileInfo));
         newFile->fd = newfd;
 
@@ -160,7 +161,7 @@ public:
 
     // Only save to the dirmap when a dir is valid.
     if(dir != NULL) {
-      dirInfo* thisDir = (dirInfo*)InternalHeap::getInstance().malloc(sizeof(dirInfo));
+      dirInfo* thisDir = slab<dirInfo>::getInstance().alloc();
       assert(thisDir != NULL);
       thisDir->pos = telldir(dir);
       thisDir->dir = dir;
@@ -266,7 +267,7 @@ public:
 		//PRINT("saveFD %d origStream %p\n", fd, file);
 
     if(fd != -1) {
-      fileInfo* thisFile = (fileInfo*)InternalHeap::getInstance().malloc(sizeof(fileInfo));
+      fileInfo* thisFile = slab<fileInfo>::getInstance().alloc();
       thisFile->fd = fd;
       thisFile->pos = 0;
       thisFile->origStream = file;
@@ -482,7 +483,7 @@ public:
 
         // Remove this entry from the filemap.
         _filesMap.erase(fd, sizeof(fd));
-        InternalHeap::getInstance().free(thisFile);
+        slab<fileInfo>::getInstance().free(thisFile);
       } else {
         // Should not happen.
         assert(0);
@@ -511,7 +512,7 @@ public:
 
         // Remove this entry from the _dirsMap.
         _dirsMap.erase(dir, sizeof(dir));
-        InternalHeap::getInstance().free(thisDir);
+        slab<dirInfo>::getInstance().free(thisDir);
       } else {
         // Should not happen.
         assert(0);
@@ -76,6 +76,9 @@ inline void global_setRollback() {
 
 inline bool global_hasRollbacked() { return g_hasRollbacked; }
 
+// The re-executions are done, and the epoch is run again in the normal execution.
+inline void global_endRollback() { g_isRollback = false; }
+
 inline void global_wakeup() {
   // Wakeup all other threads.
   Real::pthread_cond_broadcast(&g_condWaiters);
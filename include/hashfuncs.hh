@@ -41,6 +41,16 @@ public:
     return key;
   }
 
+  // Mix the return addresses of a call stack, one by one.
+  static size_t hashCallStack(void** frames, int depth) {
+    size_t hash = 0;
+
+    for(int i = 0; i < depth; i++) {
+      hash = (hash ^ hashAddr(frames[i], sizeof(void*))) * 0x100000001b3UL;
+    }
+    return hash;
+  }
+
   static bool compareAddr(void* addr1, void* addr2, size_t) { return addr1 == addr2; }
 
   static bool compareInt(int var1, int var2, size_t) { return var1 == var2; }
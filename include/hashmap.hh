@@ -16,6 +16,7 @@
 
 #include "list.hh"
 #include "log.hh"
+#include "slab.hh"
 #include "xdefines.hh"
 
 template <class KeyType,                    // What is the key? A long or string
@@ -200,7 +201,7 @@ public:
       // Remove this entry if existing.
       entry->erase();
 
-      SourceHeap::deallocate(entry);
+      slab<struct Entry, SourceHeap>::getInstance().free(entry);
     }
 
     first->count--;
@@ -216,7 +217,7 @@ public:
 private:
   // Create a new Entry with specified key and value.
   struct Entry* createNewEntry(const KeyType& key, size_t keylen, ValueType value) {
-    struct Entry* entry = (struct Entry*)SourceHeap::allocate(sizeof(struct Entry));
+    struct Entry* entry = slab<struct Entry, SourceHeap>::getInstance().alloc();
 
     // Initialize this new entry.
     entry->initialize(key, keylen, value);
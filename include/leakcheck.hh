@@ -21,86 +21,212 @@
            possible memory leakage. If yes, then we update corresponding list about how many leakage
            happens on each memory allocation site.
 
+           The marking is done by several threads together. Each of them owns a work-stealing
+           deque of possible heap pointers, which spills into a chunked stack when it is full.
+           A thread claims an object by setting its checked bit atomically before scanning it.
+           Stacks and global regions are split into pieces that are taken by all threads. Helper threads
+           are not managed by DoubleTake, so they never touch current thread's information,
+           the slabs or the internal heap.
+
+           Checks are incremental when the kernel tracks soft-dirty pages, like a generational
+           garbage collector. The checked bit of a reachable object is kept after a check. The
+           next check only scans the stacks, the globals and the parts of marked objects on pages
+           written since then, and only looks for leaks among objects on those pages. Every
+           allocated object is such an object, since its header is written. An object that
+           becomes unreachable after it is marked is only found by a full check, which is done
+           every LEAK_FULL_CHECK_EPOCHS checks and in the end of a program.
+
  * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
  */
 
 #include <assert.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <ucontext.h>
 
-#include <list>
 #include <new>
 
+#include "blockmap.hh"
+#include "dirtypages.hh"
+#include "leaksnapshot.hh"
 #include "memtrack.hh"
 #include "mm.hh"
 #include "objectheader.hh"
+#include "real.hh"
 #include "sentinelmap.hh"
+#include "sitemap.hh"
 #include "spinlock.hh"
 #include "threadstruct.hh"
+#include "workdeque.hh"
+#include "worklist.hh"
 #include "xdefines.hh"
 
-// From heaplayers
-#include "wrappers/stlallocator.h"
-
 class leakcheck {
+  // The lowest bit of a queued address tells that its object is claimed already.
+  enum { CLAIMED_OBJECT = 0x1 };
+
+  // Dirty pages are taken in groups as large as a piece of a root region.
+  enum { LEAK_DIRTY_PAGES = xdefines::LEAK_ROOT_CHUNK_SIZE / xdefines::PageSize };
+
+  // A stack or a global region, which is scanned in pieces of LEAK_ROOT_CHUNK_SIZE bytes.
+  struct rootRegion {
+    unsigned long begin;
+    unsigned long end;
+    unsigned long firstChunk;
+    unsigned long chunks;
+  };
+
 public:
   leakcheck()
-    : _unexploredObjects(), _totalLeakageSize(), _lck(), _sizeList(),
-      _nonStartAddrs(0), _heapBegin(0), _heapEnd(0) {}
+    : _totalLeakageSize(), _lck(), _nonStartAddrs(0), _heapBegin(0), _heapEnd(0),
+      _numWorkers(0), _idleWorkers(0), _finishedHelpers(0), _generation(0), _totalRegions(0),
+      _totalRootChunks(0), _nextRootChunk(0), _totalHeapChunks(0), _nextHeapChunk(0),
+      _nextCleanChunk(0), _cleanedWorkers(0), _keepMarks(false), _isSnapshot(false),
+      _isIncremental(false), _incrementalChecks(0), _nextDirtyRoot(0), _nextDirtyCheck(0) {}
+
+  static leakcheck& getInstance() {
+    static char buf[sizeof(leakcheck)];
+    static leakcheck* theOneTrueObject = new (buf) leakcheck();
+    return *theOneTrueObject;
+  }
+
+  bool doSlowLeakCheck(void* begin, void* end) { return checkLeaks(begin, end, false); }
+
+  // In the end of program, we can only check those non-freed objects.
+  // All of them are considered as memory leakage
+  bool doFastLeakCheck(void* begin, void* end) { return checkLeaks(begin, end, true); }
+
+  // A full check whose unreachable objects go to current leak snapshot, instead
+  // of being tracked for re-execution.
+  bool doSnapshotCheck(void* begin, void* end) {
+    _isSnapshot = true;
+    bool hasLeakage = checkLeaks(begin, end, true);
+    _isSnapshot = false;
+    return hasLeakage;
+  }
 
-  void searchHeapPointersInsideGlobals();
+  // In the end of program, all objects
+  // inside
+private:
+  static objectHeader* getObject(void* ptr) {
+    objectHeader* o = (objectHeader*)ptr;
+    return (o - 1);
+  }
 
-  bool doSlowLeakCheck(void* begin, void* end) {
+  bool checkLeaks(void* begin, void* end, bool isFullCheck) {
     _heapBegin = (unsigned long)begin + sizeof(objectHeader);
     _heapEnd = (unsigned long)end;
     _nonStartAddrs = 0;
     _totalLeakageSize = 0;
 
-    //    PRINT("doSlowLeakCheck now begin %p end %lx\n", begin, _heapEnd);
+    //    PRINT("checkLeaks now begin %p end %lx\n", begin, _heapEnd);
     // Search all existing registers to find possible heap pointers
     ucontext_t context;
 
     getcontext(&context);
-    //  PRINT("doSlowLeakCheck line %d\n", __LINE__);
+    //  PRINT("checkLeaks line %d\n", __LINE__);
 
-    searchHeapPointers(&context);
-    //  PRINT("doSlowLeakCheck line %d\n", __LINE__);
+    // Search the registers of all threads, and collect the stacks, the globals
+    // and the dirty pages.
+    prepareMarking(&context, isFullCheck);
+    //  PRINT("checkLeaks line %d\n", __LINE__);
 
-    // Search all stacks to find possible heap pointers
-    searchHeapPointersInsideStack(&context);
-    //  PRINT("doSlowLeakCheck line %d\n", __LINE__);
+    // Search the stacks and the globals, and traverse all possible heap pointers
+    // with all marking threads. Then they collect unreachable objects.
+    checkInParallel();
 
-    // Search the globals to find possible heap pointers
-    searchHeapPointersInsideGlobals();
-    // PRINT("doSlowLeakCheck line %d\n", __LINE__);
+    // Pages written by the check itself or by a rollback are dirty for the next check.
+    if(_isIncremental) {
+      dirtypages::getInstance().clear();
+    }
 
-    // Traverse all possible heap pointers inside unexplored sets.
-    traverseUnexploredList();
     return reportUnreachableNonfreedObjects();
   }
 
-  // In the end of program, we can only check those non-freed objects.
-  // All of them are considered as memory leakage
-  bool doFastLeakCheck(void* begin, void* end) {
-    _heapBegin = (unsigned long)begin;
-    _heapEnd = (unsigned long)end;
-    _totalLeakageSize = 0;
+  static void* markerThread(void* arg);
+
+  // Start the helper threads at the first leak check.
+  void initializeWorkers();
+
+  // Reset the deques, and split the stacks and the global regions into pieces.
+  // Decide whether this check is a full one.
+  void prepareMarking(ucontext_t* context, bool isFullCheck);
+
+  void addRootRegion(unsigned long begin, unsigned long end);
+
+  // Wake up the helper threads, check together with them and wait for them.
+  void checkInParallel();
+
+  // Before a full check, clean the marks of all objects, and wait for other threads.
+  void cleanMarks(int id);
+
+  // The marking loop of every thread.
+  void markObjects(int id);
+
+  // Search the marked objects on dirty pages.
+  void searchHeapPointersInsideDirtyPages(int id);
+
+  // Find non-freed objects that are not marked, in pieces of the heap or on dirty
+  // pages. Objects are enumerated with the block map.
+  void collectUnreachableObjects(int id);
+  void collectUnreachableObjectsInsideDirtyPages(int id);
+
+  // The overflow stacks are empty after marking. They keep the unreachable objects.
+  void collectUnreachableObject(objectHeader* object, int id) {
+    bool isLeakage;
 
-    return doSlowLeakCheck(begin, end);
-    //  return reportUnreachableNonfreedObjects();
+    // Marks are kept for the next incremental check.
+    if(_keepMarks) {
+      isLeakage = !object->isObjectFree() && !object->isObjectChecked();
+    } else {
+      isLeakage = object->checkLeakageAndClean();
+    }
+
+    if(isLeakage) {
+      _overflows[id].push((unsigned long)object->getStartPtr());
+    }
   }
 
-  // In the end of program, all objects
-  // inside
-private:
-  static objectHeader* getObject(void* ptr) {
-    objectHeader* o = (objectHeader*)ptr;
-    return (o - 1);
+  // Search the pieces of the stacks and the globals.
+  void searchHeapPointersInsideRoots(int id);
+
+  bool stealObject(int id, unsigned long* addr) {
+    for(int i = 1; i < _numWorkers; i++) {
+      if(_deques[(id + i) % _numWorkers].steal(addr)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Called when a thread has found no work. Return false when all threads are
+  // idle, since only a busy thread can push new objects.
+  bool waitForObjects() {
+    __atomic_add_fetch(&_idleWorkers, 1, __ATOMIC_SEQ_CST);
+
+    while(__atomic_load_n(&_idleWorkers, __ATOMIC_SEQ_CST) != _numWorkers) {
+      for(int i = 0; i < _numWorkers; i++) {
+        if(!_deques[i].isEmpty()) {
+          __atomic_sub_fetch(&_idleWorkers, 1, __ATOMIC_SEQ_CST);
+          return true;
+        }
+      }
+      Real::sched_yield();
+    }
+
+    return false;
   }
 
   // Check a heap object covering given addr
-  void exploreHeapObject(unsigned long addr) {
+  void exploreHeapObject(unsigned long addr, int id) {
+    // This object has been claimed when it was queued.
+    if(addr & CLAIMED_OBJECT) {
+      addr &= ~CLAIMED_OBJECT;
+      searchHeapPointers(addr, addr + getObject((void*)addr)->getObjectSize(), id);
+      return;
+    }
+
     // In most cases, this addr is the starting address of a heap object.
     objectHeader* object = getObject((void*)addr);
     unsigned long objectStart = 0;
@@ -109,11 +235,9 @@ private:
 
     if(!object->isGoodObject()) {
       // Current address is not the starting address of a heap object.
-      // To get the starting addresses of this object, we may rely on the
-      // help of sentinel map.
-      // Maybe we should check whether this object is an memaligned object?
+      // To get the starting addresses of this object, we rely on the block map.
       // PRINT("exploreHeapObject line %d\n", __LINE__);
-      if(sentinelmap::getInstance().findObjectStartAddr((void*)addr, &objectStart)) {
+      if(blockmap::getInstance().findObjectStart((void*)addr, &objectStart)) {
         //  PRINT("exploreHeapObject line %d objectStart %lx\n", __LINE__, objectStart);
         object = getObject((void*)objectStart);
 
@@ -123,7 +247,7 @@ private:
           object = NULL;
         }
       } else {
-        // PRINT("findObjectStartAddr failed on addr %lx at line %d\n", addr, __LINE__);
+        // PRINT("findObjectStart failed on addr %lx at line %d\n", addr, __LINE__);
         object = NULL;
       }
     } else {
@@ -146,26 +270,12 @@ private:
     assert(object->isGoodObject());
     assert(object->isValidAddr(addr));
 
-    // Get the end of object.
-    if(object->doCheckObject()) {
+    // Mark that this object are reachable from roots. Only the thread
+    // setting the mark searches this object.
+    if(!object->isObjectFree() && object->markObjectChecked()) {
       unsigned long end = objectStart + object->getObjectSize();
-      searchHeapPointers(objectStart, end);
+      searchHeapPointers(objectStart, end, id);
       //      PRINT("exploreHeapObject line %d addr %lx end %lx******\n", __LINE__, addr, end);
-
-      // Mark that this object are reachable from roots.
-      object->markObjectChecked();
-    }
-  }
-
-  void traverseUnexploredList() {
-    objectListType i;
-    unsigned long addr;
-
-    //    PRINT("traverseUnexploredList now empty %d\n", _unexploredObjects.empty());
-    while(_unexploredObjects.empty() != true) {
-      addr = _unexploredObjects.front();
-      _unexploredObjects.pop_front();
-      exploreHeapObject(addr);
     }
   }
 
@@ -174,37 +284,40 @@ private:
     // Update the total size.
     // We only start to rollback when leakage is too large?
     memtrack::getInstance().insert(ptr, size, OBJECT_TYPE_LEAK);
+#if defined(DETECT_ALLOCATION_SITES)
+    memtrack::getInstance().addLeak(sitemap::getInstance().getSite(ptr), size);
+#endif
   }
 
   // In the end, we should report all of those non-reachable non-freed objects.
+  // They are collected by the marking threads, but only current thread can
+  // track them.
   bool reportUnreachableNonfreedObjects() {
-    unsigned long* ptr, *stop;
     bool hasLeakage = false;
 
-    // We basically report those non-checked and non-freed objects in
-    // the system by traverse all objects.
-    ptr = (unsigned long*)_heapBegin;
-    stop = (unsigned long*)_heapEnd;
+    for(int i = 0; i < _numWorkers; i++) {
+      unsigned long ptr;
 
-    // For the last object, we may use the bitmap to help us.
-    // For example, we may only allocate some of a chunk,
-    // Then we know whether we should move forward or not.
-    objectHeader* object;
-    while(ptr < stop) {
-      // We find a object header
-      if(*ptr == xdefines::SENTINEL_WORD && sentinelmap::getInstance().isSet(ptr)) {
-        object = getObject((void*)++ptr);
+      while(_overflows[i].pop(&ptr)) {
+        objectHeader* object = getObject((void*)ptr);
 
-        if(object->checkLeakageAndClean()) {
+        if(_isSnapshot) {
           hasLeakage = true;
+          leaksnapshot::getInstance().addObject((void*)ptr, object->getObjectSize(),
+                                                object->getSize());
+          continue;
+        }
+
+        // The program continues after a re-execution, so a known leak is found again.
+        if(memtrack::getInstance().isLeak((void*)ptr)) {
+          continue;
+        }
+
+        hasLeakage = true;
 #ifndef EVALUATING_PERF
-          // Adding this object to the global leakage map, which should be tracked in re-execution
-          insertLeakageMap(object->getStartPtr(), object->getObjectSize(), object->getSize());
+        // Adding this object to the global leakage map, which should be tracked in re-execution
+        insertLeakageMap((void*)ptr, object->getObjectSize(), object->getSize());
 #endif
-        }
-        ptr = (unsigned long*)object->getNextObject();
-      } else {
-        ptr++;
       }
     }
 
@@ -213,22 +326,43 @@ private:
     return hasLeakage;
   }
 
+  // The heap is allocated from its beginning, thus _heapEnd, the current
+  // position of the heap, also bounds all allocated chunks.
   bool isPossibleHeapPointer(unsigned long addr) {
     return (addr > _heapBegin && addr < _heapEnd) ? true : false;
   }
 
   // Insert an address into unexplored set.
-  void checkInsertUnexploredList(unsigned long addr) {
-    if(isPossibleHeapPointer(addr)) {
-      //    PRINT("IIIIIIIIIIIIIunexplored list with addr %lx\n", addr);
-      // lock();
-      _unexploredObjects.push_back(addr);
-      // unlock();
+  void checkInsertUnexploredList(unsigned long addr, int id) {
+    if(!isPossibleHeapPointer(addr)) {
+      return;
+    }
+
+    //    PRINT("IIIIIIIIIIIIIunexplored list with addr %lx\n", addr);
+    // An aligned address is mostly the start of an object. Claim the object now,
+    // so that it is queued only once and a checked object is not queued at all.
+    // Other addresses can only point to the inside of an object, which is found later.
+    if((addr & xdefines::WORD_SIZE_MASK) == 0) {
+      objectHeader* object = getObject((void*)addr);
+
+      if(object->isGoodObject() && object->isValidAddr(addr)) {
+        if(!object->markObjectChecked()) {
+          return;
+        }
+        addr |= CLAIMED_OBJECT;
+      }
+    } else {
+      addr &= ~CLAIMED_OBJECT;
+    }
+
+    // Only the deque can be stolen from. When it is full, keep the address in a private stack.
+    if(!_deques[id].push(addr)) {
+      _overflows[id].push(addr);
     }
   }
 
   // Seatch heap pointers inside a memory region
-  void searchHeapPointers(unsigned long start, unsigned long end) {
+  void searchHeapPointers(unsigned long start, unsigned long end, int id) {
     assert(((intptr_t)start) % sizeof(unsigned long) == 0);
 
     // It is good if the end is not aligned caused by non-aligned malloc.
@@ -238,56 +372,33 @@ private:
     unsigned long* ptr = (unsigned long*)start;
     // PRINT("searchHeapPointers at ptr %p stop %p\n", ptr, stop);
     while(ptr < stop) {
-      checkInsertUnexploredList(*ptr);
+      checkInsertUnexploredList(*ptr, id);
       ptr++;
     }
   }
 
   // Search heap pointers inside registers set.
-  void searchHeapPointers(ucontext_t* context) {
+  void searchHeapPointers(ucontext_t* context, int id) {
     // TODO: 32-bit implementation
 #ifndef X86_32BIT
     for(int i = REG_R8; i <= REG_RCX; i++) {
-      checkInsertUnexploredList(context->uc_mcontext.gregs[i]);
-    }
-#endif
-  }
-
-  // Seearch heap pointers inside all stack area
-  void searchHeapPointersInsideStacks() {
-#if 0
-    threadmap::aliveThreadIterator i;
-    for(i = threadmap::getInstance().begin();
-      i != threadmap::getInstance().end(); i++)
-    {
-      thread_t * thread = i.getThread();
+      checkInsertUnexploredList(context->uc_mcontext.gregs[i], id);
     }
 #endif
   }
 
-  void searchHeapPointersInsideStack(void* start) {
-    void* stop = current->stackTop;
-
-    // PRINT("search heap pointers inside stack now. start %p stop %p\n", start, stop);
-    searchHeapPointers((intptr_t)start, (intptr_t)stop);
-  }
+  // Seearch heap pointers inside the registers of all threads, and add their stacks to the roots.
+  void searchHeapPointersInsideThreads(ucontext_t* context);
 
   void lock() { _lck.lock(); }
 
   void unlock() { _lck.unlock(); }
 
-  typedef std::list<unsigned long, HL::STLAllocator<unsigned long, InternalHeapAllocator>>
-  objectListType;
-  objectListType _unexploredObjects;
 
   size_t _totalLeakageSize;
 
   spinlock _lck;
 
-#define MAXIMUM_SIZE_POWER 30
-  // From 2^4 to 2 ^ 30
-  objectListType _sizeList[MAXIMUM_SIZE_POWER];
-
   // It is used to count how many non-start addresses in
   // the calculation of reachability
   size_t _nonStartAddrs;
@@ -295,6 +406,38 @@ private:
   //  typedef std::set<struct memoryRegion *, less<void *
   unsigned long _heapBegin;
   unsigned long _heapEnd;
+
+  // Marking threads. The first one is the thread doing the leak check.
+  workdeque _deques[xdefines::LEAK_MARK_THREADS];
+  worklist _overflows[xdefines::LEAK_MARK_THREADS];
+  int _numWorkers;
+  int _idleWorkers;
+
+  // Helper threads wait for a new generation, and report when they are done.
+  pthread_mutex_t _mutex;
+  pthread_cond_t _startCond;
+  pthread_cond_t _doneCond;
+  int _finishedHelpers;
+  unsigned long _generation;
+
+  rootRegion _regions[xdefines::NUM_GLOBALS + xdefines::MAX_ALIVE_THREADS];
+  int _totalRegions;
+  unsigned long _totalRootChunks;
+  unsigned long _nextRootChunk;
+
+  unsigned long _totalHeapChunks;
+  unsigned long _nextHeapChunk;
+  unsigned long _nextCleanChunk;
+  int _cleanedWorkers;
+
+  // An incremental check works on dirty pages, which are taken in groups.
+  // Without soft-dirty bits, marks are cleaned when unreachable objects are collected.
+  bool _keepMarks;
+  bool _isSnapshot;
+  bool _isIncremental;
+  int _incrementalChecks;
+  unsigned long _nextDirtyRoot;
+  unsigned long _nextDirtyCheck;
 };
 
 #endif
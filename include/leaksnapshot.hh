@@ -0,0 +1,91 @@
+#if !defined(DOUBLETAKE_LEAKSNAPSHOT_H)
+#define DOUBLETAKE_LEAKSNAPSHOT_H
+
+/*
+ * @file   leaksnapshot.h
+ * @brief  Leak snapshots for programs that never exit.
+ *         A snapshot is a full reachability check at the end of an epoch, which
+ *         reports unreachable objects grouped by their allocation site with byte
+ *         totals, and the change since the previous snapshot. It never rolls back.
+ *         A snapshot is requested by dt_leak_snapshot(), which ends current epoch,
+ *         by the signal in DOUBLETAKE_LEAK_SNAPSHOT_SIGNAL, or by creating the file
+ *         in DOUBLETAKE_LEAK_SNAPSHOT_FILE. The last two are taken at the next end
+ *         of an epoch, and the file is removed then.
+ *         Objects are grouped by the allocation sites stamped with
+ *         DETECT_ALLOCATION_SITES. Otherwise, objects do not record their allocation
+ *         sites, so objects of the same requested size are grouped together.
+ * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
+ */
+
+#include <limits.h>
+#include <stddef.h>
+
+#include <new>
+
+#include "xdefines.hh"
+
+class leaksnapshot {
+  // The group of objects whose allocation sites are unknown.
+  static const size_t UNKNOWN_SITE = (size_t)-1;
+
+  struct leakGroup {
+    size_t key;
+    size_t objects;
+    size_t bytes;
+    // Totals in the previous snapshot.
+    size_t lastObjects;
+    size_t lastBytes;
+  };
+
+public:
+  leaksnapshot()
+    : _isRequested(false), _hasControlFile(false), _groups(NULL), _spareGroups(NULL),
+      _totalGroups(0), _snapshots(0), _objects(0), _bytes(0), _lastObjects(0), _lastBytes(0) {}
+
+  static leaksnapshot& getInstance() {
+    static char buf[sizeof(leaksnapshot)];
+    static leaksnapshot* theOneTrueObject = new (buf) leaksnapshot();
+    return *theOneTrueObject;
+  }
+
+  // Install the triggers in the environment.
+  void initialize();
+
+  // Ask for a snapshot at the next end of an epoch. It is safe in a signal handler.
+  void request() { __atomic_store_n(&_isRequested, true, __ATOMIC_RELAXED); }
+
+  // Called at the end of an epoch.
+  bool isRequested();
+
+  // Start a new snapshot, and keep the totals of the last one.
+  void begin();
+
+  // Add an unreachable object, in the thread doing the leak check.
+  void addObject(void* ptr, size_t size, size_t blockSize);
+
+  // Print the largest groups and the change since the previous snapshot.
+  void report();
+
+private:
+  static void signalHandler(int sig);
+
+  leakGroup* findGroup(size_t key);
+
+  bool _isRequested;
+  bool _hasControlFile;
+  char _controlFile[PATH_MAX];
+
+  // An open addressing table of LEAK_SNAPSHOT_GROUPS groups, and the table of
+  // the previous snapshot.
+  leakGroup* _groups;
+  leakGroup* _spareGroups;
+  int _totalGroups;
+
+  int _snapshots;
+  size_t _objects;
+  size_t _bytes;
+  size_t _lastObjects;
+  size_t _lastBytes;
+};
+
+#endif
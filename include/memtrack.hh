@@ -12,6 +12,7 @@
 #include "hashmap.hh"
 #include "log.hh"
 #include "mm.hh"
+#include "slab.hh"
 #include "spinlock.hh"
 #include "xdefines.hh"
 
@@ -98,7 +99,7 @@ public:
     return *theOneTrueObject;
   }
 
-  memtrack() : _initialized(false) {}
+  memtrack() : _initialized(false), _unknownLeaks(0), _unknownLeakBytes(0) {}
 
   void initialize(void) {
     _initialized = true;
@@ -129,7 +130,7 @@ public:
     if(_trackMap.find(start, sizeof(start), &object)) {
       objectExist = true;
     } else {
-      object = (trackObject*)InternalHeap::getInstance().malloc(sizeof(trackObject));
+      object = new (slab<trackObject>::getInstance().alloc()) trackObject();
       _trackMap.insert(start, sizeof(start), object);
     }
 
@@ -141,12 +142,35 @@ public:
   // a malloc or free operation.
   // Then we can match to find whether it is good to tell
   void check(void* start, size_t size, memTrackType type);
+
+  // Whether an object is tracked as a leak, which is reported in a re-execution.
+  bool isLeak(void* start) {
+    trackObject* object;
+    return _initialized && _trackMap.find(start, sizeof(start), &object) && object->hasLeak();
+  }
+
   void print(void* start, faultyObjectType type);
+
+  // Count a leaked object at its allocation site.
+  void addLeak(unsigned int site, size_t size);
+
+  // Print the allocation sites of leaked objects, with their objects and bytes.
+  void reportLeaks();
+
+  // Called before every re-execution, which counts the leaked objects again.
+  void clearLeaks() {
+    callsitetable::getInstance().clearObjects();
+    _unknownLeaks = 0;
+    _unknownLeakBytes = 0;
+  }
   faultyObjectType getFaultType(void* start, void* faultyaddr);
 
 private:
   bool _initialized;
   HashMap<void*, trackObject*, spinlock, InternalHeapAllocator> _trackMap;
+  // Leaked objects whose sites are not in the table of callsites.
+  size_t _unknownLeaks;
+  size_t _unknownLeakBytes;
 };
 
 #endif
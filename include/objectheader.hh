@@ -15,6 +15,12 @@
  * @author Emery Berger <http://www.cs.umass.edu/~emery>
  * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
  */
+// Flags kept in the low bits of the block size.
+#define OBJECT_CHECKED_WORD (0x1)
+#define OBJECT_CHECKED_WORD_MASK (0xFFFFFFFE)
+#define OBJECT_FRESH_WORD (0x2)
+#define OBJECT_FLAGS_MASK (0xFFFFFFFC)
+
 class objectHeader {
 public:
   objectHeader(size_t sz)
@@ -26,7 +32,10 @@ public:
 #endif
   }
 
-  size_t getSize() { return (size_t)_blockSize; }
+  size_t getSize() { return (size_t)(_blockSize & OBJECT_FLAGS_MASK); }
+
+  // Change the block size, keeping the flags.
+  void setSize(size_t sz) { _blockSize = (unsigned int)sz | (_blockSize & ~OBJECT_FLAGS_MASK); }
 
   size_t getObjectSize() { return (size_t)_objectSize; }
 
@@ -49,17 +58,32 @@ public:
 
   bool isObjectFree() { return (_objectSize == 0); }
 
-#define OBJECT_CHECKED_WORD (0x1)
-#define OBJECT_CHECKED_WORD_MASK (0xFFFFFFFE)
-
   void* getNextObject() {
-    return ((void*)((intptr_t) & _sentinel + 4 * xdefines::SENTINEL_SIZE + _blockSize));
+    return ((void*)((intptr_t) & _sentinel + 4 * xdefines::SENTINEL_SIZE + getSize()));
   }
 
+  // A fresh block is carved from never-used heap memory, thus its content
+  // is still zero except the link word of a free list. The mark is cleared
+  // when the block is allocated.
+  void markObjectFresh() { _blockSize |= OBJECT_FRESH_WORD; }
+
+  void cleanObjectFresh() { _blockSize &= ~OBJECT_FRESH_WORD; }
+
+  bool isObjectFresh() { return (_blockSize & OBJECT_FRESH_WORD) ? true : false; }
+
   // Since _blockSize is always power of 2 in our allocator,
   // thus we are using the least significant bit to mark whether
   // an heap object is reachable or not.
-  void markObjectChecked() { _blockSize |= OBJECT_CHECKED_WORD; }
+  // Leak checking threads may reach an object at the same time. Only the
+  // thread that sets the mark gets true, and scans this object.
+  // A mark can stay from an earlier check, so it is read before it is written.
+  bool markObjectChecked() {
+    if(isObjectChecked()) {
+      return false;
+    }
+    unsigned int old = __atomic_fetch_or(&_blockSize, OBJECT_CHECKED_WORD, __ATOMIC_RELAXED);
+    return (old & OBJECT_CHECKED_WORD) ? false : true;
+  }
 
   void cleanObjectChecked() { _blockSize &= OBJECT_CHECKED_WORD_MASK; }
 
@@ -85,13 +109,8 @@ public:
     return isLeakage;
   }
 
-  inline bool isValidObjectSize(unsigned long size) {
-    bool isValid = false;
-    if(size != 0) {
-      isValid = ((size & (size - 1)) == 0);
-    }
-    return isValid;
-  }
+  // Only the block size is a power of 2. Any requested size of an allocated object is valid.
+  inline bool isValidObjectSize(unsigned long size) { return (size != 0); }
 
   inline bool isValidAddr(unsigned long addr) {
     unsigned long objectSize = getObjectSize();
@@ -113,7 +132,7 @@ public:
 private:
   // If a block is larger than 4G, we can't support
   // We are using the lsb of _blockSize bit is marked whether
-  // an object is checked or not.
+  // an object is checked or not, and the next bit whether it is fresh.
   unsigned int _blockSize;
   unsigned int _objectSize;
 
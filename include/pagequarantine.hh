@@ -0,0 +1,195 @@
+#if !defined(DOUBLETAKE_PAGEQUARANTINE_H)
+#define DOUBLETAKE_PAGEQUARANTINE_H
+
+/*
+ * @file   pagequarantine.h
+ * @brief  Quarantine for large freed objects.
+ *         Pages that lie entirely inside a freed object are protected with PROT_NONE,
+ *         so that a use-after-free faults on the offending instruction. Only the
+ *         partial pages at both ends are filled with canaries.
+ *         Objects are released in a FIFO order when the slots are used up or the
+ *         total size exceeds its own budget, which is separate from the budget of
+ *         the per-thread quarantine lists.
+ *         Since the heap is copied at every checkpoint and on rollback, all pages
+ *         are made accessible around those copies, see xmemory.
+ * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+
+#include <new>
+
+#include "canary.hh"
+#include "log.hh"
+#include "real.hh"
+#include "spinlock.hh"
+#include "xdefines.hh"
+
+class pagequarantine {
+  struct protectedObject {
+    void* ptr;
+    size_t size;
+    // Page-aligned part of this object.
+    void* pages;
+    size_t pagesSize;
+    bool isProtected;
+  };
+
+public:
+  pagequarantine()
+    : _totalSize(0), _totalSizeBackup(0), _availIndex(0), _availIndexBackup(0),
+      _LRIndex(0), _LRIndexBackup(0) {}
+
+  static pagequarantine& getInstance() {
+    static char buf[sizeof(pagequarantine)];
+    static pagequarantine* theOneTrueObject = new (buf) pagequarantine();
+    return *theOneTrueObject;
+  }
+
+  // Return false if this object should be freed immediately.
+  bool addFreeObject(void* ptr, size_t size) {
+    if(size > xdefines::PAGE_QUARANTINE_TOTAL_SIZE) {
+      return false;
+    }
+
+    protectedObject object;
+    object.ptr = ptr;
+    object.size = size;
+    object.pages = (void*)alignup((intptr_t)ptr, xdefines::PageSize);
+    object.pagesSize =
+        aligndown((intptr_t)ptr + size, xdefines::PageSize) - (intptr_t)object.pages;
+    object.isProtected = true;
+
+    markEnds(&object);
+
+    _lock.lock();
+
+    // Evict old objects until there is enough room.
+    while(_totalSize + size > xdefines::PAGE_QUARANTINE_TOTAL_SIZE || !hasAvailSlot()) {
+      evictLRObject();
+    }
+
+    setProtection(&object, PROT_NONE);
+    _objects[_availIndex] = object;
+
+    _totalSize += size;
+    _availIndex = incrIndex(_availIndex);
+
+    _lock.unlock();
+    return true;
+  }
+
+  // Called from the SEGV handler. Return true if the fault is on a protected object.
+  bool handleFault(void* addr, ucontext_t* context);
+
+  // Those functions are only called when all other threads are stopped.
+  void backup() {
+    _availIndexBackup = _availIndex;
+    _LRIndexBackup = _LRIndex;
+    _totalSizeBackup = _totalSize;
+
+    memcpy(_objectsBackup, _objects, sizeof(_objects));
+  }
+
+  void restore() {
+    _availIndex = _availIndexBackup;
+    _LRIndex = _LRIndexBackup;
+    _totalSize = _totalSizeBackup;
+
+    memcpy(_objects, _objectsBackup, sizeof(_objects));
+  }
+
+  // Make all protected pages accessible before the heap is copied.
+  void unprotectAll() {
+    for(size_t i = _LRIndex; i != _availIndex; i = incrIndex(i)) {
+      if(_objects[i].isProtected) {
+        setProtection(&_objects[i], PROT_READ | PROT_WRITE);
+      }
+    }
+  }
+
+  void protectAll() {
+    for(size_t i = _LRIndex; i != _availIndex; i = incrIndex(i)) {
+      if(_objects[i].isProtected) {
+        setProtection(&_objects[i], PROT_NONE);
+      }
+    }
+  }
+
+private:
+  void realfree(void* ptr);
+  void reportUseAfterFree(void* addr, protectedObject* object, ucontext_t* context);
+  bool checkEnds(protectedObject* object);
+
+  inline bool hasAvailSlot() { return incrIndex(_availIndex) != _LRIndex; }
+
+  inline size_t incrIndex(size_t index) { return (index + 1) % xdefines::PAGE_QUARANTINE_SLOTS; }
+
+  static inline intptr_t alignup(intptr_t addr, size_t align) {
+    return (addr + align - 1) & ~((intptr_t)align - 1);
+  }
+
+  static inline intptr_t aligndown(intptr_t addr, size_t align) {
+    return addr & ~((intptr_t)align - 1);
+  }
+
+  static inline void setProtection(protectedObject* object, int prot) {
+    if(object->pagesSize != 0) {
+      Real::mprotect(object->pages, object->pagesSize, prot);
+    }
+  }
+
+  // Fill the unprotected head and tail of an object with canaries.
+  static inline void markEnds(protectedObject* object) {
+    intptr_t pagesEnd = (intptr_t)object->pages + object->pagesSize;
+
+    fillCanary(object->ptr,
+               ((intptr_t)object->pages - (intptr_t)object->ptr) / sizeof(unsigned long));
+    fillCanary((void*)pagesEnd,
+               ((intptr_t)object->ptr + object->size - pagesEnd) / sizeof(unsigned long));
+  }
+
+  // Remove the least recent object. The lock is held on entry and on return, but
+  // it is released while the object is checked, since an error ends the epoch.
+  void evictLRObject() {
+    protectedObject object = _objects[_LRIndex];
+
+    _totalSize -= object.size;
+    _LRIndex = incrIndex(_LRIndex);
+
+    _lock.unlock();
+
+    if(object.isProtected) {
+      setProtection(&object, PROT_READ | PROT_WRITE);
+    }
+
+    // The object is only freed if nobody has touched its ends.
+    if(checkEnds(&object)) {
+      realfree(object.ptr);
+    }
+
+    _lock.lock();
+  }
+
+  protectedObject _objects[xdefines::PAGE_QUARANTINE_SLOTS];
+  protectedObject _objectsBackup[xdefines::PAGE_QUARANTINE_SLOTS];
+
+  size_t _totalSize;
+  size_t _totalSizeBackup;
+
+  // An index which identifies a slot is available
+  size_t _availIndex;
+  size_t _availIndexBackup;
+
+  // An index which indicates which object is least recent object.
+  size_t _LRIndex;
+  size_t _LRIndexBackup;
+
+  spinlock _lock;
+};
+
+#endif
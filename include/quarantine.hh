@@ -16,6 +16,9 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "canary.hh"
+#include "pagequarantine.hh"
+#include "quarantinebudget.hh"
 #include "watchpoint.hh"
 #include "xdefines.hh"
 
@@ -25,7 +28,11 @@ inline size_t getMarkWords(size_t size) {
   assert(size % sizeof(unsigned long) == 0);
 
   // Get a size for checking
+#if defined(DETECT_USAGE_AFTER_FREE_WHOLE)
+  if(size > xdefines::FREE_OBJECT_WHOLE_CANARY_SIZE) {
+#else
   if(size > xdefines::FREE_OBJECT_CANARY_SIZE) {
+#endif
     words = xdefines::FREE_OBJECT_CANARY_WORDS;
   } else {
     words = size / sizeof(unsigned long);
@@ -33,30 +40,24 @@ inline size_t getMarkWords(size_t size) {
   return words;
 }
 
-inline void markFreeObject(void* ptr, size_t size) {
-  unsigned long* addr = (unsigned long*)ptr;
-  size_t words = getMarkWords(size);
-
-  for(auto i = 0; i < (int) words; i++) {
-    addr[i] = xdefines::SENTINEL_WORD;
-  }
-}
+inline void markFreeObject(void* ptr, size_t size) { fillCanary(ptr, getMarkWords(size)); }
 
 inline bool hasUsageAfterFree(freeObject* object) {
   // void * ptr, size_t size) {
   bool hasUAF = false;
-  int words = getMarkWords(object->size);
+  size_t words = getMarkWords(object->size);
 
   // We only check specified size
   unsigned long* addr = (unsigned long*)object->ptr;
 
-  for(auto i = 0; i < (int) words; i++) {
-    if(addr[i] != xdefines::SENTINEL_WORD) {
-      hasUAF = true;
+  // Only new faults count, like in the check of sentinels at the end of an epoch.
+  for(size_t i = findCanaryMismatch(addr, 0, words); i < words;
+      i = findCanaryMismatch(addr, i + 1, words)) {
 //      printf("DoubleTake: Use-after-free detected at address %p.\n", &addr[i]);
-      // install watchpoints on this point.
-      watchpoint::getInstance().addWatchpoint(&addr[i], addr[i], OBJECT_TYPE_USEAFTERFREE,
-                                              object->ptr, object->size);
+    // install watchpoints on this point.
+    if(watchpoint::getInstance().addWatchpoint(&addr[i], addr[i], OBJECT_TYPE_USEAFTERFREE,
+                                               object->ptr, object->size)) {
+      hasUAF = true;
     }
   }
 
@@ -66,9 +67,9 @@ inline bool hasUsageAfterFree(freeObject* object) {
 class quarantine {
 public:
   quarantine()
-    : _objects(nullptr), _objectsBackup(nullptr), _objectsSize(0),
+    : _objects(nullptr), _undoLog(nullptr), _objectsSize(0),
       _totalSize(0), _totalSizeBackup(0), _availIndex(0), _availIndexBackup(0),
-      _LRIndex(0), _LRIndexBackup(0) {}
+      _LRIndex(0), _LRIndexBackup(0), _checkpointCount(0), _undoCount(0), _seq(0) {}
 
   void initialize(void* start, size_t size) {
     _availIndex = 0;
@@ -77,77 +78,173 @@ public:
     _objectsSize = size;
 
     _objects = (freeObject*)start;
-    _objectsBackup = (freeObject*)((intptr_t)start + size);
+    _undoLog = (freeObject*)((intptr_t)start + size);
     // PRINF("QUARANTINE list initialize _objects at %p******************************\n", _objects);
+
+    backup();
   }
 
+  // The checkpoint only saves the cursors. Since objects are added at _availIndex
+  // and evicted at _LRIndex, a slot that is alive at the checkpoint is only
+  // changed when it is reused by a later free. The old content of such a slot is
+  // saved into the undo log before it is overwritten, see saveSlot().
   void backup() {
     _availIndexBackup = _availIndex;
     _LRIndexBackup = _LRIndex;
     _totalSizeBackup = _totalSize;
 
-    memcpy(_objectsBackup, _objects, _objectsSize);
+    _checkpointCount =
+        (_availIndex + xdefines::QUARANTINE_BUF_SIZE - _LRIndex) % xdefines::QUARANTINE_BUF_SIZE;
+    _undoCount = 0;
   }
 
   void restore() {
+    writeBegin();
+
+    // Overwritten slots are reused in FIFO order, starting from _LRIndexBackup.
+    for(size_t i = 0; i < _undoCount; i++) {
+      _objects[(_LRIndexBackup + i) % xdefines::QUARANTINE_BUF_SIZE] = _undoLog[i];
+    }
+
     _availIndex = _availIndexBackup;
     _LRIndex = _LRIndexBackup;
+
+    // Give back the objects which are added in this epoch, or borrow again for
+    // those which have been freed.
+    quarantinebudget::getInstance().giveback(_totalSize);
+    quarantinebudget::getInstance().reclaim(_totalSizeBackup);
     _totalSize = _totalSizeBackup;
 
-    memcpy(_objects, _objectsBackup, _objectsSize);
+    // The re-execution will overwrite the same slots again.
+    _undoCount = 0;
+
+    writeEnd();
   }
 
   // We will check whether an object is added into free list or not.
   // If not, then we can actuall freed an object.
 
   bool addFreeObject(void* ptr, size_t size) {
-    if(size >= xdefines::QUARANTINE_TOTAL_SIZE) {
-      return false;
+    // Large objects are protected by pages instead.
+    if(size >= xdefines::PAGE_QUARANTINE_MIN_SIZE) {
+      return pagequarantine::getInstance().addFreeObject(ptr, size);
     }
-    // Check whether we need to free some objects
-    freeObject* object = &_objects[_availIndex];
-    object->ptr = ptr;
-    object->size = size;
 
     // PRINF("ADDDDDDDDDDDDDD free object ptr %p size %d\n", ptr, size);
     // Mark free object
     markFreeObject(ptr, size);
 
+    writeBegin();
+
     _totalSize += size;
+    quarantinebudget::getInstance().borrow(size);
+
+    // Check whether we need to free some objects.
+    // Only objects evicted because of the budget may stay for another round, and
+    // at most once in a free(), so that the list is walked only once.
+    size_t retainable = getDistance(_LRIndex, _availIndex);
+    while(true) {
+      bool isFull = !hasAvailSlot();
+
+      if(!isFull && !isOverBudget()) {
+        break;
+      }
 
-    while(_totalSize > xdefines::QUARANTINE_TOTAL_SIZE || !hasAvailSlot()) {
-      freeLRObject();
+      if(freeLRObject(!isFull && retainable > 0)) {
+        retainable--;
+      }
     }
 
-    _availIndex = incrIndex(_availIndex);
+    appendObject(ptr, size, 0);
+
+    writeEnd();
     return true;
   }
 
+  // A thread can always keep its reserve. Beyond that, it evicts its own objects
+  // when all threads together use more than the shared budget.
+  inline bool isOverBudget() {
+    return _LRIndex != _availIndex && _totalSize > xdefines::QUARANTINE_THREAD_RESERVE &&
+           quarantinebudget::getInstance().isOverBudget();
+  }
+
+  inline void appendObject(void* ptr, size_t size, int rounds) {
+    saveSlot(_availIndex);
+
+    freeObject* object = &_objects[_availIndex];
+    object->ptr = ptr;
+    object->size = size;
+    object->rounds = rounds;
+
+    _availIndex = incrIndex(_availIndex);
+  }
+
   inline bool hasAvailSlot() {
     return (((_availIndex + 1) % xdefines::QUARANTINE_BUF_SIZE) != _LRIndex);
   }
 
   inline freeObject* getLRObject() { return &_objects[_LRIndex]; }
 
+  // Save a slot that was alive at the checkpoint before it is reused.
+  // Only the first reuse in an epoch is recorded, so the undo log never
+  // has more entries than the quarantine list.
+  inline void saveSlot(size_t index) {
+    if(_undoCount < _checkpointCount &&
+       index == (_LRIndexBackup + _undoCount) % xdefines::QUARANTINE_BUF_SIZE) {
+      _undoLog[_undoCount++] = _objects[index];
+    }
+  }
+
   inline int incrIndex(int index) { return (index + 1) % xdefines::QUARANTINE_BUF_SIZE; }
 
-  inline void freeLRObject() {
+  // Return true if the object is kept for another round.
+  inline bool freeLRObject(bool canRetain) {
     // Get the least recent object and verify whether
     // usage-after-free has been detected?
     freeObject* object = getLRObject();
 
-    // No usage-after-free operation?
-    if(!hasUsageAfterFree(object)) {
-      // Calling actual heap object to free this object.
-      realfree(object->ptr);
+    // A use-after-free error ends the epoch, so that the rollback watches it.
+    // If the epoch is committed anyway, the list may have been trimmed meanwhile,
+    // and the fault is watched already when the object is checked again.
+    if(hasUsageAfterFree(object) && commit()) {
+      return false;
+    }
+
+    _LRIndex = incrIndex(_LRIndex);
+
+    // Objects like those with use-after-free errors are kept for
+    // QUARANTINE_HOT_ROUNDS more rounds, if there is a free slot.
+    if(canRetain && object->rounds < xdefines::QUARANTINE_HOT_ROUNDS &&
+       quarantinebudget::getInstance().isHotObject(object->ptr, object->size)) {
+      appendObject(object->ptr, object->size, object->rounds + 1);
+      return true;
+    }
+
+    evictObject(object);
+    return false;
+  }
+
+  // Free the least recent objects until the list holds at most "size" bytes.
+  // This is called when all threads are stopped, for the lists of idle threads.
+  // Return false if an object has a use-after-free error.
+  bool trim(size_t size) {
+    bool isClean = true;
+
+    writeBegin();
+    while(_totalSize > size && _LRIndex != _availIndex) {
+      freeObject* object = getLRObject();
+
+      if(hasUsageAfterFree(object)) {
+        isClean = false;
+        break;
+      }
 
-      // Update corresponding size and object
-      _totalSize -= object->size;
       _LRIndex = incrIndex(_LRIndex);
-    } else {
-      // Calling the rollback.
-      rollback();
+      evictObject(object);
     }
+    writeEnd();
+
+    return isClean;
   }
 
   inline freeObject* retrieveLRObject() {
@@ -165,6 +262,51 @@ public:
     return object;
   }
 
+  // Check up to "count" objects for the background verifier, starting from the
+  // slot "*cursor". This runs concurrently with the owner thread, so every
+  // result is only used if the sequence number has not changed meanwhile,
+  // i.e., the object has stayed in the quarantine while it is checked.
+  // Return true if a corrupted object is found, which is copied to "corrupted".
+  bool verifyObjects(size_t* cursor, int count, freeObject* corrupted) {
+    for(int i = 0; i < count; i++) {
+      unsigned long seq = __atomic_load_n(&_seq, __ATOMIC_ACQUIRE);
+      if(seq & 1) {
+        return false;
+      }
+
+      size_t lr = __atomic_load_n(&_LRIndex, __ATOMIC_RELAXED);
+      size_t avail = __atomic_load_n(&_availIndex, __ATOMIC_RELAXED);
+      size_t index = *cursor;
+
+      // Start over from the least recent object if the cursor is not in the list.
+      if(getDistance(lr, index) >= getDistance(lr, avail)) {
+        index = lr;
+      }
+      if(index == avail) {
+        *cursor = index;
+        return false;
+      }
+
+      freeObject object = _objects[index];
+      if(!isSequenceValid(seq)) {
+        return false;
+      }
+
+      size_t words = getMarkWords(object.size);
+      bool isCorrupted = (findCanaryMismatch(object.ptr, 0, words) < words);
+      if(!isSequenceValid(seq)) {
+        return false;
+      }
+
+      *cursor = incrIndex(index);
+      if(isCorrupted) {
+        *corrupted = object;
+        return true;
+      }
+    }
+    return false;
+  }
+
   bool finalUAFCheck() {
     bool hasUAF = false;
     int UAFErrors = 0;
@@ -172,6 +314,7 @@ public:
 
     //    PRINF("FFFFFFFFFFFinal check\n");
 
+    writeBegin();
     while((object = retrieveLRObject())) {
       if(hasUsageAfterFree(object)) {
         UAFErrors++;
@@ -182,16 +325,46 @@ public:
         }
       }
     }
+    writeEnd();
 
     return hasUAF;
   }
 
 private:
+  inline void evictObject(freeObject* object) {
+    // Calling actual heap object to free this object.
+    realfree(object->ptr);
+
+    // Update corresponding size and object
+    _totalSize -= object->size;
+    quarantinebudget::getInstance().giveback(object->size);
+  }
+
   void realfree(void* ptr);
-  void rollback();
+  // Return false in the re-execution, which goes on with the object evicted.
+  bool commit();
+
+  // The sequence number is odd while the owner thread changes the list.
+  // A rollback may leave it odd, so restore() always moves to the next odd number.
+  inline void writeBegin() {
+    __atomic_store_n(&_seq, (_seq + 1) | 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+  }
+
+  inline void writeEnd() { __atomic_store_n(&_seq, _seq + 1, __ATOMIC_RELEASE); }
+
+  inline bool isSequenceValid(unsigned long seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&_seq, __ATOMIC_RELAXED) == seq;
+  }
+
+  inline size_t getDistance(size_t from, size_t to) {
+    return (to + xdefines::QUARANTINE_BUF_SIZE - from) % xdefines::QUARANTINE_BUF_SIZE;
+  }
 
   freeObject* _objects;
-  freeObject* _objectsBackup;
+  // Old content of checkpointed slots that are reused in this epoch.
+  freeObject* _undoLog;
 
   size_t _objectsSize;
 
@@ -205,6 +378,14 @@ private:
   // An index which indicates which object is least recent object.
   size_t _LRIndex;
   size_t _LRIndexBackup;
+
+  // How many objects are in the list at the checkpoint, and how many of them
+  // have been saved into the undo log.
+  size_t _checkpointCount;
+  size_t _undoCount;
+
+  // Sequence number for the background verifier.
+  unsigned long _seq;
 };
 
 #endif
@@ -0,0 +1,155 @@
+#if !defined(DOUBLETAKE_QUARANTINEBUDGET_H)
+#define DOUBLETAKE_QUARANTINEBUDGET_H
+
+/*
+ * @file   quarantinebudget.h
+ * @brief  A process-wide budget for the quarantine lists of all threads.
+ *         Every thread may keep QUARANTINE_THREAD_RESERVE bytes of freed objects.
+ *         Beyond that, threads borrow from the shared budget and evict their own
+ *         objects once the budget is used up. The budget is adjusted at the
+ *         end of every committed epoch, following the amount of memory freed in
+ *         the epoch, and it shrinks when the system is short of memory. Then the
+ *         lists of all threads are trimmed to their share of it.
+ *         Objects like those with use-after-free reports are kept for more rounds
+ *         in the quarantine lists: objects of the same allocation site with
+ *         DETECT_ALLOCATION_SITES, or of the same size class otherwise.
+ * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/sysinfo.h>
+
+#include <new>
+
+#include "log.hh"
+#include "xdefines.hh"
+
+#if defined(DETECT_ALLOCATION_SITES)
+#include "sitemap.hh"
+#endif
+
+class quarantinebudget {
+public:
+  quarantinebudget()
+    : _used(0), _freed(0), _limit(xdefines::QUARANTINE_MIN_BUDGET), _hotClasses(0) {
+#if defined(DETECT_ALLOCATION_SITES)
+    memset(_hotSites, 0, sizeof(_hotSites));
+#endif
+  }
+
+  static quarantinebudget& getInstance() {
+    static char buf[sizeof(quarantinebudget)];
+    static quarantinebudget* theOneTrueObject = new (buf) quarantinebudget();
+    return *theOneTrueObject;
+  }
+
+  inline void borrow(size_t size) {
+    __atomic_add_fetch(&_used, size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&_freed, size, __ATOMIC_RELAXED);
+  }
+
+  inline void giveback(size_t size) { __atomic_sub_fetch(&_used, size, __ATOMIC_RELAXED); }
+
+  // Account for objects which are back in a quarantine list after a rollback.
+  inline void reclaim(size_t size) { __atomic_add_fetch(&_used, size, __ATOMIC_RELAXED); }
+
+  inline bool isOverBudget() {
+    return __atomic_load_n(&_used, __ATOMIC_RELAXED) > __atomic_load_n(&_limit, __ATOMIC_RELAXED);
+  }
+
+  // Remember an object with a use-after-free error.
+  void markHotObject(void* ptr, size_t size) {
+#if defined(DETECT_ALLOCATION_SITES)
+    unsigned int site = sitemap::getInstance().getSite(ptr);
+    if(site != callsitetable::NO_CALLSITE) {
+      __atomic_or_fetch(&_hotSites[getSiteWord(site)], getSiteBit(site), __ATOMIC_RELAXED);
+      return;
+    }
+#endif
+    __atomic_or_fetch(&_hotClasses, 1UL << getSizeClass(size), __ATOMIC_RELAXED);
+  }
+
+  inline bool isHotObject(void* ptr, size_t size) {
+#if defined(DETECT_ALLOCATION_SITES)
+    unsigned int site = sitemap::getInstance().getSite(ptr);
+    if(site != callsitetable::NO_CALLSITE) {
+      return (__atomic_load_n(&_hotSites[getSiteWord(site)], __ATOMIC_RELAXED) &
+              getSiteBit(site)) != 0;
+    }
+#endif
+    return (__atomic_load_n(&_hotClasses, __ATOMIC_RELAXED) & (1UL << getSizeClass(size))) != 0;
+  }
+
+  // The bytes each of "threads" threads may keep when the budget is shared evenly.
+  inline size_t getShare(int threads) {
+    size_t share = _limit / (threads > 0 ? threads : 1);
+    return (share > xdefines::QUARANTINE_THREAD_RESERVE) ? share
+                                                        : xdefines::QUARANTINE_THREAD_RESERVE;
+  }
+
+  // Called at the end of an epoch, when all other threads are stopped.
+  void adjust() {
+    size_t target = _freed * xdefines::QUARANTINE_BUDGET_EPOCHS;
+
+    if(isMemoryTight()) {
+      target = _limit / 2;
+    }
+
+    // Move halfway to the target so that a single epoch doesn't change too much.
+    _limit = (_limit + target) / 2;
+    if(_limit < xdefines::QUARANTINE_MIN_BUDGET) {
+      _limit = xdefines::QUARANTINE_MIN_BUDGET;
+    } else if(_limit > xdefines::QUARANTINE_MAX_BUDGET) {
+      _limit = xdefines::QUARANTINE_MAX_BUDGET;
+    }
+
+    PRINF("Quarantine budget 0x%zx, used 0x%zx, freed 0x%zx in last epoch\n", _limit, _used, _freed);
+    _freed = 0;
+  }
+
+private:
+  // Size classes are powers of two, starting from 16 bytes.
+  static inline int getSizeClass(size_t size) {
+    int sc = 0;
+
+    if(size > xdefines::OBJECT_SIZE_BASE) {
+      sc = sizeof(unsigned long) * 8 - __builtin_clzl(size - 1) - 4;
+    }
+    return sc;
+  }
+
+#if defined(DETECT_ALLOCATION_SITES)
+  static inline size_t getSiteWord(unsigned int site) {
+    return (site / (sizeof(unsigned long) * 8)) % HOT_SITE_WORDS;
+  }
+
+  static inline unsigned long getSiteBit(unsigned int site) {
+    return 1UL << (site % (sizeof(unsigned long) * 8));
+  }
+#endif
+
+  static bool isMemoryTight() {
+    struct sysinfo info;
+
+    if(sysinfo(&info) != 0) {
+      return false;
+    }
+    return (info.freeram + info.bufferram) < info.totalram / xdefines::QUARANTINE_LOW_MEMORY_RATIO;
+  }
+
+  size_t _used;
+  // Total size that is put into quarantine lists in current epoch.
+  size_t _freed;
+  size_t _limit;
+  unsigned long _hotClasses;
+#if defined(DETECT_ALLOCATION_SITES)
+  // One bit for every callsite id.
+  enum { HOT_SITE_WORDS = (xdefines::CALLSITE_TABLE_SIZE + 1 + sizeof(unsigned long) * 8 - 1) /
+                          (sizeof(unsigned long) * 8) };
+  unsigned long _hotSites[HOT_SITE_WORDS];
+#endif
+};
+
+#endif
@@ -13,6 +13,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <ucontext.h>
 
 #include <fstream>
 #include <functional>
@@ -76,6 +77,8 @@ public:
 
   uintptr_t getLimit() const { return _limit; }
 
+  size_t getOffset() const { return _offset; }
+
   const std::string& getFile() const { return _file; }
 
 private:
@@ -152,12 +155,22 @@ public:
     return ((pcaddr >= _appTextStart) && (pcaddr <= _appTextEnd));
   }
 
+  /// Find the mapping containing an address, or NULL.
+  const mapping* findMapping(void* addr) {
+    auto entry = _mappings.find(interval(addr));
+    return (entry != _mappings.end()) ? &entry->second : NULL;
+  }
+
   // Print out the code information about an eip address.
   // Also try to print out the stack trace of given pcaddr.
   void printCallStack();
   void printCallStack(int depth, void** array);
   static int getCallStack(void** array);
 
+  // The call stack of the code interrupted by a signal, in the signal handler.
+  void printCallStack(ucontext_t* context);
+  static int getCallStack(ucontext_t* context, void** array);
+
   void getStackInformation(void** stackBottom, void** stackTop) {
     for(const auto& entry : _mappings) {
       const mapping& m = entry.second;
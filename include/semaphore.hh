@@ -98,6 +98,9 @@ public:
       PRINT("Cannot detroy semaphore: %s\n", strerror(errno));
       abort();
     }
+
+    // It is initialized again for the next rollback.
+    _semaId = 0;
   }
 
 private:
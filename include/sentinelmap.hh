@@ -13,10 +13,12 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <new>
 
 #include "bitmap.hh"
+#include "blockmap.hh"
 #include "log.hh"
 #include "mm.hh"
 #include "objectheader.hh"
@@ -27,7 +29,7 @@ class sentinelmap {
 public:
   sentinelmap()
     : _bitmap(), _wordShiftBits(0), _itemShiftBits(0), _elements(0),
-      _totalBytes(0), _heapStart(0), _lastSentinelAddr(0) {}
+      _totalBytes(0), _heapStart(0), _lastSentinelAddr(0), _backupMap(NULL), _backupBytes(0) {}
 
   // The single instance of sentinelmap. We only need this for
   // heap.
@@ -69,11 +71,31 @@ public:
     void* buf = MM::mmapAllocatePrivate(_totalBytes);
     _bitmap.initialize(buf, _elements, _elements / sizeof(unsigned long));
 
+    _backupMap = (char*)MM::mmapAllocatePrivate(_totalBytes);
+
     // PRINF("bitmap start at buf %p\n", buf);
     // We won't cleanup all bitmap since the actual memory usage can be very small.
     _lastSentinelAddr = NULL;
   }
 
+  // Save the bits of the heap up to end, together with the heap. The replay does not
+  // clean the sentinels of freed objects, so they are recovered with the heap.
+  void backup(void* end) {
+    _backupBytes = getUsedBytes(end);
+    memcpy(_backupMap, _bitmap.getWord(0), _backupBytes);
+  }
+
+  // The heap may have grown since the backup, and its new part is unused again.
+  void recoverMemory(void* end) {
+    char* map = (char*)_bitmap.getWord(0);
+    size_t bytes = getUsedBytes(end);
+
+    memcpy(map, _backupMap, _backupBytes);
+    if(bytes > _backupBytes) {
+      memset(map + _backupBytes, 0, bytes - _backupBytes);
+    }
+  }
+
   /// Clears out the bitmap array when given the start address of heap and size.
   void cleanup(void* start, size_t size) {
     unsigned long item = getIndex(start);
@@ -174,16 +196,6 @@ public:
 
   void clearSentinelAt(void* ptr) { clear(ptr); }
 
-  void setMemalignSentinelAt(void* ptr) {
-    size_t* sentinel = (size_t*)ptr;
-
-    // Calculate the address of two sentinels
-    // The organization should be:
-    //      objectHeader + sentinelFirst + object (objectsize) + sentinelLast
-    *sentinel = xdefines::MEMALIGN_SENTINEL_WORD;
-    tryToSet((void*)sentinel);
-  }
-
   void markSentinelAt(void* ptr) { tryToSet(ptr); }
 
   inline bool checkAndClearSentinel(void* ptr) {
@@ -199,37 +211,6 @@ public:
     return ((*sentinel == xdefines::SENTINEL_WORD) ? false : true);
 	}
 
-  // Finding the heap object covering the specified address.
-  // Now suppose current address is in the middle of an object,
-  // then what should we do is to find the last set bit in the bitmap.
-  inline bool findObjectStartAddr(void* addr, unsigned long* objectStart) {
-    bool hasValidObject = false;
-
-    unsigned long item = getIndex(addr);
-    // PRINF("addr %p item %ld\n", addr, item);
-    unsigned long* canaryAddr;
-    unsigned long startIndex;
-    while(_bitmap.getLastBit(item, &startIndex)) {
-      // When we get the last set bit in the bitmap, we should check whether
-      // this address is inside a valid object.
-      // There are at least two cases for a normal object.
-      canaryAddr = (unsigned long*)getHeapAddressFromItem(startIndex);
-      if(*canaryAddr == xdefines::SENTINEL_WORD) {
-        *objectStart = (intptr_t)canaryAddr + xdefines::SENTINEL_SIZE;
-        hasValidObject = true;
-        break;
-      } else if(*canaryAddr == xdefines::MEMALIGN_SENTINEL_WORD) {
-        item = startIndex;
-        continue;
-      } else {
-        hasValidObject = false;
-        break;
-      }
-    }
-
-    return hasValidObject;
-  }
-
   // Check whether corresponding bit has been set or not.
   inline bool isSet(void* addr) {
     unsigned long item = getIndex(addr);
@@ -245,7 +226,7 @@ public:
       WORD curword = *((WORD*)addr);
 
       // If this bit is set, then we check whether it is a integral or not.
-      if(curword != xdefines::SENTINEL_WORD && curword != xdefines::MEMALIGN_SENTINEL_WORD) {
+      if(curword != xdefines::SENTINEL_WORD) {
         isOverflow = isCorruptedSentinel(addr);
       }
     }
@@ -371,6 +352,12 @@ private:
     return bytes;
   }
 
+  // The bytes of the bitmap for the heap up to end.
+  size_t getUsedBytes(void* end) {
+    unsigned long nelts = ((intptr_t)end - _heapStart) >> _wordShiftBits;
+    return (nelts + BYTEBITS - 1) / BYTEBITS;
+  }
+
   inline bool isBitSet(unsigned long word, int index) {
     // PRINF("isBitSet word %lx index %d getMask(Index) %lx\n", word, index, getMask(index));
     return (((word & getMask(index)) != 0) ? true : false);
@@ -439,8 +426,7 @@ private:
     for(int i = 0; i < WORDBITS; i++) {
       // Only check those address when corresponding bit has been set
       if(isBitSet(bits, i)) {
-        if(address[i] != xdefines::SENTINEL_WORD &&
-           address[i] != xdefines::MEMALIGN_SENTINEL_WORD) {
+        if(address[i] != xdefines::SENTINEL_WORD) {
           bool isBadSentinel = false;
 
           // Whether this word is filled by MAGIC_BYTE_NOT_ALIGNED
@@ -466,7 +452,7 @@ private:
             // Find the starting address of this object.
             unsigned long objectStart = 0;
 					
-            if(findObjectStartAddr((void*)&address[i], &objectStart)) {
+            if(blockmap::getInstance().findObjectStart((void*)&address[i], &objectStart)) {
               objectHeader* object = (objectHeader*)(objectStart - sizeof(objectHeader));
 							hasCorrupted = checkObjectOverflow((void *)objectStart, object->getSize(), object->getObjectSize(), false);
             } 
@@ -515,6 +501,10 @@ private:
 
   // Save last sentinel address for non-aligned overflow detection
   void* _lastSentinelAddr;
+
+  // The bits at the beginning of the epoch.
+  char* _backupMap;
+  size_t _backupBytes;
 };
 
 #endif
@@ -0,0 +1,100 @@
+#if !defined(DOUBLETAKE_SITEMAP_H)
+#define DOUBLETAKE_SITEMAP_H
+
+/*
+ * @file   sitemap.h
+ * @brief  The allocation sites of heap objects, stamped in the normal execution, so that
+ *         leaks and overflows are reported with their allocation sites without a
+ *         re-execution (used with DETECT_ALLOCATION_SITES).
+ *         A site is the id of a short call stack in the table of callsites, which starts
+ *         at the first frame outside of DoubleTake and is taken by frame pointers only.
+ *         The ids are kept in a shadow of the heap, one for every 32 bytes, since
+ *         objects are at least that far apart (a header, a block and its sentinels).
+ * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <new>
+
+#include "callsitetable.hh"
+#include "log.hh"
+#include "mm.hh"
+#include "selfmap.hh"
+#include "unwinder.hh"
+#include "xdefines.hh"
+
+class sitemap {
+  enum { OBJECT_SHIFT_BITS = 5 };
+
+public:
+  sitemap() : _sites(NULL), _heapStart(0), _heapEnd(0) {}
+
+  static sitemap& getInstance() {
+    static char buf[sizeof(sitemap)];
+    static sitemap* theOneTrueObject = new (buf) sitemap();
+    return *theOneTrueObject;
+  }
+
+  void initialize(void* addr, size_t size) {
+    _sites = (unsigned int*)MM::mmapAllocatePrivate((size >> OBJECT_SHIFT_BITS) *
+                                                    sizeof(unsigned int));
+    REQUIRE(_sites != NULL, "Failed to allocate the map of allocation sites");
+
+    _heapStart = (uintptr_t)addr;
+    _heapEnd = _heapStart + size;
+  }
+
+  // Stamp a new object with the site of its allocation.
+  void stamp(void* ptr) {
+    void* frames[xdefines::CALLSITE_MAXIMUM_LENGTH];
+    int depth;
+    int first = 0;
+
+    if(!isInside(ptr)) {
+      return;
+    }
+
+    depth = unwinder::getCallStackFast(frames, xdefines::CALLSITE_MAXIMUM_LENGTH);
+
+    while(first < depth && selfmap::getInstance().isDoubleTakeLibrary(frames[first])) {
+      first++;
+    }
+
+    depth -= first;
+    if(depth > xdefines::ALLOCATION_SITE_DEPTH) {
+      depth = xdefines::ALLOCATION_SITE_DEPTH;
+    }
+
+    _sites[getIndex(ptr)] = callsitetable::getInstance().intern(depth, &frames[first]);
+  }
+
+  unsigned int getSite(void* ptr) {
+    return isInside(ptr) ? _sites[getIndex(ptr)] : (unsigned int)callsitetable::NO_CALLSITE;
+  }
+
+  // Print the allocation site of an object, if it is known.
+  void printSite(void* ptr) {
+    unsigned int site = getSite(ptr);
+
+    if(site != callsitetable::NO_CALLSITE) {
+      PRINT("The object is allocated at:\n");
+      selfmap::getInstance().printCallStack(callsitetable::getInstance().getDepth(site),
+                                            callsitetable::getInstance().getFrames(site));
+    }
+  }
+
+private:
+  bool isInside(void* ptr) {
+    return _sites != NULL && (uintptr_t)ptr >= _heapStart && (uintptr_t)ptr < _heapEnd;
+  }
+
+  size_t getIndex(void* ptr) { return ((uintptr_t)ptr - _heapStart) >> OBJECT_SHIFT_BITS; }
+
+  unsigned int* _sites;
+  uintptr_t _heapStart;
+  uintptr_t _heapEnd;
+};
+
+#endif
@@ -0,0 +1,149 @@
+#if !defined(DOUBLETAKE_SLAB_H)
+#define DOUBLETAKE_SLAB_H
+
+/*
+ * @file   slab.h
+ * @brief  Typed pools for small internal records with a fixed size, such as
+ *         hash map entries, tracked objects and synchronization entries.
+ *         Objects are carved from large slabs of the internal heap, so they
+ *         do not pay for an objectHeader and sentinels each.
+ *         Every thread has a private free list. Only when it is empty (or
+ *         too long), the shared free list is touched under a lock.
+ * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <new>
+
+#include "log.hh"
+#include "mm.hh"
+#include "spinlock.hh"
+#include "xdefines.hh"
+
+template <class Type, class SourceHeap = InternalHeapAllocator> class slab {
+  // A free object is linked through its first word.
+  struct freeNode {
+    freeNode* next;
+  };
+
+  // Per-thread free list, padded to avoid false sharing.
+  struct threadCache {
+    freeNode* head;
+    size_t count;
+    char padding[xdefines::CACHE_LINE_SIZE - sizeof(freeNode*) - sizeof(size_t)];
+  };
+
+  enum { OBJECT_SIZE = (sizeof(Type) > sizeof(freeNode) ? sizeof(Type) : sizeof(freeNode)) };
+  enum { SLOT_SIZE = (OBJECT_SIZE + sizeof(void*) - 1) & ~(sizeof(void*) - 1) };
+
+public:
+  slab() : _freelist(NULL), _bump(NULL), _bumpEnd(NULL), _lock() {
+    for(int i = 0; i < xdefines::MAX_ALIVE_THREADS; i++) {
+      _caches[i].head = NULL;
+      _caches[i].count = 0;
+    }
+  }
+
+  static slab& getInstance() {
+    static char buf[sizeof(slab)];
+    static slab* theOneTrueObject = new (buf) slab();
+    return *theOneTrueObject;
+  }
+
+  // Get the memory for one object. It is up to the caller to initialize it.
+  Type* alloc() {
+    threadCache* cache = &_caches[getThreadIndex()];
+    freeNode* node = cache->head;
+
+    if(node != NULL) {
+      cache->head = node->next;
+      cache->count--;
+      return (Type*)node;
+    }
+
+    _lock.lock();
+    if(_freelist != NULL) {
+      node = _freelist;
+      _freelist = node->next;
+    } else {
+      if(_bump + SLOT_SIZE > _bumpEnd) {
+        _bump = (char*)SourceHeap::allocate(xdefines::SLAB_SIZE);
+        REQUIRE(_bump != NULL, "Failed to allocate a slab");
+        _bumpEnd = _bump + xdefines::SLAB_SIZE;
+      }
+      node = (freeNode*)_bump;
+      _bump += SLOT_SIZE;
+    }
+    _lock.unlock();
+
+    return (Type*)node;
+  }
+
+  void free(Type* ptr) {
+    threadCache* cache = &_caches[getThreadIndex()];
+    freeNode* node = (freeNode*)ptr;
+
+    if(cache->count < xdefines::SLAB_CACHE_SIZE) {
+      node->next = cache->head;
+      cache->head = node;
+      cache->count++;
+      return;
+    }
+
+    _lock.lock();
+    node->next = _freelist;
+    _freelist = node;
+    _lock.unlock();
+  }
+
+private:
+  threadCache _caches[xdefines::MAX_ALIVE_THREADS];
+
+  // Shared free list and the current slab.
+  freeNode* _freelist;
+  char* _bump;
+  char* _bumpEnd;
+  spinlock _lock;
+};
+
+// An allocator for STL containers, which takes single nodes from the slab
+// of the node type. Arrays still come from the source heap.
+template <class T, class SourceHeap = InternalHeapAllocator> class slabAllocator {
+public:
+  typedef T value_type;
+  typedef T* pointer;
+  typedef const T* const_pointer;
+  typedef T& reference;
+  typedef const T& const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  template <class U> struct rebind { typedef slabAllocator<U, SourceHeap> other; };
+
+  slabAllocator() {}
+
+  template <class U> slabAllocator(const slabAllocator<U, SourceHeap>&) {}
+
+  pointer allocate(size_type n, const void* = 0) {
+    if(n == 1) {
+      return slab<T, SourceHeap>::getInstance().alloc();
+    }
+    return (pointer)SourceHeap::allocate(n * sizeof(T));
+  }
+
+  void deallocate(pointer p, size_type n) {
+    if(n == 1) {
+      slab<T, SourceHeap>::getInstance().free(p);
+    } else {
+      SourceHeap::deallocate(p);
+    }
+  }
+
+  template <class U> bool operator==(const slabAllocator<U, SourceHeap>&) const { return true; }
+
+  template <class U> bool operator!=(const slabAllocator<U, SourceHeap>&) const { return false; }
+};
+
+#endif
@@ -0,0 +1,242 @@
+#if !defined(DOUBLETAKE_SYMBOLIZER_H)
+#define DOUBLETAKE_SYMBOLIZER_H
+
+/*
+ * @file   symbolizer.h
+ * @brief  Symbolize call stacks inside the process, without running addr2line.
+ *         Every mapped object (by its selfmap mapping) is mapped and parsed once, at
+ *         its first frame: the function symbols of .symtab (or .dynsym), the rows of
+ *         .debug_line, and the address ranges of the compilation units in
+ *         .debug_info. Inline frames come from the inlined subroutines of the
+ *         compilation unit, which is walked once for all frames in it.
+ *         DWARF 2 to 5 is supported. Compressed sections and split DWARF are not,
+ *         and objects without debug information are looked up in
+ *         /usr/lib/debug/.build-id by their build IDs.
+ *         Nothing is allocated from the heap, thus symbol names are not demangled:
+ *         the names in DWARF are printed instead, and raw names otherwise.
+ * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <new>
+
+#include "selfmap.hh"
+#include "spinlock.hh"
+#include "xdefines.hh"
+
+class dwarfReader;
+
+class symbolizer {
+  struct section {
+    const unsigned char* data;
+    size_t size;
+  };
+
+  struct symbolEntry {
+    uintptr_t addr;
+    size_t size;
+    const char* name;
+  };
+
+  // A row of a line table. The row ending a sequence has file NO_FILE.
+  struct lineRow {
+    uintptr_t addr;
+    unsigned int file;
+    unsigned int line;
+    // The order of rows, to keep the last row of an address after sorting.
+    unsigned int index;
+  };
+
+  struct sourceFile {
+    const char* compDir;
+    const char* dir;
+    const char* name;
+  };
+
+  // The line table of a compilation unit, and its files in the file list.
+  struct lineTable {
+    size_t offset;
+    unsigned int firstFile;
+    unsigned int files;
+    int version;
+  };
+
+  // An address range of a compilation unit.
+  struct unitRange {
+    uintptr_t start;
+    uintptr_t end;
+    size_t offset;
+  };
+
+  struct elfObject {
+    const char* file;
+    uintptr_t bias;
+    bool isValid;
+
+    section image;
+    section debugImage;
+
+    section debugInfo;
+    section debugAbbrev;
+    section debugLine;
+    section debugStr;
+    section debugLineStr;
+    section debugRanges;
+    section debugRnglists;
+    section debugAddr;
+    section debugStrOffsets;
+
+    symbolEntry* symbols;
+    size_t numSymbols;
+    lineRow* rows;
+    size_t numRows;
+    sourceFile* files;
+    size_t numFiles;
+    lineTable* tables;
+    size_t numTables;
+    unitRange* units;
+    size_t numUnits;
+  };
+
+  struct abbrevEntry {
+    uint64_t code;
+    uint64_t tag;
+    bool hasChildren;
+    const unsigned char* specs;
+  };
+
+  struct attrValue {
+    uint64_t form;
+    uint64_t value;
+    const char* string;
+  };
+
+  // A compilation unit being read.
+  struct unitInfo {
+    elfObject* object;
+    const unsigned char* start;
+    const unsigned char* dies;
+    const unsigned char* end;
+    int version;
+    int addrSize;
+    bool is64;
+    uintptr_t base;
+    uint64_t strOffsetsBase;
+    uint64_t addrBase;
+    uint64_t rnglistsBase;
+    lineTable* table;
+  };
+
+  struct dieInfo {
+    uint64_t tag;
+    bool hasChildren;
+    attrValue lowPc;
+    attrValue highPc;
+    attrValue ranges;
+    attrValue name;
+    attrValue linkageName;
+    attrValue origin;
+    attrValue specification;
+    attrValue callFile;
+    attrValue callLine;
+    attrValue stmtList;
+    attrValue compDir;
+    attrValue strOffsetsBase;
+    attrValue addrBase;
+    attrValue rnglistsBase;
+  };
+
+  struct inlineEntry {
+    int depth;
+    size_t origin;
+    const char* function;
+    unsigned int callFile;
+    unsigned int callLine;
+  };
+
+  struct frameInfo {
+    void* addr;
+    elfObject* object;
+    uintptr_t pc;
+    size_t unit;
+    const char* function;
+    const sourceFile* file;
+    unsigned int line;
+    int inlines;
+    inlineEntry chain[xdefines::SYMBOLIZER_MAX_INLINES];
+  };
+
+  // Files of rows ending sequences, and files not in the tables.
+  static const unsigned int NO_FILE = 0xFFFFFFFF;
+  static const unsigned int UNKNOWN_FILE = 0xFFFFFFFE;
+  static const size_t NO_UNIT = (size_t)-1;
+
+public:
+  symbolizer()
+    : _numObjects(0), _abbrevs(NULL), _maxAbbrevs(0), _numAbbrevs(0), _abbrevOffset(0),
+      _abbrevObject(NULL) {
+    _lock.init();
+  }
+
+  static symbolizer& getInstance() {
+    static char buf[sizeof(symbolizer)];
+    static symbolizer* theOneTrueObject = new (buf) symbolizer();
+    return *theOneTrueObject;
+  }
+
+  // Print the frames of a call stack, whose addresses are the return addresses.
+  void printCallStack(int frames, void** addrs);
+
+private:
+  elfObject* getObject(const mapping* m);
+  bool loadObject(elfObject* object, const mapping* m);
+  bool mapFile(const char* file, section* image);
+  bool findSections(elfObject* object, section* image, bool isDebugFile);
+  bool findDebugFile(elfObject* object, char* path, size_t size);
+
+  void parseSymbols(elfObject* object, section* image);
+  size_t parseLines(elfObject* object, bool isCounting);
+  const char* readLineEntry(dwarfReader& r, const unsigned char* formats, int numFormats,
+                            const unsigned char* end, unitInfo* unit, uint64_t* dirIndex);
+  size_t parseUnits(elfObject* object, bool isCounting);
+
+  void symbolizeObject(elfObject* object, frameInfo* frames, int numFrames);
+  void findLine(elfObject* object, frameInfo* frame);
+  void findInlines(elfObject* object, size_t unitOffset, frameInfo* frames, int numFrames);
+  void printFrame(frameInfo* frame);
+  void getLocation(elfObject* object, unsigned int file, unsigned int line, char* buf, size_t size);
+
+  // Compilation units.
+  bool readUnit(elfObject* object, size_t offset, unitInfo* unit, dieInfo* root);
+  bool readAbbrevs(elfObject* object, size_t offset);
+  abbrevEntry* findAbbrev(uint64_t code);
+  int readDie(unitInfo* unit, dwarfReader& r, dieInfo* die);
+  bool readAttribute(dwarfReader& r, uint64_t form, int64_t implicitConst, unitInfo* unit,
+                     attrValue* attr);
+  const char* getName(unitInfo* unit, size_t offset, int hops);
+  const char* getString(unitInfo* unit, attrValue* attr);
+  bool getIndexedAddress(unitInfo* unit, uint64_t index, uintptr_t* addr);
+  bool getAddress(unitInfo* unit, attrValue* attr, uintptr_t* addr);
+  size_t getReference(unitInfo* unit, attrValue* attr);
+  lineTable* findTable(elfObject* object, size_t offset);
+
+  template <typename Visitor> void visitRanges(unitInfo* unit, dieInfo* die, Visitor visit);
+
+  spinlock _lock;
+
+  elfObject _objects[xdefines::SYMBOLIZER_MAX_OBJECTS];
+  int _numObjects;
+
+  // Abbreviations of the compilation unit being read.
+  abbrevEntry* _abbrevs;
+  size_t _maxAbbrevs;
+  size_t _numAbbrevs;
+  size_t _abbrevOffset;
+  elfObject* _abbrevObject;
+
+  frameInfo _frames[xdefines::SYMBOLIZER_MAX_FRAMES];
+};
+
+#endif
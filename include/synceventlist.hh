@@ -4,6 +4,10 @@
 /*
  * @file   synceventlist.h
  * @brief  Manage the list of synchronization event.
+ *         Events of a synchronization variable are appended without a lock: a thread
+ *         swaps its event into the tail, and then links the previous tail to it. Thus
+ *         the order of the swaps is the order of the events in replay. The list is
+ *         only read when all threads are stopped, after their appends are done.
  * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
  */
 
@@ -44,7 +48,7 @@ public:
     //    PRINF("synceventlist initialization at list %p\n", &list);
     // Initialize the sequence number
     listInit(&list);
-    Real::pthread_mutex_init(&lock, NULL);
+    tail = &list;
     syncVariable = variable;
     syncCmd = synccmd;
     curentry = NULL;
@@ -52,17 +56,20 @@ public:
 
 	void initialization(thrSyncCmd synccmd) {
     listInit(&list);
-    Real::pthread_mutex_init(&lock, NULL);
+    tail = &list;
     syncVariable = NULL;
     syncCmd = synccmd;
     curentry = NULL;
 	}
 
   // Record a synchronization event
+  // Mutex events are recorded inside their critical sections, and other events
+  // may be recorded by many threads at the same time.
   void recordSyncEvent(thrSyncCmd synccmd, int ret) {
     struct syncEvent* event = allocSyncEvent();
 
-    listInit(&event->list);
+    // The new tail ends the list.
+    event->list.next = &this->list;
 
     // Change the event there.
     event->thread = current;
@@ -71,15 +78,9 @@ public:
 
     PRINF("recordSyncEvent line %d: event %p (at %zd) thread %d eventlist %p\n",
           __LINE__, (void *)event, current->syncevents.getEntriesNumb()-1, current->index, (void *)this);
-    if(synccmd != E_SYNC_MUTEX_LOCK) {
-      Real::pthread_mutex_lock(&this->lock);
-      listInsertTail(&event->list, &this->list);
-      Real::pthread_mutex_unlock(&this->lock);
-    } else {
-      // We only record synchronization inside critical section.
-      // so there is no need to acquire another lock.
-      listInsertTail(&event->list, &this->list);
-    }
+    list_t* prev = __atomic_exchange_n(&this->tail, &event->list, __ATOMIC_ACQ_REL);
+    event->list.prev = prev;
+    __atomic_store_n(&prev->next, &event->list, __ATOMIC_RELEASE);
     // PRINF("RECORDING: syncCmd %d on event %p thread %p (THREAD%d)", synccmd, event,
     // event->thread, current->index);
   }
@@ -105,6 +106,7 @@ public:
   // cleanup all events in a list.
   void cleanup() {
 		listInit(&this->list); 
+    this->tail = &this->list;
 	}
 
   struct syncEvent* allocSyncEvent() { return current->syncevents.alloc(); }
@@ -124,7 +126,7 @@ public:
 
 private:
   list_t list; // List for all synchronization events.
-  pthread_mutex_t lock;
+  list_t* tail; // The last event, or the list itself when it is empty.
   void* syncVariable;
   thrSyncCmd syncCmd;
   list_t* curentry;
@@ -79,7 +79,7 @@ public:
 
   // Prepare rollback for system calls
   void prepareRollback() {
-		fprintf(stderr, "syscalls: prepareRollback at thread\n");
+		PRINF("syscalls: prepareRollback at thread\n");
     // Handle all opened files
     _fops.prepareRollback();
   }
@@ -118,6 +118,16 @@ public:
     return;
   }
 
+  // Open the pages of software watch points in a buffer that a system call
+  // writes into, and check their watch points after the call.
+  void beginSystemCall(void* buf, size_t count) {
+    watchpoint::getInstance().beginSystemCall(buf, count);
+  }
+
+  void endSystemCall(void* buf, size_t count) {
+    watchpoint::getInstance().endSystemCall(buf, count);
+  }
+
   ssize_t read(int fd, void* buf, size_t count) {
     ssize_t ret;
 
@@ -127,7 +137,9 @@ public:
     // PRINF("read on fd %d\n", fd);
     // Check whether this fd is not a socketid.
     if(_fops.checkPermission(fd)) {
+      beginSystemCall(buf, count);
       ret = Real::read(fd, buf, count);
+      endSystemCall(buf, count);
     } else {
       //      PRINF("Reading special file\n");
       epochEnd();
@@ -475,7 +487,9 @@ public:
 
     checkOverflowBeforehand(buf, count);
     if(_fops.checkPermission(fd)) {
+      beginSystemCall(buf, count);
       ret = Real::pread(fd, buf, count, offset);
+      endSystemCall(buf, count);
     } else {
       epochEnd();
       ret = Real::pread(fd, buf, count, offset);
@@ -484,6 +498,21 @@ public:
     return ret;
   }
 
+  // The reads of a stream into its buffer are not seen by read() above. A buffer
+  // allocated by this call is new, so it is not watched.
+  size_t fread(void* ptr, size_t size, size_t nmemb, FILE* stream) {
+    char* buf = stream->_IO_buf_base;
+    size_t bufsize = stream->_IO_buf_end - buf;
+    size_t ret;
+
+    beginSystemCall(ptr, size * nmemb);
+    beginSystemCall(buf, bufsize);
+    ret = Real::fread(ptr, size, nmemb, stream);
+    endSystemCall(buf, bufsize);
+    endSystemCall(ptr, size * nmemb);
+    return ret;
+  }
+
   ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset) {
     ssize_t ret;
 
@@ -506,7 +535,13 @@ public:
     }
 
     if(_fops.checkPermission(fd)) {
+      for(int i = 0; i < count; i++) {
+        beginSystemCall(vector[i].iov_base, vector[i].iov_len);
+      }
       ret = Real::readv(fd, vector, count);
+      for(int i = 0; i < count; i++) {
+        endSystemCall(vector[i].iov_base, vector[i].iov_len);
+      }
     } else {
       epochEnd();
       // No need to call aotmicBegin() since this system call
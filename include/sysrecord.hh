@@ -323,13 +323,32 @@ public:
       Real::munmap(record->addr, record->length);
     }
 
-		// Cleanup all record entries and all list of system calls;
+    cleanup(thread);
+  }
+
+  // Cleanup all record entries and all list of system calls, without doing the
+  // deferred ones, when the epoch is run again.
+  static void cleanup(thread_t * thread) {
 		thread->syscalls.cleanup();
 		for(int i = 0; i< E_SYS_MAX; i++) {
 			listInit(&thread->syslist[i]);
 		}
   }
 
+  // Whether the thread has opened files, directories or mappings in this epoch,
+  // which would be opened again by another run of the epoch.
+  static bool hasOpenedResources(thread_t * thread) {
+    for(size_t i = 0; i < thread->syscalls.getEntriesNumb(); i++) {
+      eRecordSyscall sc = thread->syscalls.getEntry(i)->syscall;
+
+      if(sc == E_SYS_FILE_OPEN || sc == E_SYS_FILE_DUP || sc == E_SYS_DIR_OPEN ||
+         sc == E_SYS_MMAP) {
+        return true;
+      }
+    }
+    return false;
+  }
+
   // Prepare the traverse for all list.
   static void prepareRollback(thread_t * thread) { thread->syscalls.prepareRollback(); }
 
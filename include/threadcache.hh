@@ -0,0 +1,79 @@
+#if !defined(DOUBLETAKE_THREADCACHE_H)
+#define DOUBLETAKE_THREADCACHE_H
+
+/*
+ * @file   threadcache.h
+ * @brief  Per-thread magazines of free heap blocks, one for each small size class.
+ *         A magazine is a small LIFO stack so that the common malloc/free pair
+ *         never leaves the current thread. Magazines are refilled from and
+ *         flushed to the thread's own sub-heap in batches.
+ * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "xdefines.hh"
+
+class threadcache {
+public:
+  threadcache() { reset(); }
+
+  // Discard all cached blocks without giving them back.
+  // This is only safe after the heap metadata has been recovered, since
+  // those blocks are owned by the recovered free lists again.
+  void reset() { memset(_counts, 0, sizeof(_counts)); }
+
+  inline bool isEmpty(int sc) { return _counts[sc] == 0; }
+
+  inline bool isFull(int sc) { return _counts[sc] == xdefines::THREAD_CACHE_SIZE; }
+
+  inline int getCount(int sc) { return _counts[sc]; }
+
+  inline void* get(int sc) {
+    if(_counts[sc] == 0) {
+      return NULL;
+    }
+    return _blocks[sc][--_counts[sc]];
+  }
+
+  inline void put(int sc, void* ptr) {
+    assert(_counts[sc] < xdefines::THREAD_CACHE_SIZE);
+    _blocks[sc][_counts[sc]++] = ptr;
+  }
+
+  // Take the most recently cached block whose address is aligned to boundary.
+  inline void* getAligned(int sc, size_t boundary) {
+    for(int i = _counts[sc] - 1; i >= 0; i--) {
+      void* ptr = _blocks[sc][i];
+
+      if(((uintptr_t)ptr & (boundary - 1)) == 0) {
+        memmove(&_blocks[sc][i], &_blocks[sc][i + 1], (_counts[sc] - i - 1) * sizeof(void*));
+        _counts[sc]--;
+        return ptr;
+      }
+    }
+    return NULL;
+  }
+
+  // Remove the oldest "count" blocks, the ones at the bottom of the magazine,
+  // and move the rest down. The removed blocks are returned in "out".
+  inline int drain(int sc, void** out, int count) {
+    if(count > _counts[sc]) {
+      count = _counts[sc];
+    }
+
+    memcpy(out, &_blocks[sc][0], count * sizeof(void*));
+    memmove(&_blocks[sc][0], &_blocks[sc][count], (_counts[sc] - count) * sizeof(void*));
+    _counts[sc] -= count;
+    return count;
+  }
+
+private:
+  int _counts[xdefines::THREAD_CACHE_CLASSES];
+  void* _blocks[xdefines::THREAD_CACHE_CLASSES][xdefines::THREAD_CACHE_SIZE];
+};
+
+#endif
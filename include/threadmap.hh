@@ -22,6 +22,7 @@
 #include "mm.hh"
 #include "recordentries.hh"
 #include "semaphore.hh"
+#include "slab.hh"
 #include "spinlock.hh"
 #include "threadstruct.hh"
 #include "xdefines.hh"
@@ -59,8 +60,7 @@ public:
 
   void insertAliveThread(thread_t* thread, pthread_t tid) {
     // Malloc
-    struct aliveThread* ath =
-        (struct aliveThread*)InternalHeap::getInstance().malloc(sizeof(struct aliveThread));
+    struct aliveThread* ath = slab<struct aliveThread>::getInstance().alloc();
 		
 		assert(ath != NULL);
     listInit(&ath->list);
@@ -100,7 +100,7 @@ public:
       ath = (struct aliveThread*)nextEntry(&ath->list);
     }
 
-    InternalHeap::getInstance().free((void*)ath);
+    slab<struct aliveThread>::getInstance().free(ath);
 
     // Setting a thread structure to be "Free" status.
     setFreeThread(thread);
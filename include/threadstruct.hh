@@ -15,6 +15,7 @@
 #include "quarantine.hh"
 #include "recordentries.hh"
 #include "semaphore.hh"
+#include "threadcache.hh"
 #include "xcontext.hh"
 #include "xdefines.hh"
 
@@ -109,6 +110,10 @@ typedef struct thread {
 
   quarantine qlist;
 
+  // Free blocks of small size classes that this thread can reuse without
+  // going through its sub-heap.
+  threadcache heapcache;
+
   // struct syncEventList syncevents;
   list_t pendingSyncevents;
   // struct syncEventList pendingSyncevents;
@@ -120,6 +125,22 @@ typedef struct thread {
   // Main thread have completely stack setting.
   bool mainThread;
 
+  // Registers of a thread which is stopped or blocked when an epoch ends.
+  // It points to the context of the signal handler, or to blockedContext
+  // when the thread is waiting inside DoubleTake. The leak checker uses it
+  // to scan the registers and the stack of this thread.
+  ucontext_t* stopContext;
+  ucontext_t blockedContext;
+
+  // The page of software watch points that this thread is writing to, while the
+  // write is single-stepped, and the address of the write.
+  void* watchedPage;
+  void* watchedAddr;
+
+  // Perf events of the debug registers for this thread in the re-execution.
+  int watchFds[xdefines::MAX_WATCHPOINTS];
+  int numWatchFds;
+
   semaphore sema;
 
   xcontext context;
@@ -0,0 +1,64 @@
+#if !defined(DOUBLETAKE_UAFVERIFIER_H)
+#define DOUBLETAKE_UAFVERIFIER_H
+
+/*
+ * @file   uafverifier.h
+ * @brief  A background thread that checks the canaries of quarantined objects
+ *         while the program is running, so that a use-after-free is found
+ *         before the object is evicted or the program exits.
+ *         The verifier never touches a quarantine list, see quarantine::verifyObjects().
+ *         When it finds a corrupted object, the object is handed over to the next
+ *         thread calling free(), or to the end of current epoch, which installs
+ *         watchpoints and ends the epoch.
+ *         It is enabled by DETECT_USAGE_AFTER_FREE_BACKGROUND.
+ * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include <new>
+
+#include "xdefines.hh"
+
+class uafverifier {
+public:
+  uafverifier() : _hasCorruption(false) {
+    for(int i = 0; i < xdefines::MAX_ALIVE_THREADS; i++) {
+      _cursors[i] = 0;
+    }
+  }
+
+  static uafverifier& getInstance() {
+    static char buf[sizeof(uafverifier)];
+    static uafverifier* theOneTrueObject = new (buf) uafverifier();
+    return *theOneTrueObject;
+  }
+
+  // Start the verifier thread.
+  void initialize();
+
+  inline bool hasCorruption() { return __atomic_load_n(&_hasCorruption, __ATOMIC_RELAXED); }
+
+  // Check the reported object again. If it is still corrupted, watchpoints are
+  // installed on its corrupted words and true is returned.
+  bool checkCorruption();
+
+  // Called by the application threads: end current epoch on a corrupted object.
+  void handleCorruption();
+
+private:
+  static void* verifierThread(void* arg);
+
+  // Check a part of the quarantine lists of all threads.
+  void sweep();
+
+  pthread_t _thread;
+  bool _hasCorruption;
+  freeObject _corrupted;
+
+  // Where to continue on each thread's quarantine list.
+  size_t _cursors[xdefines::MAX_ALIVE_THREADS];
+};
+
+#endif
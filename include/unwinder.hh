@@ -0,0 +1,48 @@
+#if !defined(DOUBLETAKE_UNWINDER_H)
+#define DOUBLETAKE_UNWINDER_H
+
+/*
+ * @file   unwinder.h
+ * @brief  Get call stacks by walking the chain of frame pointers.
+ *         Every frame with a frame pointer saves the frame pointer of its caller at
+ *         fp[0] and its return address at fp[1]. The walk is bounded by the stack of
+ *         the current thread, and every frame must be above the last one, so it never
+ *         faults, never allocates and can be used in signal handlers.
+ *         When the chain is broken (code compiled without frame pointers), the stack
+ *         is unwound by backtrace() instead, which is called once at the beginning so
+ *         that libgcc is loaded before any signal handler needs it.
+ *         The stacks interrupted by signals are walked as well, since backtrace() is
+ *         not async-signal-safe. The return address at the stack pointer stands in for
+ *         the frame of an interrupted function that has not set up its own.
+ * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ucontext.h>
+
+class unwinder {
+public:
+  // Load libgcc for backtrace(), out of any signal handler.
+  static void initialize();
+
+  // Get the return addresses of the callers of this function, like backtrace().
+  static int getCallStack(void** frames, int maxDepth) __attribute__((noinline));
+
+  // Only the frames reached by frame pointers, which may be fewer than backtrace()
+  // finds, but never falls back to it. For call stacks taken on every allocation.
+  static int getCallStackFast(void** frames, int maxDepth) __attribute__((noinline));
+
+  // Get the call stack of the code interrupted by a signal. The first frame is
+  // the interrupted instruction, plus one so that it reads as a return address.
+  static int getCallStack(ucontext_t* context, void** frames, int maxDepth);
+
+private:
+  static int walk(uintptr_t fp, uintptr_t sp, void** frames, int depth, int maxDepth,
+                  bool* isComplete);
+  static bool isOnStack(uintptr_t addr);
+  static bool isReturnAddress(uintptr_t addr);
+  static int getBacktrace(void** frames, int maxDepth, void* ip) __attribute__((noinline));
+};
+
+#endif
@@ -6,6 +6,18 @@
  * @brief  Watch point handler, we are relying the dr.c to add watchpoint and detect the condition
  * of
  *         watch point, dr.c is adopted from GDB-7.5/gdb/i386-nat.c.
+ *         There are only four debug registers. Other watch points in the heap are
+ *         watched in software during the re-execution: their pages are made
+ *         read-only, and a write on such a page is single-stepped with the trap
+ *         flag, so that the watched words can be checked after the instruction.
+ *         A system call writing into such a page has it opened around the call
+ *         and its watched words compared afterwards, and a write of another
+ *         thread while the page is open may be missed.
+ *         Perf events only watch the thread that opens them, so every thread arms
+ *         its own when it starts the re-execution, and their traps go to the
+ *         thread doing the write.
+ *         The epoch is re-executed again while some watch points have no call
+ *         stack and have not been in a debug register, with the next ones there.
  * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
  */
 
@@ -28,6 +40,10 @@ public:
     unsigned long faultyvalue;
     unsigned long currentvalue;
     CallSite faultySite;
+    // Whether a call stack of this fault is reported.
+    bool isDiagnosed;
+    // Whether it has been in a debug register in a re-execution.
+    bool hasRegister;
   };
 
   static watchpoint& getInstance() {
@@ -36,7 +52,9 @@ public:
     return *theOneTrueObject;
   }
 
-  // Add a watch point with its value to watchpoint list.
+  // Add a watch point with its value to watchpoint list. Return true if it is a new
+  // fault, i.e., it is neither known from an earlier re-execution nor watched yet,
+  // and there is room for it.
   bool addWatchpoint(void* addr, size_t value, faultyObjectType objtype, void* objectstart,
                      size_t objectsize);
 
@@ -47,6 +65,29 @@ public:
   // Set all watch points before rollback.
   void installWatchpoints();
 
+  // Arm the debug registers of current thread, when it starts the re-execution.
+  void installThreadWatchpoints();
+
+  // Remove the watch points of the last re-execution.
+  void uninstallWatchpoints();
+
+  // Whether another re-execution may diagnose more faults.
+  bool hasNextBatch();
+
+  // Forget the watch points after the last re-execution. Their faulty values are
+  // kept, so that the same corruption doesn't cause another rollback.
+  void clearWatchpoints();
+
+  // Called from the SEGV handler. Return true if the fault is on a page of
+  // software watch points, which is then single-stepped.
+  bool handleFault(void* addr, void* context);
+
+  // A system call can not write into a read-only page, so the pages of software
+  // watch points in [start, start + size) are opened before it, and their watch
+  // points are checked after it.
+  void beginSystemCall(void* start, size_t size);
+  void endSystemCall(void* start, size_t size);
+
   // Use perf_event_open to install a particular watch points.
   int install_watchpoint(uintptr_t address, int sig, int group);
 
@@ -64,13 +105,54 @@ public:
   static void trapHandler(int sig, siginfo_t* siginfo, void* context);
 
 private:
-  watchpoint() : _numWatchpoints(0) {}
+  // The trap flag of EFLAGS.
+  enum { EFLAGS_TF = 0x100 };
+
+  struct knownFault {
+    void* addr;
+    unsigned long value;
+  };
+
+  struct protectedPage {
+    void* page;
+    // Threads stepping a write on this page.
+    int writers;
+  };
+
+  watchpoint()
+    : _numWatchpoints(0), _numHardwareWatchpoints(0), _numActiveWatchpoints(0), _numPages(0),
+      _numKnownFaults(0) {}
   ~watchpoint() {}
 
+  bool isKnownFault(void* addr, unsigned long value);
+  bool isWatched(void* addr, unsigned long value);
+  void assignWatchpoints();
+  void swapWatchpoints(int i, int j, int* sharers);
+  void protectPages();
+  protectedPage* findPage(void* addr);
+
+  // Check the software watch points after a single-stepped write.
+  bool handleStep(siginfo_t* siginfo, ucontext_t* context);
+  void finishStep(ucontext_t* context);
+
+  static void reportAccess(faultyObject* object, ucontext_t* context);
+  static void reportAccess(faultyObject* object, int depth, void** callsites);
+
   int _numWatchpoints;
 
-  // Watchpoint array, we can only support 4 watchpoints totally.
-  faultyObject _wp[xdefines::MAX_WATCHPOINTS];
+  // In a re-execution, the first _numHardwareWatchpoints are in debug registers,
+  // and others up to _numActiveWatchpoints are in software.
+  int _numHardwareWatchpoints;
+  int _numActiveWatchpoints;
+  faultyObject _wp[xdefines::MAX_WATCHPOINTS + xdefines::MAX_SOFTWARE_WATCHPOINTS];
+
+  // Read-only pages of software watch points, sorted by address.
+  int _numPages;
+  protectedPage _pages[xdefines::MAX_SOFTWARE_WATCHPOINTS];
+
+  // Faults diagnosed in earlier re-executions.
+  int _numKnownFaults;
+  knownFault _knownFaults[xdefines::MAX_WATCHPOINTS + xdefines::MAX_SOFTWARE_WATCHPOINTS];
 };
 
 #endif
@@ -0,0 +1,111 @@
+#if !defined(DOUBLETAKE_WORKDEQUE_H)
+#define DOUBLETAKE_WORKDEQUE_H
+
+/*
+ * @file   workdeque.h
+ * @brief  A work-stealing deque of addresses (Chase and Lev, "Dynamic Circular
+ *         Work-Stealing Deque"), with a fixed capacity.
+ *         The owner pushes and pops at the bottom without locks, while other
+ *         threads steal from the top. Only the last entry is contended.
+ * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
+ */
+
+#include <stddef.h>
+
+#include "log.hh"
+#include "mm.hh"
+#include "xdefines.hh"
+
+class workdeque {
+  enum { CAPACITY = xdefines::LEAK_MARK_DEQUE_SIZE };
+  enum { MASK = CAPACITY - 1 };
+
+public:
+  workdeque() : _top(0), _bottom(0), _entries(NULL) {}
+
+  void initialize() {
+    _entries = (unsigned long*)MM::mmapAllocatePrivate(CAPACITY * sizeof(unsigned long));
+    REQUIRE(_entries != NULL, "Failed to allocate a work deque");
+  }
+
+  // Only called when nobody is using this deque.
+  void reset() {
+    _top = 0;
+    _bottom = 0;
+  }
+
+  // Called by the owner. Return false if the deque is full.
+  bool push(unsigned long value) {
+    long bottom = __atomic_load_n(&_bottom, __ATOMIC_RELAXED);
+    long top = __atomic_load_n(&_top, __ATOMIC_ACQUIRE);
+
+    if(bottom - top >= CAPACITY) {
+      return false;
+    }
+
+    __atomic_store_n(&_entries[bottom & MASK], value, __ATOMIC_RELAXED);
+    __atomic_store_n(&_bottom, bottom + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  // Called by the owner.
+  bool pop(unsigned long* value) {
+    long bottom = __atomic_load_n(&_bottom, __ATOMIC_RELAXED) - 1;
+
+    __atomic_store_n(&_bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    long top = __atomic_load_n(&_top, __ATOMIC_RELAXED);
+    bool found = false;
+
+    if(top <= bottom) {
+      *value = __atomic_load_n(&_entries[bottom & MASK], __ATOMIC_RELAXED);
+      found = true;
+
+      // The last entry: race against the thieves.
+      if(top == bottom) {
+        found = __atomic_compare_exchange_n(&_top, &top, top + 1, false, __ATOMIC_SEQ_CST,
+                                            __ATOMIC_RELAXED);
+        __atomic_store_n(&_bottom, bottom + 1, __ATOMIC_RELAXED);
+      }
+    } else {
+      __atomic_store_n(&_bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+
+    return found;
+  }
+
+  // Called by other threads. A false return may also mean a lost race.
+  bool steal(unsigned long* value) {
+    long top = __atomic_load_n(&_top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long bottom = __atomic_load_n(&_bottom, __ATOMIC_ACQUIRE);
+
+    if(top >= bottom) {
+      return false;
+    }
+
+    unsigned long entry = __atomic_load_n(&_entries[top & MASK], __ATOMIC_RELAXED);
+    if(!__atomic_compare_exchange_n(&_top, &top, top + 1, false, __ATOMIC_SEQ_CST,
+                                    __ATOMIC_RELAXED)) {
+      return false;
+    }
+
+    *value = entry;
+    return true;
+  }
+
+  bool isEmpty() {
+    return __atomic_load_n(&_top, __ATOMIC_ACQUIRE) >= __atomic_load_n(&_bottom, __ATOMIC_ACQUIRE);
+  }
+
+private:
+  // Thieves and the owner work on different cache lines.
+  long _top;
+  char _padding0[xdefines::CACHE_LINE_SIZE - sizeof(long)];
+  long _bottom;
+  unsigned long* _entries;
+  char _padding1[xdefines::CACHE_LINE_SIZE - sizeof(long) - sizeof(unsigned long*)];
+};
+
+#endif
@@ -0,0 +1,80 @@
+#if !defined(DOUBLETAKE_WORKLIST_H)
+#define DOUBLETAKE_WORKLIST_H
+
+/*
+ * @file   worklist.h
+ * @brief  A LIFO stack of addresses, kept in chunks of LEAK_WORKLIST_CHUNK_SIZE bytes.
+ *         Chunks are mapped directly and kept for reuse, so that pushing an address
+ *         never calls an allocator. It is owned by a single thread.
+ * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
+ */
+
+#include <stddef.h>
+
+#include "log.hh"
+#include "mm.hh"
+#include "xdefines.hh"
+
+class worklist {
+  struct chunk {
+    chunk* prev;
+    size_t count;
+  };
+
+  enum {
+    ENTRIES_PER_CHUNK = (xdefines::LEAK_WORKLIST_CHUNK_SIZE - sizeof(chunk)) / sizeof(unsigned long)
+  };
+
+public:
+  worklist() : _top(NULL), _free(NULL) {}
+
+  inline bool isEmpty() { return _top == NULL; }
+
+  inline void push(unsigned long value) {
+    if(_top == NULL || _top->count == ENTRIES_PER_CHUNK) {
+      newChunk();
+    }
+    getEntries(_top)[_top->count++] = value;
+  }
+
+  inline bool pop(unsigned long* value) {
+    if(_top == NULL) {
+      return false;
+    }
+
+    *value = getEntries(_top)[--_top->count];
+
+    // Keep the empty chunk for later pushes.
+    if(_top->count == 0) {
+      chunk* empty = _top;
+      _top = empty->prev;
+      empty->prev = _free;
+      _free = empty;
+    }
+    return true;
+  }
+
+private:
+  static inline unsigned long* getEntries(chunk* c) { return (unsigned long*)(c + 1); }
+
+  void newChunk() {
+    chunk* c = _free;
+
+    if(c != NULL) {
+      _free = c->prev;
+    } else {
+      c = (chunk*)MM::mmapAllocatePrivate(xdefines::LEAK_WORKLIST_CHUNK_SIZE);
+      REQUIRE(c != NULL, "Failed to allocate a worklist chunk");
+    }
+
+    c->prev = _top;
+    c->count = 0;
+    _top = c;
+  }
+
+  chunk* _top;
+  // Empty chunks
+  chunk* _free;
+};
+
+#endif
@@ -92,6 +92,8 @@ struct freeObject {
     int owner; // which thread is using this heap.
     size_t size;
   };
+  // How many times this object has been kept beyond its turn.
+  int rounds;
 };
 
 class xdefines {
@@ -110,9 +112,71 @@ public:
 
   enum { QUARANTINE_BUF_SIZE = 1024 };
 
-  // If total free objects is larger than this size, we begin to
-  // re-use those objects
-  enum { QUARANTINE_TOTAL_SIZE = 1048576 * 16 };
+  // Every thread can keep QUARANTINE_THREAD_RESERVE bytes of freed objects.
+  // Beyond that, all threads share a budget between QUARANTINE_MIN_BUDGET and
+  // QUARANTINE_MAX_BUDGET, which is set to the amount freed in the last
+  // QUARANTINE_BUDGET_EPOCHS epochs. The budget is halved when free memory is
+  // less than 1/QUARANTINE_LOW_MEMORY_RATIO of total memory.
+  enum { QUARANTINE_THREAD_RESERVE = 1048576 };
+  enum { QUARANTINE_MIN_BUDGET = 1048576 * 16 };
+  enum { QUARANTINE_MAX_BUDGET = 1048576 * 256 };
+  enum { QUARANTINE_BUDGET_EPOCHS = 4 };
+  enum { QUARANTINE_LOW_MEMORY_RATIO = 8 };
+
+  // Objects in the size classes with use-after-free errors stay in the quarantine
+  // for so many extra rounds. Set it to 0 to disable this bias.
+  enum { QUARANTINE_HOT_ROUNDS = 2 };
+
+  // The background verifier checks UAF_VERIFIER_BATCH quarantined objects of
+  // every thread each UAF_VERIFIER_INTERVAL nanoseconds.
+  enum { UAF_VERIFIER_INTERVAL = 10000000 };
+  enum { UAF_VERIFIER_BATCH = 64 };
+
+  // The leak check marks reachable objects with up to LEAK_MARK_THREADS threads.
+  // Each of them owns a deque of LEAK_MARK_DEQUE_SIZE pointers (a power of 2),
+  // which spills into a stack of LEAK_WORKLIST_CHUNK_SIZE chunks when it is full.
+  // Global regions are scanned in pieces of LEAK_ROOT_CHUNK_SIZE bytes, and the
+  // heap is searched for unreachable objects in pieces of LEAK_HEAP_CHUNK_SIZE bytes.
+  enum { LEAK_MARK_THREADS = 8 };
+  enum { LEAK_MARK_DEQUE_SIZE = 8192 };
+  enum { LEAK_WORKLIST_CHUNK_SIZE = 32768 };
+  enum { LEAK_ROOT_CHUNK_SIZE = 262144 };
+  enum { LEAK_HEAP_CHUNK_SIZE = 1048576 * 4 };
+
+  // When the kernel tracks soft-dirty pages, leak checks are incremental, and
+  // only one of LEAK_FULL_CHECK_EPOCHS checks is a full one.
+  enum { LEAK_FULL_CHECK_EPOCHS = 16 };
+
+  // A leak snapshot groups unreachable objects in up to LEAK_SNAPSHOT_GROUPS groups
+  // (a power of 2), and prints the LEAK_SNAPSHOT_REPORT largest ones.
+  enum { LEAK_SNAPSHOT_GROUPS = 4096 };
+  enum { LEAK_SNAPSHOT_REPORT = 20 };
+
+  // Freed objects of at least PAGE_QUARANTINE_MIN_SIZE are protected page by page
+  // instead of being canaried. This quarantine has its own slots and total size.
+  enum { PAGE_QUARANTINE_MIN_SIZE = 16384 };
+  enum { PAGE_QUARANTINE_SLOTS = 256 };
+  enum { PAGE_QUARANTINE_TOTAL_SIZE = 1048576 * 256 };
+
+  // Each thread caches free blocks of the first THREAD_CACHE_CLASSES size
+  // classes (16 bytes up to 2KB) in magazines of THREAD_CACHE_SIZE slots.
+  // Magazines are refilled and flushed THREAD_CACHE_BATCH blocks at a time.
+  enum { THREAD_CACHE_CLASSES = 9 };
+  enum { THREAD_CACHE_SIZE = 32 };
+  enum { THREAD_CACHE_BATCH = 8 };
+
+  // Fixed-size internal records (hash entries, tracked objects, sync entries)
+  // are carved from SLAB_SIZE slabs. Each thread keeps up to SLAB_CACHE_SIZE
+  // free records of each type before returning them to the shared list.
+  enum { SLAB_SIZE = 65536 };
+  enum { SLAB_CACHE_SIZE = 64 };
+
+  // An aligned allocation first looks at up to MEMALIGN_SEARCH_BLOCKS free blocks
+  // of its size class for one that is already aligned.
+  enum { MEMALIGN_SEARCH_BLOCKS = 16 };
+
+  // A realloc shrinks a block in place only if the block is at least this large.
+  enum { REALLOC_SHRINK_SIZE = 65536 };
 
   // 128M so that almost all memory is allocated from the begining.
   enum { USER_HEAP_CHUNK = 1048576 * 4 };
@@ -128,6 +192,14 @@ public:
   enum { BIT_SECTOR_SIZE = 32 };
 
   enum { MAX_WATCHPOINTS = 4 };
+
+  // Watch points beyond the debug registers, which are watched by protecting
+  // their pages in the re-execution.
+  enum { MAX_SOFTWARE_WATCHPOINTS = 1024 };
+
+  // An epoch is re-executed again while some faults have no call stacks, with
+  // other watch points in the debug registers.
+  enum { MAX_REEXECUTIONS = 8 };
   enum { PageSize = 4096UL };
   enum { PAGE_SIZE_MASK = (PageSize - 1) };
 
@@ -156,7 +228,20 @@ public:
   enum { MAGIC_BYTE_NOT_ALIGNED = 0x7E };
   enum { FREE_OBJECT_CANARY_WORDS = 16 };
   enum { FREE_OBJECT_CANARY_SIZE = 16 * WORD_SIZE };
+  // With DETECT_USAGE_AFTER_FREE_WHOLE, objects up to this size are canaried entirely.
+  enum { FREE_OBJECT_WHOLE_CANARY_SIZE = 4096 };
   enum { CALLSITE_MAXIMUM_LENGTH = 10 };
+  // Slots of the table of interned callsites, a power of 2.
+  enum { CALLSITE_TABLE_SIZE = 16384 };
+  // Frames of the allocation sites stamped with DETECT_ALLOCATION_SITES.
+  enum { ALLOCATION_SITE_DEPTH = 4 };
+  // Frames of a call stack unwound by backtrace(), when frame pointers are broken.
+  enum { UNWINDER_MAX_FRAMES = 256 };
+  // Objects whose symbols and line tables are kept by the symbolizer.
+  enum { SYMBOLIZER_MAX_OBJECTS = 64 };
+  // Frames of a call stack that are printed, and inline frames of a frame.
+  enum { SYMBOLIZER_MAX_FRAMES = 256 };
+  enum { SYMBOLIZER_MAX_INLINES = 16 };
 
   // FIXME: the following definitions are sensitive to
   // glibc version (possibly?)
@@ -173,10 +258,8 @@ public:
 
 #ifdef X86_32BIT
   enum { SENTINEL_WORD = 0xCAFEBABE };
-  enum { MEMALIGN_SENTINEL_WORD = 0xDADEBABE };
 #else
   enum { SENTINEL_WORD = 0xCAFEBABECAFEBABE };
-  enum { MEMALIGN_SENTINEL_WORD = 0xDADEBABEDADEBABE };
 #endif
 };
 
@@ -24,8 +24,11 @@
 #include "log.hh"
 #include "memtrack.hh"
 #include "objectheader.hh"
+#include "pagequarantine.hh"
 #include "real.hh"
 #include "selfmap.hh"
+#include "sitemap.hh"
+#include "uafverifier.hh"
 #include "threadstruct.hh"
 #include "watchpoint.hh"
 #include "xdefines.hh"
@@ -64,6 +67,9 @@ public:
         (intptr_t)_pheap.initialize((void*)xdefines::USER_HEAP_BASE, xdefines::USER_HEAP_SIZE);
 
     _heapEnd = _heapBegin + xdefines::USER_HEAP_SIZE;
+#if defined(DETECT_ALLOCATION_SITES)
+    sitemap::getInstance().initialize((void*)_heapBegin, xdefines::USER_HEAP_SIZE);
+#endif
     _globals.initialize();
   }
 
@@ -91,8 +97,53 @@ public:
   }
 
   inline void* calloc(size_t nmemb, size_t sz) {
-    void* ptr = malloc(nmemb * sz);
-    return ptr;
+    void* ptr = NULL;
+    size_t size;
+
+    if(!getArraySize(nmemb, sz, &size)) {
+      return NULL;
+    }
+
+    if(current->internalheap == true) {
+      ptr = InternalHeap::getInstance().malloc(size);
+      clearMemory(ptr, size);
+      return ptr;
+    }
+
+    ptr = _pheap.malloc(getBlockSize(size));
+    if(ptr == NULL) {
+      return NULL;
+    }
+
+    // Blocks that are carved from never-used memory are still zero, except
+    // the first word that may hold the link of a free list.
+    // We only need to clean up those recycled blocks.
+    // This must be done before the guard zone is installed.
+    if(getObject(ptr)->isObjectFresh()) {
+      *((void**)ptr) = NULL;
+    } else {
+      clearMemory(ptr, size);
+    }
+
+    return setupObject(ptr, size);
+  }
+
+  // Get the size of an array of nmemb elements, unless the multiplication overflows.
+  static inline bool getArraySize(size_t nmemb, size_t sz, size_t* size) {
+    *size = nmemb * sz;
+    return (sz == 0 || *size / sz == nmemb);
+  }
+
+  // Zero a block of memory. Large blocks are cleaned with "rep stosb", which
+  // is using the fast string operations on modern x86 processors.
+  static inline void clearMemory(void* ptr, size_t size) {
+#if defined(__x86_64__) || defined(__i386__)
+    if(size >= xdefines::PageSize) {
+      asm volatile("rep stosb" : "+D"(ptr), "+c"(size) : "a"(0) : "memory");
+      return;
+    }
+#endif
+    memset(ptr, 0, size);
   }
 
 	inline void setSentinels(void * ptr, size_t blockSize, size_t sz) {
@@ -161,9 +212,8 @@ public:
     // Get the block size
 		size_t objSize = o->getObjectSize();
 
+		if(inRange((intptr_t)ptr)) {
 #ifdef DETECT_OVERFLOW
-		size_t blockSize = o->getSize();
-		if(blockSize >= sz) {
 			if(!global_isRollback()) {
 				// Check the object overflow.
       	if(checkOverflowAndCleanSentinels(ptr)) {
@@ -173,14 +223,21 @@ public:
 	#endif
 				}
       }
+#endif
 
-			// Change the size of object to the new address
-			o->setObjectSize(sz);
+			// Try to grow or shrink the block without moving the object.
+			if(_pheap.resize(ptr, getBlockSize(sz))) {
+				// Change the size of object to the new address
+				o->setObjectSize(sz);
 
-			setSentinels(ptr, blockSize, sz);
-			return ptr;
-		}
+#ifdef DETECT_OVERFLOW
+				// Also when the object fills its block, since the guard at the end of
+				// the block is cleaned with the old sentinels.
+				setSentinels(ptr, o->getSize(), sz);
 #endif
+				return ptr;
+			}
+		}
 		
   	void * buf = malloc(sz);
 
@@ -199,86 +256,29 @@ public:
 
   // Actual allocations
   inline void* realmalloc(size_t sz) {
-    unsigned char* ptr = NULL;
-   	size_t mysize = sz;
-
-    if(sz == 0) {
-			sz = 1;
-    }
-		
-		// Align the object size, which should be multiple of 16 bytes.
-    if(sz < 16) {
-      mysize = 16;
-    }
-		mysize = (mysize + 15) & ~15;
-
-    ptr = (unsigned char*)_pheap.malloc(mysize);
-    objectHeader* o = getObject(ptr);
-
-    // Set actual size there.
-    o->setObjectSize(sz);
-
-#ifdef DETECT_OVERFLOW
-    // Get the block size
-    size_t size = o->getSize();
-
-    assert(size >= sz);
-    // Add another guard zone if block size is larger than actual size
-    // in order to capture the 1 byte overflow.
-//    PRINT("realmalloc at line %d size %ld sz %ld mysize %ld\n", __LINE__, size, sz, mysize);
-    // Set actual size there.
-    if(size > sz) {
-			setSentinels(ptr, size, sz);
-    }
-#endif
+    void* ptr = _pheap.malloc(getBlockSize(sz));
 
-    // Check the malloc if it is in rollback phase.
-    if(global_isRollback()) {
-      memtrack::getInstance().check(ptr, sz, MEM_TRACK_MALLOC);
-    }
-
-//		PRINT("realmalloc object %p\n", ptr);
-    // We donot need to do anything if size is equal to sz
-    //   PRINT("***********malloc object from %p to %lx. sz %lx\n", ptr, (unsigned long)ptr + sz,
-    // sz);
-    return ptr;
-  }
-
-  // We are trying to find the aligned address starting from ptr
-  // to ptr+boundary.
-  inline void* getAlignedAddress(void* ptr, size_t boundary) {
-    return ((intptr_t)ptr % boundary == 0)
-               ? ptr
-               : ((void*)(((intptr_t)ptr + boundary) & (~(boundary - 1))));
+    return setupObject(ptr, sz);
   }
 
+  // Aligned objects are ordinary heap objects whose start address happens to
+  // be aligned, thus they can be freed without any special treatment.
   inline void* memalign(size_t boundary, size_t sz) {
-    // Actually, malloc is easy. Just have more memory at first.
-    void* ptr = malloc(boundary + sz);
+    void* ptr;
 
-    // Since the returned ptr is not aligned, return next aligned address
-    void* newptr = getAlignedAddress(ptr, boundary);
-
-    // check offset between newptr and ptr
-    size_t offset = (intptr_t)newptr - (intptr_t)ptr;
-    if(offset == 0) {
-      newptr = (void*)((intptr_t)newptr + boundary);
-      offset = boundary;
+    if(current->internalheap == true) {
+      // Objects of the internal heap are never given back through free().
+      ptr = InternalHeap::getInstance().malloc(sz + boundary);
+      return (void*)alignup((intptr_t)ptr, boundary);
     }
 
-    // Check whether the offset is valid?
-    assert(offset >= 2 * sizeof(size_t));
-#if defined(DETECT_OVERFLOW) || defined(DETECT_MEMORY_LEAKS)
-    // Put a sentinel before the this memory block. We should do this
-    sentinelmap::getInstance().setMemalignSentinelAt((void*)((intptr_t)newptr - sizeof(size_t)));
-#endif
-
-    // Put the offset before the sentinel too
-    void** origptr = (void**)((intptr_t)newptr - 2 * sizeof(size_t));
-    *origptr = ptr;
+    ptr = _pheap.memalign(boundary, getBlockSize(sz));
+    if(ptr == NULL) {
+      return NULL;
+    }
 
-    PRINF("memalign: ptr %p newptr %p\n", ptr, newptr);
-    return newptr;
+    PRINF("memalign: boundary %#zx ptr %p\n", boundary, ptr);
+    return setupObject(ptr, sz);
   }
 
 #ifdef DETECT_OVERFLOW
@@ -303,25 +303,6 @@ public:
   }
 #endif
 
-  // Get the actual pointer of memory block
-  // Since we are putting a special magic number before this pointer
-  // we can check the magic number.
-  // If the magic number is corrupted, then we can find out later.
-  void* getObjectPtrAtFree(void* ptr) {
-    size_t* prevPtr = (size_t*)((intptr_t)ptr - sizeof(size_t));
-    void* origptr = ptr;
-
-    if(*prevPtr == xdefines::MEMALIGN_SENTINEL_WORD) {
-      void** ppPtr = (void**)((intptr_t)ptr - 2 * sizeof(size_t));
-#ifdef DETECT_OVERFLOW
-      // Now we will cleanup the sentinel word.
-      sentinelmap::getInstance().clearSentinelAt(prevPtr);
-#endif
-      origptr = *ppPtr;
-    }
-    return origptr;
-  }
-
   bool inRange(intptr_t addr) { return (addr > _heapBegin && addr < _heapEnd) ? true : false; }
 
   // We should mark this whole objects with
@@ -329,15 +310,18 @@ public:
   // Change the free operation to put into the tail of
   // list.
   void free(void* ptr) {
-    void* origptr;
+#if defined(DETECT_USAGE_AFTER_FREE_BACKGROUND)
+    // A corrupted object has been found by the background verifier.
+    if(uafverifier::getInstance().hasCorruption()) {
+      uafverifier::getInstance().handleCorruption();
+    }
+#endif
 
     if(!inRange((intptr_t)ptr)) {
       return;
     }
 
-    // Check whether this is an memaligned object.
-    origptr = getObjectPtrAtFree(ptr);
-    objectHeader* o = getObject(origptr);
+    objectHeader* o = getObject(ptr);
 
 #ifndef EVALUATING_PERF
     // Check for double free
@@ -350,9 +334,9 @@ public:
 #ifdef DETECT_OVERFLOW
     // If this object has a overflow, we donot need to free this object
     if(!global_isRollback()) {
-      if(checkOverflowAndCleanSentinels(origptr)) {
+      if(checkOverflowAndCleanSentinels(ptr)) {
 #ifndef EVALUATING_PERF
-      	PRWRN("DoubleTake: Caught buffer overflow error. ptr %p\n", origptr);
+      	PRWRN("DoubleTake: Caught buffer overflow error. ptr %p\n", ptr);
         xthread::invokeCommit();
 #endif
         return;
@@ -366,7 +350,7 @@ public:
       memtrack::getInstance().check(ptr, o->getObjectSize(), MEM_TRACK_FREE);
     }
 
-    _pheap.free(origptr);
+    _pheap.free(ptr);
 
     // We remove the actual size of this object to set free on an object.
     o->setObjectFree();
@@ -392,6 +376,12 @@ public:
 
   /// Called when a thread need to rollback.
   inline void rollback() {
+    // The watch points of an earlier re-execution are replaced below.
+    watchpoint::getInstance().uninstallWatchpoints();
+
+#if defined(DETECT_USAGE_AFTER_FREE)
+    pagequarantine::getInstance().unprotectAll();
+#endif
 
     // Release all private pages.
     _globals.recoverMemory();
@@ -399,6 +389,11 @@ public:
 
     _pheap.recoverHeapMetadata();
 
+#if defined(DETECT_USAGE_AFTER_FREE)
+    pagequarantine::getInstance().restore();
+    pagequarantine::getInstance().protectAll();
+#endif
+
     // Now those watchpoints should be saved successfully,
     // We might have to install the watchpoints now.
     watchpoint::getInstance().installWatchpoints();
@@ -406,6 +401,11 @@ public:
 
   /// Rollback only without install watchpoints.
   inline void rollbackonly() {
+    watchpoint::getInstance().uninstallWatchpoints();
+
+#if defined(DETECT_USAGE_AFTER_FREE)
+    pagequarantine::getInstance().unprotectAll();
+#endif
 
     // Release all private pages.
     _globals.recoverMemory();
@@ -415,6 +415,11 @@ public:
     // we will pass the position of heap inside recoverMemory.
     _pheap.recoverHeapMetadata();
 
+#if defined(DETECT_USAGE_AFTER_FREE)
+    pagequarantine::getInstance().restore();
+    pagequarantine::getInstance().protectAll();
+#endif
+
     // We do not need to install watch points if we only rollback.
     watchpoint::getInstance().installWatchpoints();
   }
@@ -425,13 +430,26 @@ public:
   //  exit(-1);
   }
 
+  // Give cached free blocks of a thread back to its sub-heap.
+  inline void flushThreadCache(thread_t* thread) { _pheap.flushThreadCache(thread); }
+
   /// Transaction begins.
   inline void epochBegin() {
     _pheap.saveHeapMetadata();
 
+#if defined(DETECT_USAGE_AFTER_FREE)
+    // Protected pages can't be copied.
+    pagequarantine::getInstance().unprotectAll();
+#endif
+
     // Backup all existing data.
     _pheap.backup();
     _globals.backup();
+
+#if defined(DETECT_USAGE_AFTER_FREE)
+    pagequarantine::getInstance().backup();
+    pagequarantine::getInstance().protectAll();
+#endif
   }
 
   inline void* getHeapEnd() { return _pheap.getHeapEnd(); }
@@ -472,16 +490,16 @@ public:
 		
 
 #ifdef DETECT_OVERFLOW
-    hasOverflow = _pheap.checkHeapOverflow();
+    // Every corrupted sentinel adds a watch point, except those diagnosed in an
+    // earlier re-execution.
+    _pheap.checkHeapOverflow();
 #endif
 //		PRINT("checkHeapOverflow: line %d hasOverflow %d\n", __LINE__, hasOverflow);
     // double elapse = stop(&startTime, NULL);
-    if(hasOverflow == false) {
-      // Check whether overflows and underflows have been detected
-      // in the normal execution phase, like free()
-      if(watchpoint::getInstance().hasToRollback()) {
-        hasOverflow = true;
-      }
+    // Check whether overflows and underflows have been detected
+    // in the normal execution phase, like free()
+    if(watchpoint::getInstance().hasToRollback()) {
+      hasOverflow = true;
     }
     return hasOverflow;
   }
@@ -506,16 +524,33 @@ public:
   static void segvHandle(int /* signum */, siginfo_t* siginfo, void* context) {
     void* addr = siginfo->si_addr; // address of access
 
+    // A write on a page of software watch points in the re-execution.
+    if(watchpoint::getInstance().handleFault(addr, context)) {
+      return;
+    }
+
+#if defined(DETECT_USAGE_AFTER_FREE)
+    // An access on a freed object in the page quarantine.
+    if(pagequarantine::getInstance().handleFault(addr, (ucontext_t*)context)) {
+      return;
+    }
+#endif
+
     PRINT("%d: Segmentation fault error %d at addr %p!\n", current->index, siginfo->si_code, addr);
     current->internalheap = true;
-    selfmap::getInstance().printCallStack();
+    selfmap::getInstance().printCallStack((ucontext_t*)context);
     current->internalheap = false;
     PRINT("%d: Segmentation fault error %d at addr %p!\n", current->index, siginfo->si_code, addr);
-    while(1) ;
+
+    // Restore the default action so that the faulting instruction terminates the program.
+    struct sigaction siga;
+    memset(&siga, 0, sizeof(siga));
+    siga.sa_handler = SIG_DFL;
+    Real::sigaction(SIGSEGV, &siga, NULL);
 
     //Real::exit(-1);
     // Set the context to handleSegFault
-    jumpToFunction((ucontext_t*)context, (unsigned long)xmemory::getInstance().handleSegFault);
+    //jumpToFunction((ucontext_t*)context, (unsigned long)xmemory::getInstance().handleSegFault);
     //    xmemory::getInstance().handleSegFault ();
   }
 
@@ -547,6 +582,11 @@ public:
 #endif
 
     siga.sa_sigaction = xmemory::segvHandle;
+#if defined(DETECT_USAGE_AFTER_FREE) || defined(DETECT_OVERFLOW)
+    // Accesses on the protected pages of freed objects are reported by segvHandle,
+    // which also steps the writes on pages of software watch points.
+    Real::sigaction(SIGSEGV, &siga, NULL);
+#endif
     //if(Real::sigaction(SIGSEGV, &siga, NULL) == -1) {
     //  printf("sfug.\n");
     //  exit(-1);
@@ -556,6 +596,54 @@ public:
   }
 
 private:
+  // Align the object size, which should be multiple of 16 bytes.
+  inline size_t getBlockSize(size_t sz) {
+    if(sz < 16) {
+      sz = 16;
+    }
+    return (sz + 15) & ~15;
+  }
+
+  // Record the actual size of a newly allocated object and add the guard zone.
+  inline void* setupObject(void* ptr, size_t sz) {
+    if(sz == 0) {
+			sz = 1;
+    }
+
+    objectHeader* o = getObject(ptr);
+
+    // Set actual size there. This block is not fresh any more.
+    o->setObjectSize(sz);
+    o->cleanObjectFresh();
+#if defined(DETECT_MEMORY_LEAKS)
+    // The leak check keeps the marks of reachable objects, maybe of a freed one.
+    o->cleanObjectChecked();
+#endif
+
+#ifdef DETECT_OVERFLOW
+    // Get the block size
+    size_t size = o->getSize();
+
+    assert(size >= sz);
+    // Add another guard zone if block size is larger than actual size
+    // in order to capture the 1 byte overflow.
+    if(size > sz) {
+			setSentinels(ptr, size, sz);
+    }
+#endif
+
+#if defined(DETECT_ALLOCATION_SITES)
+    sitemap::getInstance().stamp(ptr);
+#endif
+
+    // Check the malloc if it is in rollback phase.
+    if(global_isRollback()) {
+      memtrack::getInstance().check(ptr, sz, MEM_TRACK_MALLOC);
+    }
+
+    return ptr;
+  }
+
   /// The globals region.
   xglobals _globals;
 
@@ -12,10 +12,13 @@
 
 #include <new>
 
+#include "blockmap.hh"
 #include "compat.hh"
 #include "log.hh"
 #include "objectheader.hh"
 #include "sentinelmap.hh"
+#include "threadcache.hh"
+#include "threadstruct.hh"
 #include "xdefines.hh"
 
 // Include all of heaplayers
@@ -40,8 +43,9 @@ public:
     }
 
 //	  fprintf(stderr, "AdaptAppHeap malloc sz %lx ptr %p\n", sz, ptr);
-    // Set the objectHeader.
+    // Set the objectHeader. Memory from the source heap has never been used.
     objectHeader* o = new (ptr) objectHeader(sz);
+    o->markObjectFresh();
     void* newptr = getPointer(o);
 
 // Now we are adding two sentinels and mark them on the shared bitmap.
@@ -49,6 +53,7 @@ public:
 // sizeof(objectHeader) + 2 * xdefines::SENTINEL_SIZE);
 #if defined(DETECT_OVERFLOW) || defined(DETECT_MEMORY_LEAKS)
     sentinelmap::getInstance().setupSentinels(newptr, sz);
+    blockmap::getInstance().setBlock(o, sz + getOverhead());
 #endif
 
     assert(getSize(newptr) == sz);
@@ -57,6 +62,75 @@ public:
     return newptr;
   }
 
+  // Allocate an object whose start address is aligned to the boundary.
+  // We over-allocate by (boundary - Alignment) bytes and place the objectHeader
+  // right before the first aligned address. The leading and trailing slack is cut
+  // into free blocks that are returned in "spare", so that the caller can put them
+  // into the free lists instead of wasting them.
+  void* memalign(size_t boundary, size_t sz, void** spare, int* spareCount) {
+    size_t slack = boundary - SourceHeap::Alignment;
+    char* start = (char*)SourceHeap::malloc(sz + getOverhead() + slack);
+
+    *spareCount = 0;
+    if(!start) {
+      return NULL;
+    }
+
+    char* end = start + sz + getOverhead() + slack;
+    char* newptr = (char*)alignup((intptr_t)start + sizeof(objectHeader), boundary);
+
+    carveSpareBlocks(start, newptr - sizeof(objectHeader), spare, spareCount);
+
+    objectHeader* o = new (newptr - sizeof(objectHeader)) objectHeader(sz);
+    o->markObjectFresh();
+#if defined(DETECT_OVERFLOW) || defined(DETECT_MEMORY_LEAKS)
+    sentinelmap::getInstance().setupSentinels(newptr, sz);
+    blockmap::getInstance().setBlock(o, sz + getOverhead());
+#endif
+
+    carveSpareBlocks((char*)o + sz + getOverhead(), end, spare, spareCount);
+    return newptr;
+  }
+
+  // Grow an object in place when its block is the last one of the zone.
+  bool extend(void* ptr, size_t sz) {
+    objectHeader* o = getObject(ptr);
+    size_t oldsz = o->getSize();
+
+    if(!SourceHeap::extend((void*)o, oldsz + getOverhead(), sz + getOverhead())) {
+      return false;
+    }
+
+#if defined(DETECT_OVERFLOW) || defined(DETECT_MEMORY_LEAKS)
+    sentinelmap::getInstance().clearSentinelAt((void*)((intptr_t)ptr + oldsz));
+#endif
+    o->setSize(sz);
+#if defined(DETECT_OVERFLOW) || defined(DETECT_MEMORY_LEAKS)
+    sentinelmap::getInstance().setupSentinels(ptr, sz);
+    blockmap::getInstance().setBlock(o, sz + getOverhead());
+#endif
+    return true;
+  }
+
+  // Shrink the block of an object to sz bytes. The tail is cut into free
+  // blocks that are returned in "spare".
+  void shrink(void* ptr, size_t sz, void** spare, int* spareCount) {
+    objectHeader* o = getObject(ptr);
+    size_t oldsz = o->getSize();
+
+    *spareCount = 0;
+#if defined(DETECT_OVERFLOW) || defined(DETECT_MEMORY_LEAKS)
+    sentinelmap::getInstance().clearSentinelAt((void*)((intptr_t)ptr + oldsz));
+#endif
+    o->setSize(sz);
+#if defined(DETECT_OVERFLOW) || defined(DETECT_MEMORY_LEAKS)
+    sentinelmap::getInstance().setupSentinels(ptr, sz);
+#endif
+
+    carveSpareBlocks((char*)o + sz + getOverhead(), (char*)o + oldsz + getOverhead(), spare,
+                     spareCount, false);
+  }
+
   void free(void* ptr) { SourceHeap::free((void*)getObject(ptr)); }
 
   size_t getSize(void* ptr) {
@@ -70,6 +144,39 @@ public:
   }
 
 private:
+  // Bytes used by a block besides the object itself.
+  static size_t getOverhead() {
+#if defined(DETECT_OVERFLOW) || defined(DETECT_MEMORY_LEAKS)
+    return sizeof(objectHeader) + 2 * xdefines::SENTINEL_SIZE;
+#else
+    return sizeof(objectHeader);
+#endif
+  }
+
+  // Cut [start, end) into blocks of power-of-two sizes, largest first.
+  // Remaining bytes that are too small to hold a block are left untouched.
+  void carveSpareBlocks(char* start, char* end, void** spare, int* spareCount,
+                        bool isFresh = true) {
+    while((size_t)(end - start) >= getOverhead() + xdefines::OBJECT_SIZE_BASE) {
+      size_t sz = xdefines::OBJECT_SIZE_BASE;
+      while(2 * sz + getOverhead() <= (size_t)(end - start)) {
+        sz *= 2;
+      }
+
+      objectHeader* o = new (start) objectHeader(sz);
+      if(isFresh) {
+        o->markObjectFresh();
+      }
+      void* ptr = getPointer(o);
+#if defined(DETECT_OVERFLOW) || defined(DETECT_MEMORY_LEAKS)
+      sentinelmap::getInstance().setupSentinels(ptr, sz);
+      blockmap::getInstance().setBlock(o, sz + getOverhead());
+#endif
+      spare[(*spareCount)++] = ptr;
+      start += sz + getOverhead();
+    }
+  }
+
   static objectHeader* getObject(void* ptr) {
     objectHeader* o = (objectHeader*)ptr;
     return (o - 1);
@@ -93,7 +200,84 @@ private:
 public:
   KingsleyStyleHeap() {}
 
+  // Aligned objects are taken from the free list of their size class when a
+  // recently freed block there is aligned already. Otherwise they are carved out
+  // of fresh memory of the zone, and the spare blocks around the aligned object
+  // go to the free lists of this heap.
+  void* memalign(size_t boundary, size_t sz) {
+    void* spare[2 * sizeof(size_t) * 8];
+    int spareCount;
+    int sc = Kingsley::size2Class(sz);
+
+    sz = Kingsley::class2Size(sc);
+    void* ptr = getAlignedBlock(sc, boundary);
+    if(ptr != NULL) {
+      return ptr;
+    }
+
+    ptr = SuperHeap::bigheap.memalign(boundary, sz, spare, &spareCount);
+
+    for(int i = 0; i < spareCount; i++) {
+      SuperHeap::free(spare[i]);
+    }
+    return ptr;
+  }
+
+  // Resize an object without moving it. Blocks are kept at power-of-two
+  // sizes: a block grows only if it is the last one of the zone, and a large
+  // block shrinks if the new size is much smaller.
+  bool resize(void* ptr, size_t sz) {
+    size_t blockSize = SuperHeap::getSize(ptr);
+    size_t newSize = Kingsley::class2Size(Kingsley::size2Class(sz));
+
+    if(newSize > blockSize) {
+      return SuperHeap::bigheap.extend(ptr, newSize);
+    }
+
+    if(blockSize >= xdefines::REALLOC_SHRINK_SIZE && newSize * 4 <= blockSize) {
+      void* spare[sizeof(size_t) * 8];
+      int spareCount;
+
+      SuperHeap::bigheap.shrink(ptr, newSize, spare, &spareCount);
+      for(int i = 0; i < spareCount; i++) {
+        SuperHeap::free(spare[i]);
+      }
+    }
+    return true;
+  }
+
 private:
+  // Look at the first MEMALIGN_SEARCH_BLOCKS blocks of a free list, and put back
+  // the ones that are not aligned in the same order.
+  void* getAlignedBlock(int sc, size_t boundary) {
+    void* blocks[xdefines::MEMALIGN_SEARCH_BLOCKS];
+    size_t sz = Kingsley::class2Size(sc);
+    void* ptr = NULL;
+    int count = 0;
+
+    if(sz > SuperHeap::_maxObjectSize) {
+      return NULL;
+    }
+
+    while(count < xdefines::MEMALIGN_SEARCH_BLOCKS) {
+      void* block = SuperHeap::myLittleHeap[sc].malloc(sz);
+      if(block == NULL) {
+        break;
+      }
+
+      if(((uintptr_t)block & (boundary - 1)) == 0) {
+        ptr = block;
+        break;
+      }
+      blocks[count++] = block;
+    }
+
+    while(count > 0) {
+      SuperHeap::myLittleHeap[sc].free(blocks[--count]);
+    }
+    return ptr;
+  }
+
   // We want that a single heap's metadata are on different page
   // to avoid conflicts on one page
   //  char buf[4096 - (sizeof(SuperHeap) % 4096)];
@@ -114,6 +298,10 @@ public:
     return ptr;
   }
 
+  void* memalign(int ind, size_t boundary, size_t sz) { return _heap[ind].memalign(boundary, sz); }
+
+  bool resize(int ind, void* ptr, size_t sz) { return _heap[ind].resize(ptr, sz); }
+
   // Here, we will give one block of memory back to the originated process related heap.
   void free(int ind, void* ptr) {
     REQUIRE(ind < NumHeaps, "Invalid free status");
@@ -168,6 +356,7 @@ public:
     // _heapStart, xdefines::USER_HEAP_SIZE);
     // Initialize bitmap
     sentinelmap::getInstance().initialize(sentinelmapStart, sentinelmapSize);
+    blockmap::getInstance().initialize(sentinelmapStart, sentinelmapSize);
 #endif
 
     return (void*)_heapStart;
@@ -184,36 +373,99 @@ public:
     void* heapEnd = (void*)SourceHeap::getHeapPosition();
     // PRINF("recoverMemory, heapEnd %p\n", heapEnd);
     SourceHeap::recoverMemory(heapEnd);
+
+#if defined(DETECT_OVERFLOW)
+    sentinelmap::getInstance().recoverMemory(heapEnd);
+#endif
   }
 
   void backup() {
     void* heapEnd = (void*)SourceHeap::getHeapPosition();
-    return SourceHeap::backup(heapEnd);
+    SourceHeap::backup(heapEnd);
+
+#if defined(DETECT_OVERFLOW)
+    sentinelmap::getInstance().backup(heapEnd);
+#endif
   }
 
   void* getHeapEnd() { return (void*)SourceHeap::getHeapPosition(); }
 
   void* malloc(size_t size) {
     // printf("malloc in xpheap with size %d\n", size);
+    int sc = Kingsley::size2Class(size);
+
+    // Small objects are served from the magazine of current thread.
+    // We are reading "current" directly instead of calling getThreadIndex().
+    if(sc < xdefines::THREAD_CACHE_CLASSES && current != NULL) {
+      void* ptr = current->heapcache.get(sc);
+      if(ptr == NULL) {
+        ptr = refillThreadCache(sc);
+      }
+      return ptr;
+    }
+
     return _heap->malloc(getThreadIndex(), size);
   }
 
-  void free(void* ptr) {
-    int tid = getThreadIndex();
+  // Objects with an alignment larger than the default one only take aligned
+  // blocks from the magazines.
+  void* memalign(size_t boundary, size_t size) {
+    if(boundary <= xdefines::OBJECT_SIZE_BASE) {
+      return malloc(size);
+    }
 
+    // A freed aligned object is usually still in the magazine.
+    int sc = Kingsley::size2Class(size);
+    if(sc < xdefines::THREAD_CACHE_CLASSES && current != NULL) {
+      void* ptr = current->heapcache.getAligned(sc, boundary);
+      if(ptr != NULL) {
+        return ptr;
+      }
+    }
+    return _heap->memalign(getThreadIndex(), boundary, size);
+  }
+
+  // Only the zone of current thread can be extended.
+  bool resize(void* ptr, size_t size) { return _heap->resize(getThreadIndex(), ptr, size); }
+
+  void free(void* ptr) {
 #ifndef DETECT_USAGE_AFTER_FREE
-    _heap->free(tid, ptr);
+    realfree(ptr);
 #else
     size_t size = getSize(ptr);
     // Adding this to the quarantine list
     if(addThreadQuarantineList(ptr, size) == false) {
       // If an object is too large, we simply freed this object.
-      _heap->free(tid, ptr);
+      realfree(ptr);
     }
 #endif
   }
 
-  void realfree(void* ptr) { _heap->free(getThreadIndex(), ptr); }
+  void realfree(void* ptr) {
+    int sc = Kingsley::size2Class(getSize(ptr));
+
+    if(sc < xdefines::THREAD_CACHE_CLASSES && current != NULL) {
+      threadcache* cache = &current->heapcache;
+
+      // Give the oldest half of a full magazine back to the sub-heap.
+      if(cache->isFull(sc)) {
+        flushThreadCache(cache, current->index, sc, xdefines::THREAD_CACHE_SIZE / 2);
+      }
+      cache->put(sc, ptr);
+      return;
+    }
+
+    _heap->free(getThreadIndex(), ptr);
+  }
+
+  // Return all cached blocks of a thread to its sub-heap. This is called at the
+  // beginning of every epoch so that magazines are always empty at a checkpoint:
+  // after a rollback, the magazines can simply be reset.
+  void flushThreadCache(thread_t* thread) {
+    for(int sc = 0; sc < xdefines::THREAD_CACHE_CLASSES; sc++) {
+      flushThreadCache(&thread->heapcache, thread->index, sc, xdefines::THREAD_CACHE_SIZE);
+    }
+  }
 
   size_t getSize(void* ptr) { 
 		//fprintf(stderr, "xheap getSize ptr %p\n", ptr);
@@ -223,6 +475,41 @@ public:
   bool inRange(void* addr) { return ((addr >= _heapStart) && (addr <= _heapEnd)) ? true : false; }
 
 private:
+  // Get a batch of blocks from the sub-heap of current thread and return one of them.
+  void* refillThreadCache(int sc) {
+    void* blocks[xdefines::THREAD_CACHE_BATCH];
+    size_t size = Kingsley::class2Size(sc);
+    int ind = current->index;
+    int count = 0;
+
+    while(count < xdefines::THREAD_CACHE_BATCH) {
+      blocks[count] = _heap->malloc(ind, size);
+      if(blocks[count] == NULL) {
+        break;
+      }
+      count++;
+    }
+
+    if(count == 0) {
+      return NULL;
+    }
+
+    // Keep the first block we got (the most recently freed one) on the top.
+    for(int i = count - 1; i > 0; i--) {
+      current->heapcache.put(sc, blocks[i]);
+    }
+    return blocks[0];
+  }
+
+  void flushThreadCache(threadcache* cache, int ind, int sc, int count) {
+    void* blocks[xdefines::THREAD_CACHE_SIZE];
+
+    count = cache->drain(sc, blocks, count);
+    for(int i = 0; i < count; i++) {
+      _heap->free(ind, blocks[i]);
+    }
+  }
+
   SuperHeap* _heap;
   void* _heapStart;
   void* _heapEnd;
@@ -17,11 +17,14 @@
 
 #include <new>
 
+#include "callsitetable.hh"
 #include "globalinfo.hh"
 #include "internalheap.hh"
+#include "leaksnapshot.hh"
 #include "log.hh"
 #include "mm.hh"
 #include "real.hh"
+#include "unwinder.hh"
 #include "watchpoint.hh"
 #include "xdefines.hh"
 #include "xmemory.hh"
@@ -37,7 +40,7 @@ class xrun {
 private:
   xrun()
       : _memory(xmemory::getInstance()), _thread(xthread::getInstance()),
-        _watchpoint(watchpoint::getInstance())
+        _watchpoint(watchpoint::getInstance()), _reexecutions(0)
   {
     // PRINF("xrun constructor\n");
   }
@@ -88,26 +91,39 @@ public:
     // Initialize the internal heap at first.
     InternalHeap::getInstance().initialize();
 
+    // Load the fallback of the unwinder before any signal handler needs it.
+    unwinder::initialize();
+    callsitetable::getInstance().initialize();
+
     _thread.initialize();
 
     // Initialize the memory (install the memory handler)
     _memory.initialize();
 
     syscallsInitialize();
+
+#if defined(DETECT_USAGE_AFTER_FREE_BACKGROUND)
+    uafverifier::getInstance().initialize();
+#endif
+
+#if defined(DETECT_MEMORY_LEAKS)
+    leaksnapshot::getInstance().initialize();
+#endif
   }
 
   void finalize() {
 #ifdef GET_CHARECTERISTICS
 			fprintf(stderr, "DOUBLETAKE has epochs %ld\n", count_epochs);
 #endif
-    // If we are not in rollback phase, then we should check buffer overflow.
-    if(!global_isRollback()) {
 #ifdef DETECT_USAGE_AFTER_FREE
+    // If we are not in rollback phase, then we should check use-after-free errors.
+    if(!global_isRollback()) {
       finalUAFCheck();
+    }
 #endif
 
-      epochEnd(true);
-    }
+    // In the re-execution, it may be repeated from here.
+    epochEnd(true);
 
     //    PRINF("%d: finalize now !!!!!\n", getpid());
     // Now we have to cleanup all semaphores.
@@ -136,6 +152,9 @@ public:
   char *getCurrentThreadBuffer() { return _thread.getCurrentThreadBuffer(); }
 
 private:
+#ifdef DETECT_USAGE_AFTER_FREE
+  void trimQuarantines();
+#endif
   void syscallsInitialize();
   void stopAllThreads();
 
@@ -179,6 +198,9 @@ private:
   // Notify the system call handler about rollback phase
   void startRollback();
 
+  // The re-execution reaches the end of the epoch.
+  void endRollback();
+
   /*  volatile bool _hasRolledBack; */
 
   /// The memory manager (for both heap and globals).
@@ -186,6 +208,9 @@ private:
   xthread& _thread;
   watchpoint& _watchpoint;
 
+  // Re-executions of the current epoch.
+  int _reexecutions;
+
 
   //  int   _rollbackStatus;
   /*  int _pid; // The first process's id. */
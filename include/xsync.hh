@@ -20,6 +20,7 @@
 #include "mm.hh"
 #include "recordentries.hh"
 #include "semaphore.hh"
+#include "slab.hh"
 #include "spinlock.hh"
 #include "synceventlist.hh"
 #include "threadstruct.hh"
@@ -134,8 +135,7 @@ public:
 
   struct SyncEntry * recordSyncVar(syncVariableType type, void* nominal, void* real, SyncEventList* list) {
 		// Alloc a synchronization variable entry.
-    struct SyncEntry* entry =
-        (struct SyncEntry*)InternalHeap::getInstance().malloc(sizeof(struct SyncEntry));
+    struct SyncEntry* entry = slab<struct SyncEntry>::getInstance().alloc();
 		entry->type = type;
     entry->real = real;
     entry->nominal = nominal;
@@ -155,7 +155,7 @@ public:
   }
 
 	void freeSyncEntry(struct SyncEntry * entry) {
-		InternalHeap::getInstance().free((void *)entry);
+		slab<struct SyncEntry>::getInstance().free(entry);
 	}
 
 	void deferSync(struct SyncEntry *entry) {
@@ -164,6 +164,11 @@ public:
 		unlock();
 	}
 
+	// Whether some synchronization variables are destroyed in this epoch.
+	bool hasDeferredSyncs() {
+		return !isListEmpty(&_delList);
+	}
+
 	struct SyncEntry * getSyncEntryDellist(list_t * listentry) {
 		return (struct SyncEntry *)((intptr_t)listentry - sizeof(list_t) - sizeof(list_t));
 	}
@@ -33,6 +33,7 @@
 #include "threadinfo.hh"
 #include "threadmap.hh"
 #include "threadstruct.hh"
+#include "watchpoint.hh"
 #include "xcontext.hh"
 #include "xdefines.hh"
 #include "xsync.hh"
@@ -84,6 +85,9 @@ public:
   int getThreadIndex() const;
   char *getCurrentThreadBuffer();
 
+  // The thread structure at an index, in use or not.
+  thread_t* getThreadByIndex(int index) { return getThreadInfo(index); }
+
   // After an epoch is end and there is no overflow,
   // we should discard those record events since there is no
   // need to rollback anymore
@@ -114,6 +118,9 @@ public:
     current->joiner = NULL;
     current->index = tindex;
     current->parent = NULL;
+    current->stopContext = NULL;
+    current->watchedPage = NULL;
+    current->numWatchFds = 0;
 
     insertAliveThread(current, pthread_self());
 
@@ -177,6 +184,9 @@ public:
       // It is impossible to let newly spawned child to set this correctly since
       // the parent may already sleep on that.
       children->joiner = NULL;
+      children->stopContext = NULL;
+      children->watchedPage = NULL;
+      children->numWatchFds = 0;
 
       PRINF("thread creation with index %d\n", tindex);
       // Now we are going to record this spawning event.
@@ -249,12 +259,23 @@ public:
   }
 
 	inline void markThreadJoining(thread_t * thread) {
+		saveBlockedContext();
+
 		lock_thread(current);
 		current->status = E_THREAD_JOINING;
 		current->condwait = &thread->cond;
 		unlock_thread(current);
 	}
 
+	// Save the registers before waiting, since this thread is not stopped
+	// by a signal when an epoch ends. Only the leak checker needs them.
+	inline void saveBlockedContext() {
+#if defined(DETECT_MEMORY_LEAKS)
+		getcontext(&current->blockedContext);
+		current->stopContext = &current->blockedContext;
+#endif
+	}
+
 	inline void unmarkThreadJoining() {
 		checkRollback(NULL);
 	}
@@ -520,6 +541,8 @@ public:
 
 	// Mark whether 
 	void markThreadCondwait(pthread_cond_t * cond) {
+		saveBlockedContext();
+
 		lock_thread(current);
 		assert(current->status == E_THREAD_RUNNING);
 		current->status = E_THREAD_COND_WAITING;
@@ -547,6 +570,7 @@ public:
 		lock_thread(current);
 		// Cleanup this thread
 		current->condwait = NULL;
+		current->stopContext = NULL;
 		
 		if(current->status == E_THREAD_ROLLBACK) {
       PRINF("THREAD%d (status %d) is wakenup after cond_wait, plan to rollback\n", current->index, current->status);
@@ -844,6 +868,9 @@ public:
 
   // Preparing the rollback.
   void prepareRollback();
+  // Run the epoch again in the normal execution, after its re-executions.
+  bool canRunAgain();
+  void prepareRunAgain();
 	void prepareRollbackAlivethreads();
 	void destroyAllSemaphores();
 	void initThreadSemaphore(thread_t* thread);
@@ -860,6 +887,7 @@ public:
 	// Thus, it will replace the current context (of signal handler)
 	// with the old context.
   void rollbackInsideSignalHandler(ucontext* uctx) {
+    watchpoint::getInstance().installThreadWatchpoints();
     current->context.rollbackInHandler(uctx);
   }
 
@@ -23,18 +23,386 @@
 
 #include "leakcheck.hh"
 
+#include <signal.h>
+#include <unistd.h>
+
+#include "log.hh"
+#include "real.hh"
+#include "threadmap.hh"
+#include "threadstruct.hh"
 #include "xmemory.hh"
 
-void leakcheck::searchHeapPointersInsideGlobals() {
-  int totalRegions;
+#if defined(X86_32BIT)
+#define STACK_RED_ZONE 0
+#else
+// Leaf functions may keep data below the stack pointer.
+#define STACK_RED_ZONE 128
+#endif
+
+void* leakcheck::markerThread(void* arg) {
+  sigset_t mask;
+
+  // This thread is not managed by DoubleTake. Any signal should go to the
+  // application threads instead.
+  sigfillset(&mask);
+  Real::sigprocmask(SIG_BLOCK, &mask, NULL);
+
+  int id = (int)(intptr_t)arg;
+  leakcheck& checker = leakcheck::getInstance();
+  unsigned long generation = 0;
+
+  while(true) {
+    Real::pthread_mutex_lock(&checker._mutex);
+    while(checker._generation == generation) {
+      Real::pthread_cond_wait(&checker._startCond, &checker._mutex);
+    }
+    generation = checker._generation;
+    Real::pthread_mutex_unlock(&checker._mutex);
+
+    if(checker._keepMarks && !checker._isIncremental) {
+      checker.cleanMarks(id);
+    }
+    checker.markObjects(id);
+    checker.collectUnreachableObjects(id);
+
+    Real::pthread_mutex_lock(&checker._mutex);
+    checker._finishedHelpers++;
+    Real::pthread_cond_signal(&checker._doneCond);
+    Real::pthread_mutex_unlock(&checker._mutex);
+  }
+
+  return NULL;
+}
+
+void leakcheck::initializeWorkers() {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  _numWorkers = xdefines::LEAK_MARK_THREADS;
+  if(cpus < _numWorkers) {
+    _numWorkers = (cpus > 1) ? (int)cpus : 1;
+  }
 
-  totalRegions = xmemory::getInstance().getGlobalRegionsNumb();
-  unsigned long begin, end;
+  for(int i = 0; i < _numWorkers; i++) {
+    _deques[i].initialize();
+  }
+
+  Real::pthread_mutex_init(&_mutex, NULL);
+  Real::pthread_cond_init(&_startCond, NULL);
+  Real::pthread_cond_init(&_doneCond, NULL);
+
+  // Whatever pthread_create allocates should not be in the user heap.
+  bool isInternal = current->internalheap;
+  current->internalheap = true;
+
+  for(int i = 1; i < _numWorkers; i++) {
+    pthread_t thread;
+
+    if(Real::pthread_create(&thread, NULL, leakcheck::markerThread, (void*)(intptr_t)i) != 0) {
+      PRWRN("DoubleTake: Failed to start leak checking thread %d.\n", i);
+      _numWorkers = i;
+      break;
+    }
+  }
+
+  current->internalheap = isInternal;
+  PRINF("Leak checking with %d threads\n", _numWorkers);
+
+  dirtypages::getInstance().initialize(xdefines::USER_HEAP_SIZE);
+
+  // Marks are only valid after a full check.
+  _incrementalChecks = xdefines::LEAK_FULL_CHECK_EPOCHS;
+}
+
+void leakcheck::prepareMarking(ucontext_t* context, bool isFullCheck) {
+  if(_numWorkers == 0) {
+    initializeWorkers();
+  }
+
+  dirtypages& pages = dirtypages::getInstance();
+
+  _keepMarks = pages.isAvailable();
+  _isIncremental = !isFullCheck && pages.isAvailable() &&
+                   _incrementalChecks < xdefines::LEAK_FULL_CHECK_EPOCHS;
+  if(_isIncremental && !pages.collect(_heapBegin, _heapEnd)) {
+    _isIncremental = false;
+  }
+
+  if(_isIncremental) {
+    _incrementalChecks++;
+  } else {
+    _incrementalChecks = 0;
+    // Clean the soft-dirty bits before the marks are cleaned, so that the next
+    // check sees all pages written after that.
+    if(pages.isAvailable()) {
+      pages.clear();
+    }
+  }
+
+  for(int i = 0; i < _numWorkers; i++) {
+    _deques[i].reset();
+  }
+
+  _totalRegions = 0;
+  _totalRootChunks = 0;
+
+  searchHeapPointersInsideThreads(context);
+
+  int globals = xmemory::getInstance().getGlobalRegionsNumb();
+  for(int i = 0; i < globals; i++) {
+    unsigned long begin, end;
 
-  for(int i = 0; i < totalRegions; i++) {
     xmemory::getInstance().getGlobalRegion(i, &begin, &end);
-    if(begin != 0) {
-      searchHeapPointers(begin, end);
+    addRootRegion(begin, end);
+  }
+
+  _nextRootChunk = 0;
+  _idleWorkers = 0;
+
+  _totalHeapChunks = (_heapEnd - _heapBegin + xdefines::LEAK_HEAP_CHUNK_SIZE - 1) /
+                     xdefines::LEAK_HEAP_CHUNK_SIZE;
+  _nextHeapChunk = 0;
+  _nextCleanChunk = 0;
+  _cleanedWorkers = 0;
+  _nextDirtyRoot = 0;
+  _nextDirtyCheck = 0;
+}
+
+void leakcheck::addRootRegion(unsigned long begin, unsigned long end) {
+  if(begin >= end) {
+    return;
+  }
+
+  REQUIRE(_totalRegions < xdefines::NUM_GLOBALS + xdefines::MAX_ALIVE_THREADS,
+          "Too many root regions for the leak check");
+
+  rootRegion* region = &_regions[_totalRegions++];
+
+  region->begin = begin;
+  region->end = end;
+  region->firstChunk = _totalRootChunks;
+  region->chunks =
+      (end - begin + xdefines::LEAK_ROOT_CHUNK_SIZE - 1) / xdefines::LEAK_ROOT_CHUNK_SIZE;
+  _totalRootChunks += region->chunks;
+}
+
+void leakcheck::searchHeapPointersInsideThreads(ucontext_t* context) {
+  // Current thread is the first marking thread.
+  searchHeapPointers(context, 0);
+  addRootRegion((unsigned long)context, (unsigned long)current->stackTop);
+
+  threadmap::aliveThreadIterator i;
+  for(i = threadmap::getInstance().begin(); i != threadmap::getInstance().end(); i++) {
+    thread_t* thread = i.getThread();
+
+    if(thread == current) {
+      continue;
+    }
+
+    // The result of a finished thread is only kept by DoubleTake until it is joined.
+    if(thread->status == E_THREAD_WAITFOR_REAPING) {
+      checkInsertUnexploredList((unsigned long)thread->result, 0);
+    }
+
+    // Other threads are stopped by a signal, or they are waiting inside DoubleTake.
+    ucontext_t* stopped = thread->stopContext;
+    if(stopped == NULL) {
+      continue;
+    }
+
+    searchHeapPointers(stopped, 0);
+
+    unsigned long sp = stopped->uc_mcontext.gregs[REG_SP] - STACK_RED_ZONE;
+    addRootRegion(aligndown(sp, sizeof(void*)), (unsigned long)thread->stackTop);
+  }
+}
+
+void leakcheck::checkInParallel() {
+  Real::pthread_mutex_lock(&_mutex);
+  _finishedHelpers = 0;
+  _generation++;
+  Real::pthread_cond_broadcast(&_startCond);
+  Real::pthread_mutex_unlock(&_mutex);
+
+  if(_keepMarks && !_isIncremental) {
+    cleanMarks(0);
+  }
+  markObjects(0);
+  collectUnreachableObjects(0);
+
+  Real::pthread_mutex_lock(&_mutex);
+  while(_finishedHelpers != _numWorkers - 1) {
+    Real::pthread_cond_wait(&_doneCond, &_mutex);
+  }
+  Real::pthread_mutex_unlock(&_mutex);
+}
+
+void leakcheck::markObjects(int id) {
+  unsigned long addr;
+
+  searchHeapPointersInsideRoots(id);
+  if(_isIncremental) {
+    searchHeapPointersInsideDirtyPages(id);
+  }
+
+  while(true) {
+    if(_deques[id].pop(&addr) || _overflows[id].pop(&addr) || stealObject(id, &addr)) {
+      exploreHeapObject(addr, id);
+    } else if(!waitForObjects()) {
+      break;
+    }
+  }
+}
+
+void leakcheck::searchHeapPointersInsideRoots(int id) {
+  int index = 0;
+
+  while(true) {
+    unsigned long chunk = __atomic_fetch_add(&_nextRootChunk, 1, __ATOMIC_RELAXED);
+    if(chunk >= _totalRootChunks) {
+      break;
+    }
+
+    // Chunks are claimed in increasing order.
+    while(chunk >= _regions[index].firstChunk + _regions[index].chunks) {
+      index++;
+    }
+
+    rootRegion* region = &_regions[index];
+    unsigned long begin =
+        region->begin + (chunk - region->firstChunk) * xdefines::LEAK_ROOT_CHUNK_SIZE;
+    unsigned long end = begin + xdefines::LEAK_ROOT_CHUNK_SIZE;
+
+    if(end > region->end) {
+      end = region->end;
+    }
+    searchHeapPointers(begin, end, id);
+  }
+}
+
+void leakcheck::cleanMarks(int id) {
+  while(true) {
+    unsigned long chunk = __atomic_fetch_add(&_nextCleanChunk, 1, __ATOMIC_RELAXED);
+    if(chunk >= _totalHeapChunks) {
+      break;
+    }
+
+    unsigned long cursor = _heapBegin + chunk * xdefines::LEAK_HEAP_CHUNK_SIZE;
+    unsigned long end = cursor + xdefines::LEAK_HEAP_CHUNK_SIZE;
+
+    if(end > _heapEnd) {
+      end = _heapEnd;
+    }
+
+    objectHeader* object;
+    while((object = blockmap::getInstance().findNextBlock(&cursor, end)) != NULL) {
+      if(object->isObjectChecked()) {
+        object->cleanObjectChecked();
+      }
+    }
+  }
+
+  // No thread may mark an object before all marks are cleaned.
+  __atomic_add_fetch(&_cleanedWorkers, 1, __ATOMIC_SEQ_CST);
+  while(__atomic_load_n(&_cleanedWorkers, __ATOMIC_SEQ_CST) != _numWorkers) {
+    Real::sched_yield();
+  }
+}
+
+void leakcheck::searchHeapPointersInsideDirtyPages(int id) {
+  dirtypages& pages = dirtypages::getInstance();
+  unsigned long count = pages.getCount();
+
+  while(true) {
+    unsigned long first = __atomic_fetch_add(&_nextDirtyRoot, LEAK_DIRTY_PAGES, __ATOMIC_RELAXED);
+    if(first >= count) {
+      break;
+    }
+
+    unsigned long last = (first + LEAK_DIRTY_PAGES < count) ? first + LEAK_DIRTY_PAGES : count;
+    for(unsigned long i = first; i < last; i++) {
+      unsigned long page = pages.getPage(i);
+      unsigned long pageEnd = page + xdefines::PageSize;
+      unsigned long cursor = page;
+      unsigned long objectStart;
+
+      // The object covering the start of this page, and the objects starting inside.
+      objectHeader* object = NULL;
+      if(blockmap::getInstance().findObjectStart((void*)page, &objectStart)) {
+        object = getObject((void*)objectStart);
+      } else {
+        object = blockmap::getInstance().findNextBlock(&cursor, pageEnd);
+      }
+
+      while(object != NULL) {
+        // Only marked objects are known to be reachable. Others are scanned if
+        // they are reached.
+        if(!object->isObjectFree() && object->isObjectChecked()) {
+          unsigned long begin = (unsigned long)object->getStartPtr();
+          unsigned long end = begin + object->getObjectSize();
+
+          begin = (begin > page) ? begin : page;
+          end = (end < pageEnd) ? end : pageEnd;
+          if(begin < end) {
+            searchHeapPointers(begin, end, id);
+          }
+        }
+
+        cursor = (unsigned long)object->getStartPtr();
+        object = blockmap::getInstance().findNextBlock(&cursor, pageEnd);
+      }
+    }
+  }
+}
+
+void leakcheck::collectUnreachableObjects(int id) {
+  // Once a thread leaves markObjects(), all threads are idle and all reachable
+  // objects are marked.
+  if(_isIncremental) {
+    collectUnreachableObjectsInsideDirtyPages(id);
+    return;
+  }
+
+  while(true) {
+    unsigned long chunk = __atomic_fetch_add(&_nextHeapChunk, 1, __ATOMIC_RELAXED);
+    if(chunk >= _totalHeapChunks) {
+      break;
+    }
+
+    // Only the blocks starting in this piece belong to it.
+    unsigned long cursor = _heapBegin + chunk * xdefines::LEAK_HEAP_CHUNK_SIZE;
+    unsigned long end = cursor + xdefines::LEAK_HEAP_CHUNK_SIZE;
+
+    if(end > _heapEnd) {
+      end = _heapEnd;
+    }
+
+    objectHeader* object;
+    while((object = blockmap::getInstance().findNextBlock(&cursor, end)) != NULL) {
+      collectUnreachableObject(object, id);
+    }
+  }
+}
+
+void leakcheck::collectUnreachableObjectsInsideDirtyPages(int id) {
+  dirtypages& pages = dirtypages::getInstance();
+  unsigned long count = pages.getCount();
+
+  while(true) {
+    unsigned long first = __atomic_fetch_add(&_nextDirtyCheck, LEAK_DIRTY_PAGES, __ATOMIC_RELAXED);
+    if(first >= count) {
+      break;
+    }
+
+    unsigned long last = (first + LEAK_DIRTY_PAGES < count) ? first + LEAK_DIRTY_PAGES : count;
+    for(unsigned long i = first; i < last; i++) {
+      // Only the blocks starting in this page belong to it.
+      unsigned long cursor = pages.getPage(i);
+      unsigned long end = cursor + xdefines::PageSize;
+
+      objectHeader* object;
+      while((object = blockmap::getInstance().findNextBlock(&cursor, end)) != NULL) {
+        collectUnreachableObject(object, id);
+      }
     }
   }
 }
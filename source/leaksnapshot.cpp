@@ -0,0 +1,207 @@
+/*
+ * @file   leaksnapshot.cpp
+ * @brief  Leak snapshots for programs that never exit.
+ * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
+ */
+
+#include "leaksnapshot.hh"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.hh"
+#include "mm.hh"
+#include "real.hh"
+#include "selfmap.hh"
+#include "sitemap.hh"
+
+void leaksnapshot::initialize() {
+  const char* value = getenv("DOUBLETAKE_LEAK_SNAPSHOT_SIGNAL");
+
+  if(value != NULL) {
+    struct sigaction sa;
+    int sig = atoi(value);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = leaksnapshot::signalHandler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+
+    if(sig <= 0 || Real::sigaction(sig, &sa, NULL) != 0) {
+      PRWRN("DoubleTake: Invalid signal %s for leak snapshots.\n", value);
+    }
+  }
+
+  value = getenv("DOUBLETAKE_LEAK_SNAPSHOT_FILE");
+  if(value != NULL) {
+    if(strlen(value) < sizeof(_controlFile)) {
+      strcpy(_controlFile, value);
+      _hasControlFile = true;
+    } else {
+      PRWRN("DoubleTake: The control file of leak snapshots is too long.\n");
+    }
+  }
+}
+
+void leaksnapshot::signalHandler(int /* sig */) { leaksnapshot::getInstance().request(); }
+
+bool leaksnapshot::isRequested() {
+  // The file is removed, so that one file asks for one snapshot.
+  if(_hasControlFile && Real::access(_controlFile, F_OK) == 0) {
+    Real::unlink(_controlFile);
+    request();
+  }
+
+  return __atomic_exchange_n(&_isRequested, false, __ATOMIC_RELAXED);
+}
+
+void leaksnapshot::begin() {
+  size_t tableSize = xdefines::LEAK_SNAPSHOT_GROUPS * sizeof(leakGroup);
+
+  if(_groups == NULL) {
+    _groups = (leakGroup*)MM::mmapAllocatePrivate(tableSize);
+    _spareGroups = (leakGroup*)MM::mmapAllocatePrivate(tableSize);
+    REQUIRE(_groups != NULL && _spareGroups != NULL,
+            "Failed to allocate the groups of leak snapshots");
+  }
+
+  _snapshots++;
+  _lastObjects = _objects;
+  _lastBytes = _bytes;
+  _objects = 0;
+  _bytes = 0;
+
+  // Move the groups of the last snapshot to the other table. Groups without
+  // objects in the last snapshot are dropped.
+  leakGroup* groups = _groups;
+
+  _groups = _spareGroups;
+  _spareGroups = groups;
+  _totalGroups = 0;
+  memset(_groups, 0, tableSize);
+
+  for(int i = 0; i < xdefines::LEAK_SNAPSHOT_GROUPS; i++) {
+    if(groups[i].key == 0 || groups[i].objects == 0) {
+      continue;
+    }
+
+    leakGroup* group = findGroup(groups[i].key);
+    if(group != NULL) {
+      group->lastObjects = groups[i].objects;
+      group->lastBytes = groups[i].bytes;
+    }
+  }
+}
+
+leaksnapshot::leakGroup* leaksnapshot::findGroup(size_t key) {
+  unsigned long mask = xdefines::LEAK_SNAPSHOT_GROUPS - 1;
+  unsigned long index = (key * 2654435761UL) >> 4;
+
+  for(int i = 0; i < xdefines::LEAK_SNAPSHOT_GROUPS; i++) {
+    leakGroup* group = &_groups[(index + i) & mask];
+
+    if(group->key == key) {
+      return group;
+    }
+
+    if(group->key == 0) {
+      // Keep the table sparse.
+      if(_totalGroups >= xdefines::LEAK_SNAPSHOT_GROUPS / 4 * 3) {
+        return NULL;
+      }
+
+      group->key = key;
+      group->objects = 0;
+      group->bytes = 0;
+      group->lastObjects = 0;
+      group->lastBytes = 0;
+      _totalGroups++;
+      return group;
+    }
+  }
+
+  return NULL;
+}
+
+void leaksnapshot::addObject(void* ptr, size_t size, size_t /* blockSize */) {
+  _objects++;
+  _bytes += size;
+
+#if defined(DETECT_ALLOCATION_SITES)
+  size_t key = sitemap::getInstance().getSite(ptr);
+  if(key == callsitetable::NO_CALLSITE) {
+    key = UNKNOWN_SITE;
+  }
+#else
+  size_t key = size;
+#endif
+
+  leakGroup* group = findGroup(key);
+  if(group != NULL) {
+    group->objects++;
+    group->bytes += size;
+  }
+}
+
+void leaksnapshot::report() {
+  PRINT("DoubleTake: Leak snapshot %d: %zu unreachable objects, %zu bytes.\n", _snapshots, _objects,
+        _bytes);
+  if(_snapshots > 1) {
+    PRINT("DoubleTake: Since the last snapshot: %+ld objects, %+ld bytes.\n",
+          (long)(_objects - _lastObjects), (long)(_bytes - _lastBytes));
+  }
+
+  // Print the largest groups, in the order of their bytes and then their places.
+  size_t printedBytes = (size_t)-1;
+  int printedIndex = -1;
+
+  for(int k = 0; k < xdefines::LEAK_SNAPSHOT_REPORT; k++) {
+    int best = -1;
+
+    for(int i = 0; i < xdefines::LEAK_SNAPSHOT_GROUPS; i++) {
+      leakGroup* group = &_groups[i];
+
+      if(group->key == 0 || group->objects == 0) {
+        continue;
+      }
+      if(group->bytes > printedBytes || (group->bytes == printedBytes && i <= printedIndex)) {
+        continue;
+      }
+      if(best == -1 || group->bytes > _groups[best].bytes) {
+        best = i;
+      }
+    }
+
+    if(best == -1) {
+      break;
+    }
+
+    leakGroup* group = &_groups[best];
+#if defined(DETECT_ALLOCATION_SITES)
+    const char* site = (group->key == UNKNOWN_SITE) ? "at unknown sites" : "allocated at";
+    if(_snapshots > 1) {
+      PRINT("  objects %s: %zu objects, %zu bytes (%+ld bytes)\n", site, group->objects,
+            group->bytes, (long)(group->bytes - group->lastBytes));
+    } else {
+      PRINT("  objects %s: %zu objects, %zu bytes\n", site, group->objects, group->bytes);
+    }
+    if(group->key != UNKNOWN_SITE) {
+      selfmap::getInstance().printCallStack(callsitetable::getInstance().getDepth(group->key),
+                                            callsitetable::getInstance().getFrames(group->key));
+    }
+#else
+    if(_snapshots > 1) {
+      PRINT("  objects of %zu bytes: %zu objects, %zu bytes (%+ld bytes)\n", group->key,
+            group->objects, group->bytes, (long)(group->bytes - group->lastBytes));
+    } else {
+      PRINT("  objects of %zu bytes: %zu objects, %zu bytes\n", group->key, group->objects,
+            group->bytes);
+    }
+#endif
+
+    printedBytes = group->bytes;
+    printedIndex = best;
+  }
+}
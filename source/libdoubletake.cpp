@@ -7,6 +7,7 @@
  */
 
 #include <dlfcn.h>
+#include <errno.h>
 #include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -18,6 +19,7 @@
 #include <string>
 
 #include "globalinfo.hh"
+#include "leaksnapshot.hh"
 #include "real.hh"
 #include "syscalls.hh"
 #include "xmemory.hh"
@@ -182,6 +184,25 @@ extern "C" {
     return ptr;
   }
 
+  void* xxcalloc(size_t nmemb, size_t sz) {
+    void* ptr = NULL;
+
+    if(!initialized) {
+      // Check the multiplication overflow.
+      if(sz != 0 && (nmemb * sz) / sz != nmemb) {
+        return NULL;
+      }
+      // Memory of tempmalloc is never reused, thus it is always zero.
+      return xxmalloc(nmemb * sz);
+    }
+
+    ptr = xmemory::getInstance().calloc(nmemb, sz);
+    if(ptr == NULL) {
+      errno = ENOMEM;
+    }
+    return ptr;
+  }
+
   void xxfree(void* ptr) {
     if(initialized && ptr) {
       xmemory::getInstance().free(ptr);
@@ -195,6 +216,22 @@ extern "C" {
     return 0;
   }
 
+  void* xxmemalign(size_t boundary, size_t sz) {
+    void* ptr = NULL;
+
+    if(!initialized) {
+      ptr = tempmalloc(sz + boundary);
+      ptr = (void*)alignup((intptr_t)ptr, boundary);
+    } else {
+      ptr = xmemory::getInstance().memalign(boundary, sz);
+    }
+    if(ptr == NULL) {
+    	fprintf(stderr, "Out of memory with initialized %d!\n", initialized);
+      ::abort();
+    }
+    return ptr;
+  }
+
 	void * xxrealloc(void * ptr, size_t sz) {
     if(initialized) {
       return xmemory::getInstance().realloc(ptr, sz);
@@ -206,6 +243,17 @@ extern "C" {
 	}
 }
 
+// Report the unreachable objects now, without waiting for the end of the program.
+extern "C" void dt_leak_snapshot() {
+#if defined(DETECT_MEMORY_LEAKS)
+  // A re-execution replays to the failure, and does not take snapshots again.
+  if(initialized && !global_isRollback()) {
+    leaksnapshot::getInstance().request();
+    xthread::invokeCommit();
+  }
+#endif
+}
+
 // Thread functions
 extern "C" {
 
@@ -532,7 +580,15 @@ extern "C" {
     abort();
   }
 
-	// We don't care about fread and fwrite since they won't call sockets.
+	// We don't care about fwrite since it won't call sockets. The reads of fread are
+	// not seen by read() though, and they may write into watched pages.
+  size_t fread(void* ptr, size_t size, size_t nmemb, FILE* stream) {
+    if(!initialized) {
+      return Real::fread(ptr, size, nmemb, stream);
+    }
+    return syscalls::getInstance().fread(ptr, size, nmemb, stream);
+  }
+
   int fclose(FILE* fp) {
     if(!initialized) {
       return Real::fclose(fp);
@@ -1,10 +1,10 @@
-#include <execinfo.h>
-
 #include "memtrack.hh"
+#include "quarantinebudget.hh"
 #include "xthread.hh"
 
 #include "selfmap.hh"
 #include "sentinelmap.hh"
+#include "unwinder.hh"
 
 // Check whether an object should be reported or not. Type is to identify whether it is
 // a malloc or free operation.
@@ -29,17 +29,15 @@ void memtrack::check(void* start, size_t size, memTrackType type) {
        (object->hasLeak() && (object->objectSize == size))) {
       // Now we check the type of this object.
       void* callsites[xdefines::CALLSITE_MAXIMUM_LENGTH];
-      xthread::disableCheck();
-      int depth = backtrace(callsites, xdefines::CALLSITE_MAXIMUM_LENGTH);
-      xthread::enableCheck();
+      int depth = unwinder::getCallStack(callsites, xdefines::CALLSITE_MAXIMUM_LENGTH);
       object->saveCallsite(size, type, depth, (void**)&callsites[0]);
-#ifndef EVALUATING_PERF
-			// Since printing can cause SPEC2006 benchmarks to fail, thus comment them for evaluating perf.
-      // Insert or print.
-      if(object->hasLeak()) {
-        PRINT("Leaked object: start address = %p, size = %zd.\nCurrent call stack:\n", object->start,
-              object->objectSize);
-        selfmap::getInstance().printCallStack(depth, (void**)&callsites[0]);
+
+#if !defined(DETECT_ALLOCATION_SITES)
+      // Leaked objects are reported by their allocation sites at the end of the
+      // re-execution. With stamped sites, they have been reported before it.
+      if(object->hasLeak() && type == MEM_TRACK_MALLOC) {
+        PRINF("Leaked object: start address = %p, size = %zd.\n", object->start, object->objectSize);
+        addLeak(object->allocSite.id(), object->objectSize);
       }
 #endif
     }
@@ -98,9 +96,67 @@ void memtrack::print(void* start, faultyObjectType type) {
 
     if(type == OBJECT_TYPE_USEAFTERFREE) {
       assert(object->isFreed() == true);
+      // Keep objects like this one longer in the quarantine.
+      quarantinebudget::getInstance().markHotObject(start, object->objectSize);
+
       PRINT("Memory deallocation call stack:\n");
       selfmap::getInstance().printCallStack(object->freeSite.depth(),
                                             object->freeSite.getCallsite());
     }
   }
 }
+
+void memtrack::addLeak(unsigned int site, size_t size) {
+  if(site != callsitetable::NO_CALLSITE) {
+    callsitetable::getInstance().addObject(site, size);
+  } else {
+    __atomic_add_fetch(&_unknownLeaks, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&_unknownLeakBytes, size, __ATOMIC_RELAXED);
+  }
+}
+
+void memtrack::reportLeaks() {
+#ifndef EVALUATING_PERF
+  // Since printing can cause SPEC2006 benchmarks to fail, thus comment them for evaluating perf.
+  callsitetable& sites = callsitetable::getInstance();
+  size_t printedBytes = (size_t)-1;
+  unsigned int printedId = callsitetable::NO_CALLSITE;
+
+  // Print the sites in the order of their bytes and then their ids.
+  while(true) {
+    unsigned int best = callsitetable::NO_CALLSITE;
+    size_t bestBytes = 0;
+
+    for(unsigned int id = 1; id <= xdefines::CALLSITE_TABLE_SIZE; id++) {
+      size_t bytes = sites.getBytes(id);
+
+      if(sites.getObjects(id) == 0) {
+        continue;
+      }
+      if(bytes > printedBytes || (bytes == printedBytes && id <= printedId)) {
+        continue;
+      }
+      if(best == callsitetable::NO_CALLSITE || bytes > bestBytes) {
+        best = id;
+        bestBytes = bytes;
+      }
+    }
+
+    if(best == callsitetable::NO_CALLSITE) {
+      break;
+    }
+
+    PRINT("Leaked %zu objects, %zu bytes in total, allocated at:\n", sites.getObjects(best),
+          bestBytes);
+    selfmap::getInstance().printCallStack(sites.getDepth(best), sites.getFrames(best));
+
+    printedBytes = bestBytes;
+    printedId = best;
+  }
+
+  if(_unknownLeaks > 0) {
+    PRINT("Leaked %zu objects, %zu bytes in total, allocated at unknown sites.\n", _unknownLeaks,
+          _unknownLeakBytes);
+  }
+#endif
+}
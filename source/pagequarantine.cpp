@@ -0,0 +1,86 @@
+/*
+* @file pagequarantine.cpp
+* @brief Quarantine for large freed objects, whose pages are protected.
+* @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
+*/
+
+#include "pagequarantine.hh"
+
+#include "globalinfo.hh"
+#include "selfmap.hh"
+#include "sitemap.hh"
+#include "watchpoint.hh"
+#include "xmemory.hh"
+#include "xthread.hh"
+
+void pagequarantine::realfree(void* ptr) {
+  // Calling actual heap object to free this object.
+  xmemory::getInstance().realfree(ptr);
+}
+
+bool pagequarantine::handleFault(void* addr, ucontext_t* context) {
+  bool isFound = false;
+
+  _lock.lock();
+  for(size_t i = _LRIndex; i != _availIndex; i = incrIndex(i)) {
+    protectedObject* object = &_objects[i];
+
+    if(object->isProtected && addr >= object->pages &&
+       (intptr_t)addr < (intptr_t)object->pages + (intptr_t)object->pagesSize) {
+      // Report it only once, since the re-execution will fault at the same place.
+      if(!global_isRollback()) {
+        reportUseAfterFree(addr, object, context);
+      }
+
+      // Let the program continue on this object.
+      object->isProtected = false;
+      setProtection(object, PROT_READ | PROT_WRITE);
+      isFound = true;
+      break;
+    }
+  }
+  _lock.unlock();
+
+  return isFound;
+}
+
+void pagequarantine::reportUseAfterFree(void* addr, protectedObject* object,
+                                        ucontext_t* context) {
+  PRINT("\nCaught a use-after-free error at %p (object %p, size %zu). Current call stack:\n",
+        addr, object->ptr, object->size);
+  selfmap::getInstance().printCallStack(context);
+#if defined(DETECT_ALLOCATION_SITES)
+  sitemap::getInstance().printSite(object->ptr);
+#endif
+}
+
+bool pagequarantine::checkEnds(protectedObject* object) {
+  bool hasUAF = false;
+  unsigned long* ends[2];
+  size_t words[2];
+
+  ends[0] = (unsigned long*)object->ptr;
+  words[0] = ((intptr_t)object->pages - (intptr_t)object->ptr) / sizeof(unsigned long);
+  ends[1] = (unsigned long*)((intptr_t)object->pages + object->pagesSize);
+  words[1] = ((intptr_t)object->ptr + object->size - (intptr_t)ends[1]) / sizeof(unsigned long);
+
+  for(int j = 0; j < 2; j++) {
+    unsigned long* addr = ends[j];
+
+    for(size_t i = findCanaryMismatch(addr, 0, words[j]); i < words[j];
+        i = findCanaryMismatch(addr, i + 1, words[j])) {
+      // install watchpoints on this point, for new faults only.
+      if(watchpoint::getInstance().addWatchpoint(&addr[i], addr[i], OBJECT_TYPE_USEAFTERFREE,
+                                                 object->ptr, object->size)) {
+        hasUAF = true;
+      }
+    }
+  }
+
+  if(hasUAF && !global_isRollback()) {
+    // End the epoch now so that the watchpoints are used in the rollback.
+    xthread::invokeCommit();
+  }
+
+  return !hasUAF;
+}
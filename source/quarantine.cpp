@@ -9,14 +9,21 @@
 
 #include "quarantine.hh"
 
+#include "globalinfo.hh"
 #include "xmemory.hh"
+#include "xthread.hh"
 
 void quarantine::realfree(void* ptr) {
   // Calling actual heap object to free this object.
   xmemory::getInstance().realfree(ptr);
 }
 
-void quarantine::rollback() {
-  // Calling the rollback.
-  xmemory::getInstance().rollback();
+bool quarantine::commit() {
+  if(global_isRollback()) {
+    return false;
+  }
+
+  // End the epoch now so that the watchpoints are used in the rollback.
+  xthread::invokeCommit();
+  return true;
 }
@@ -0,0 +1,1643 @@
+/*
+ * @file   symbolizer.cpp
+ * @brief  Symbolize call stacks inside the process, without running addr2line.
+ * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
+ */
+
+#include "symbolizer.hh"
+
+#include <elf.h>
+#include <link.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "log.hh"
+#include "mm.hh"
+#include "real.hh"
+
+// DWARF constants used here, from the DWARF 5 standard.
+#define DW_TAG_subprogram 0x2e
+#define DW_TAG_inlined_subroutine 0x1d
+#define DW_TAG_compile_unit 0x11
+#define DW_TAG_partial_unit 0x3c
+
+#define DW_AT_name 0x03
+#define DW_AT_stmt_list 0x10
+#define DW_AT_low_pc 0x11
+#define DW_AT_high_pc 0x12
+#define DW_AT_comp_dir 0x1b
+#define DW_AT_abstract_origin 0x31
+#define DW_AT_specification 0x47
+#define DW_AT_ranges 0x55
+#define DW_AT_call_file 0x58
+#define DW_AT_call_line 0x59
+#define DW_AT_linkage_name 0x6e
+#define DW_AT_str_offsets_base 0x72
+#define DW_AT_addr_base 0x73
+#define DW_AT_rnglists_base 0x74
+#define DW_AT_MIPS_linkage_name 0x2007
+
+#define DW_FORM_addr 0x01
+#define DW_FORM_block2 0x03
+#define DW_FORM_block4 0x04
+#define DW_FORM_data2 0x05
+#define DW_FORM_data4 0x06
+#define DW_FORM_data8 0x07
+#define DW_FORM_string 0x08
+#define DW_FORM_block 0x09
+#define DW_FORM_block1 0x0a
+#define DW_FORM_data1 0x0b
+#define DW_FORM_flag 0x0c
+#define DW_FORM_sdata 0x0d
+#define DW_FORM_strp 0x0e
+#define DW_FORM_udata 0x0f
+#define DW_FORM_ref_addr 0x10
+#define DW_FORM_ref1 0x11
+#define DW_FORM_ref2 0x12
+#define DW_FORM_ref4 0x13
+#define DW_FORM_ref8 0x14
+#define DW_FORM_ref_udata 0x15
+#define DW_FORM_indirect 0x16
+#define DW_FORM_sec_offset 0x17
+#define DW_FORM_exprloc 0x18
+#define DW_FORM_flag_present 0x19
+#define DW_FORM_strx 0x1a
+#define DW_FORM_addrx 0x1b
+#define DW_FORM_ref_sup4 0x1c
+#define DW_FORM_strp_sup 0x1d
+#define DW_FORM_data16 0x1e
+#define DW_FORM_line_strp 0x1f
+#define DW_FORM_ref_sig8 0x20
+#define DW_FORM_implicit_const 0x21
+#define DW_FORM_loclistx 0x22
+#define DW_FORM_rnglistx 0x23
+#define DW_FORM_ref_sup8 0x24
+#define DW_FORM_strx1 0x25
+#define DW_FORM_strx2 0x26
+#define DW_FORM_strx3 0x27
+#define DW_FORM_strx4 0x28
+#define DW_FORM_addrx1 0x29
+#define DW_FORM_addrx2 0x2a
+#define DW_FORM_addrx3 0x2b
+#define DW_FORM_addrx4 0x2c
+#define DW_FORM_GNU_addr_index 0x1f01
+#define DW_FORM_GNU_str_index 0x1f02
+#define DW_FORM_GNU_ref_alt 0x1f20
+#define DW_FORM_GNU_strp_alt 0x1f21
+
+#define DW_UT_compile 0x01
+#define DW_UT_partial 0x03
+
+#define DW_LNS_copy 0x01
+#define DW_LNS_advance_pc 0x02
+#define DW_LNS_advance_line 0x03
+#define DW_LNS_set_file 0x04
+#define DW_LNS_const_add_pc 0x08
+#define DW_LNS_fixed_advance_pc 0x09
+#define DW_LNE_end_sequence 0x01
+#define DW_LNE_set_address 0x02
+
+#define DW_LNCT_path 0x1
+#define DW_LNCT_directory_index 0x2
+
+#define DW_RLE_end_of_list 0x00
+#define DW_RLE_base_addressx 0x01
+#define DW_RLE_startx_endx 0x02
+#define DW_RLE_startx_length 0x03
+#define DW_RLE_offset_pair 0x04
+#define DW_RLE_base_address 0x05
+#define DW_RLE_start_end 0x06
+#define DW_RLE_start_length 0x07
+
+// A bounded little-endian reader of a debug section.
+class dwarfReader {
+public:
+  dwarfReader(const unsigned char* start, const unsigned char* end) : _pos(start), _end(end) {}
+
+  bool atEnd() { return _pos >= _end; }
+
+  const unsigned char* position() { return _pos; }
+
+  void skip(uint64_t bytes) {
+    _pos = (bytes < (uint64_t)(_end - _pos)) ? _pos + bytes : _end;
+  }
+
+  uint64_t fixed(int bytes) {
+    uint64_t value = 0;
+
+    if(_end - _pos < bytes) {
+      _pos = _end;
+      return 0;
+    }
+
+    for(int i = 0; i < bytes; i++) {
+      value |= (uint64_t)_pos[i] << (i * 8);
+    }
+    _pos += bytes;
+    return value;
+  }
+
+  uint64_t u8() { return fixed(1); }
+  uint64_t u16() { return fixed(2); }
+  uint64_t u32() { return fixed(4); }
+  uint64_t u64() { return fixed(8); }
+
+  uint64_t uleb() {
+    uint64_t value = 0;
+    int shift = 0;
+
+    while(_pos < _end) {
+      unsigned char byte = *_pos++;
+      if(shift < 64) {
+        value |= (uint64_t)(byte & 0x7f) << shift;
+      }
+      shift += 7;
+      if((byte & 0x80) == 0) {
+        break;
+      }
+    }
+    return value;
+  }
+
+  int64_t sleb() {
+    int64_t value = 0;
+    int shift = 0;
+    unsigned char byte = 0;
+
+    while(_pos < _end) {
+      byte = *_pos++;
+      if(shift < 64) {
+        value |= (int64_t)(byte & 0x7f) << shift;
+      }
+      shift += 7;
+      if((byte & 0x80) == 0) {
+        break;
+      }
+    }
+
+    if(shift < 64 && (byte & 0x40)) {
+      value |= -((int64_t)1 << shift);
+    }
+    return value;
+  }
+
+  // A string ended by zero, or NULL when the section ends first.
+  const char* string() {
+    const char* str = (const char*)_pos;
+
+    while(_pos < _end && *_pos != 0) {
+      _pos++;
+    }
+    if(_pos == _end) {
+      return NULL;
+    }
+    _pos++;
+    return str;
+  }
+
+  uint64_t length(bool* is64) {
+    uint64_t length = u32();
+
+    *is64 = (length == 0xffffffff);
+    if(*is64) {
+      length = u64();
+    }
+    return length;
+  }
+
+  uint64_t offset(bool is64) { return is64 ? u64() : u32(); }
+
+private:
+  const unsigned char* _pos;
+  const unsigned char* _end;
+};
+
+
+// Normally, callstack only saves next instruction address.
+// To get the instruction of the call, we should substract 1 here.
+#define PREV_INSTRUCTION_OFFSET 1
+
+void symbolizer::printCallStack(int frames, void** addrs) {
+  selfmap& maps = selfmap::getInstance();
+  int numFrames = 0;
+
+  _lock.lock();
+
+  for(int i = 0; i < frames && numFrames < xdefines::SYMBOLIZER_MAX_FRAMES; i++) {
+    void* addr = (void*)((uintptr_t)addrs[i] - PREV_INSTRUCTION_OFFSET);
+
+    // Frames of DoubleTake itself are not interesting to the user.
+    if(maps.isDoubleTakeLibrary(addr)) {
+      continue;
+    }
+
+    frameInfo* frame = &_frames[numFrames++];
+    frame->addr = addr;
+    frame->object = getObject(maps.findMapping(addr));
+    frame->pc = (frame->object != NULL) ? (uintptr_t)addr - frame->object->bias : 0;
+    frame->unit = NO_UNIT;
+    frame->function = NULL;
+    frame->file = NULL;
+    frame->line = 0;
+    frame->inlines = 0;
+  }
+
+  // Symbolize all frames of an object together.
+  for(int i = 0; i < numFrames; i++) {
+    elfObject* object = _frames[i].object;
+    bool isDone = (object == NULL);
+
+    for(int j = 0; j < i && !isDone; j++) {
+      isDone = (_frames[j].object == object);
+    }
+
+    if(!isDone) {
+      symbolizeObject(object, _frames, numFrames);
+    }
+  }
+
+  for(int i = 0; i < numFrames; i++) {
+    printFrame(&_frames[i]);
+  }
+
+  _lock.unlock();
+}
+
+symbolizer::elfObject* symbolizer::getObject(const mapping* m) {
+  // Pseudo files like [vdso] and anonymous mappings are not on the disk.
+  if(m == NULL || m->getFile().size() == 0 || m->getFile()[0] != '/') {
+    return NULL;
+  }
+
+  const char* file = m->getFile().c_str();
+  for(int i = 0; i < _numObjects; i++) {
+    if(strcmp(_objects[i].file, file) == 0) {
+      return _objects[i].isValid ? &_objects[i] : NULL;
+    }
+  }
+
+  if(_numObjects == xdefines::SYMBOLIZER_MAX_OBJECTS) {
+    return NULL;
+  }
+
+  // An object that fails to load is kept, thus it is not loaded again.
+  elfObject* object = &_objects[_numObjects++];
+  memset(object, 0, sizeof(elfObject));
+  object->file = file;
+  object->isValid = loadObject(object, m);
+
+  return object->isValid ? object : NULL;
+}
+
+bool symbolizer::loadObject(elfObject* object, const mapping* m) {
+  if(!mapFile(object->file, &object->image)) {
+    return false;
+  }
+
+  // Find the segment of this mapping, which gives the load bias.
+  const ElfW(Ehdr)* header = (const ElfW(Ehdr)*)object->image.data;
+  if(header->e_phoff + header->e_phnum * sizeof(ElfW(Phdr)) > object->image.size) {
+    return false;
+  }
+
+  const ElfW(Phdr)* segments = (const ElfW(Phdr)*)(object->image.data + header->e_phoff);
+  bool hasSegment = false;
+
+  for(int i = 0; i < header->e_phnum; i++) {
+    const ElfW(Phdr)* segment = &segments[i];
+
+    if(segment->p_type == PT_LOAD &&
+       aligndown(segment->p_offset, xdefines::PageSize) <= m->getOffset() &&
+       m->getOffset() < segment->p_offset + segment->p_filesz) {
+      object->bias = m->getBase() - m->getOffset() - (segment->p_vaddr - segment->p_offset);
+      hasSegment = true;
+      break;
+    }
+  }
+
+  if(!hasSegment || !findSections(object, &object->image, false)) {
+    return false;
+  }
+
+  // Debug information may be installed in a separate file.
+  if(object->debugInfo.size == 0 || object->debugLine.size == 0) {
+    char path[PATH_MAX];
+
+    if(findDebugFile(object, path, sizeof(path)) && mapFile(path, &object->debugImage)) {
+      findSections(object, &object->debugImage, true);
+    }
+  }
+
+  parseSymbols(object, &object->image);
+
+  object->numRows = parseLines(object, true);
+  if(object->numRows > 0) {
+    object->rows = (lineRow*)MM::mmapAllocatePrivate(object->numRows * sizeof(lineRow));
+    object->files = (sourceFile*)MM::mmapAllocatePrivate((object->numFiles + 1) * sizeof(sourceFile));
+    object->tables = (lineTable*)MM::mmapAllocatePrivate((object->numTables + 1) * sizeof(lineTable));
+    parseLines(object, false);
+
+    // Rows ending sequences go first, thus a sequence starting at the same address wins.
+    std::sort(object->rows, object->rows + object->numRows, [](const lineRow& a, const lineRow& b) {
+      if(a.addr != b.addr) {
+        return a.addr < b.addr;
+      }
+      if((a.file == NO_FILE) != (b.file == NO_FILE)) {
+        return a.file == NO_FILE;
+      }
+      return a.index < b.index;
+    });
+  }
+
+  object->numUnits = parseUnits(object, true);
+  if(object->numUnits > 0) {
+    object->units = (unitRange*)MM::mmapAllocatePrivate(object->numUnits * sizeof(unitRange));
+    parseUnits(object, false);
+    std::sort(object->units, object->units + object->numUnits,
+              [](const unitRange& a, const unitRange& b) { return a.start < b.start; });
+  }
+
+  PRINF("Symbolizer loaded %s: bias %#lx, %zu symbols, %zu rows, %zu ranges of units\n",
+        object->file, object->bias, object->numSymbols, object->numRows, object->numUnits);
+  return true;
+}
+
+bool symbolizer::mapFile(const char* file, section* image) {
+  struct stat st;
+
+  int fd = Real::open(file, O_RDONLY);
+  if(fd < 0) {
+    return false;
+  }
+
+  if(Real::fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ElfW(Ehdr))) {
+    Real::close(fd);
+    return false;
+  }
+
+  void* ptr = Real::mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  Real::close(fd);
+  if(ptr == MAP_FAILED) {
+    return false;
+  }
+
+  const ElfW(Ehdr)* header = (const ElfW(Ehdr)*)ptr;
+  if(memcmp(header->e_ident, ELFMAG, SELFMAG) != 0 ||
+     header->e_ident[EI_CLASS] != (sizeof(void*) == 8 ? ELFCLASS64 : ELFCLASS32)) {
+    Real::munmap(ptr, st.st_size);
+    return false;
+  }
+
+  image->data = (const unsigned char*)ptr;
+  image->size = st.st_size;
+  return true;
+}
+
+// Get the section headers of an image, checking that they are inside it.
+static const ElfW(Shdr)* getSectionHeaders(const unsigned char* data, size_t size, int* count) {
+  const ElfW(Ehdr)* header = (const ElfW(Ehdr)*)data;
+
+  if(header->e_shoff == 0 || header->e_shoff + header->e_shnum * sizeof(ElfW(Shdr)) > size ||
+     header->e_shstrndx >= header->e_shnum) {
+    return NULL;
+  }
+
+  *count = header->e_shnum;
+  return (const ElfW(Shdr)*)(data + header->e_shoff);
+}
+
+bool symbolizer::findSections(elfObject* object, section* image, bool isDebugFile) {
+  struct {
+    const char* name;
+    section* target;
+  } debugSections[] = {
+    { ".debug_info", &object->debugInfo },
+    { ".debug_abbrev", &object->debugAbbrev },
+    { ".debug_line", &object->debugLine },
+    { ".debug_str", &object->debugStr },
+    { ".debug_line_str", &object->debugLineStr },
+    { ".debug_ranges", &object->debugRanges },
+    { ".debug_rnglists", &object->debugRnglists },
+    { ".debug_addr", &object->debugAddr },
+    { ".debug_str_offsets", &object->debugStrOffsets },
+  };
+  int count;
+
+  const ElfW(Shdr)* sections = getSectionHeaders(image->data, image->size, &count);
+  if(sections == NULL) {
+    return false;
+  }
+
+  // The debug file replaces all debug sections of the object.
+  if(isDebugFile) {
+    for(size_t i = 0; i < sizeof(debugSections) / sizeof(debugSections[0]); i++) {
+      debugSections[i].target->data = NULL;
+      debugSections[i].target->size = 0;
+    }
+  }
+
+  const ElfW(Shdr)* names = &sections[((const ElfW(Ehdr)*)image->data)->e_shstrndx];
+  for(int i = 0; i < count; i++) {
+    const ElfW(Shdr)* s = &sections[i];
+
+    // Compressed sections are not supported.
+    if(s->sh_type == SHT_NOBITS || (s->sh_flags & SHF_COMPRESSED) ||
+       s->sh_offset + s->sh_size > image->size || s->sh_name >= names->sh_size) {
+      continue;
+    }
+
+    const char* name = (const char*)image->data + names->sh_offset + s->sh_name;
+    for(size_t j = 0; j < sizeof(debugSections) / sizeof(debugSections[0]); j++) {
+      if(strcmp(name, debugSections[j].name) == 0) {
+        debugSections[j].target->data = image->data + s->sh_offset;
+        debugSections[j].target->size = s->sh_size;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool symbolizer::findDebugFile(elfObject* object, char* path, size_t size) {
+  int count;
+
+  const ElfW(Shdr)* sections = getSectionHeaders(object->image.data, object->image.size, &count);
+  if(sections == NULL) {
+    return false;
+  }
+
+  for(int i = 0; i < count; i++) {
+    if(sections[i].sh_type != SHT_NOTE || sections[i].sh_offset + sections[i].sh_size > object->image.size) {
+      continue;
+    }
+
+    dwarfReader r(object->image.data + sections[i].sh_offset,
+                  object->image.data + sections[i].sh_offset + sections[i].sh_size);
+
+    while(!r.atEnd()) {
+      uint64_t nameSize = r.u32();
+      uint64_t descSize = r.u32();
+      uint64_t type = r.u32();
+      const char* name = (const char*)r.position();
+      r.skip(alignup(nameSize, 4));
+      const unsigned char* desc = r.position();
+      r.skip(alignup(descSize, 4));
+
+      if(type != NT_GNU_BUILD_ID || nameSize != 4 || memcmp(name, "GNU", 4) != 0 || descSize < 2 ||
+         r.position() - desc < (long)descSize) {
+        continue;
+      }
+
+      // The file is /usr/lib/debug/.build-id/xx/yyyy.debug, with the ID in hex.
+      int length = snprintf(path, size, "/usr/lib/debug/.build-id/%02x/", desc[0]);
+      for(uint64_t j = 1; j < descSize && length + 3 < (int)size; j++) {
+        length += snprintf(path + length, size - length, "%02x", desc[j]);
+      }
+      snprintf(path + length, size - length, ".debug");
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void symbolizer::parseSymbols(elfObject* object, section* image) {
+  const ElfW(Shdr)* table = NULL;
+  section* tableImage = image;
+  int count;
+
+  // Prefer .symtab of the object or its debug file over .dynsym.
+  for(int round = 0; round < 3 && table == NULL; round++) {
+    tableImage = (round == 1) ? &object->debugImage : image;
+    if(tableImage->data == NULL) {
+      continue;
+    }
+
+    const ElfW(Shdr)* sections = getSectionHeaders(tableImage->data, tableImage->size, &count);
+    for(int i = 0; sections != NULL && i < count; i++) {
+      if(sections[i].sh_type == (round < 2 ? SHT_SYMTAB : SHT_DYNSYM) &&
+         sections[i].sh_link < (unsigned int)count &&
+         sections[i].sh_offset + sections[i].sh_size <= tableImage->size &&
+         sections[sections[i].sh_link].sh_offset + sections[sections[i].sh_link].sh_size <=
+           tableImage->size) {
+        table = &sections[i];
+        break;
+      }
+    }
+  }
+
+  if(table == NULL) {
+    return;
+  }
+
+  const ElfW(Shdr)* strings = &((const ElfW(Shdr)*)(tableImage->data +
+                                                      ((const ElfW(Ehdr)*)tableImage->data)->e_shoff))[table->sh_link];
+  const ElfW(Sym)* symbols = (const ElfW(Sym)*)(tableImage->data + table->sh_offset);
+  size_t numSymbols = table->sh_size / sizeof(ElfW(Sym));
+
+  for(int round = 0; round < 2; round++) {
+    size_t index = 0;
+
+    for(size_t i = 0; i < numSymbols; i++) {
+      const ElfW(Sym)* symbol = &symbols[i];
+      int type = ELF64_ST_TYPE(symbol->st_info);
+
+      if((type != STT_FUNC && type != STT_GNU_IFUNC) || symbol->st_shndx == SHN_UNDEF ||
+         symbol->st_value == 0 || symbol->st_name >= strings->sh_size) {
+        continue;
+      }
+
+      if(round == 1) {
+        object->symbols[index].addr = symbol->st_value;
+        object->symbols[index].size = symbol->st_size;
+        object->symbols[index].name = (const char*)tableImage->data + strings->sh_offset + symbol->st_name;
+      }
+      index++;
+    }
+
+    if(round == 0) {
+      if(index == 0) {
+        return;
+      }
+      object->numSymbols = index;
+      object->symbols = (symbolEntry*)MM::mmapAllocatePrivate(index * sizeof(symbolEntry));
+    }
+  }
+
+  std::sort(object->symbols, object->symbols + object->numSymbols,
+            [](const symbolEntry& a, const symbolEntry& b) { return a.addr < b.addr; });
+}
+
+// Find the string at the given index of a list ended by an empty string.
+static const char* getListString(const unsigned char* list, const unsigned char* end, uint64_t index) {
+  dwarfReader r(list, end);
+
+  for(uint64_t i = 0; i <= index; i++) {
+    const char* str = r.string();
+    if(str == NULL || *str == 0) {
+      return NULL;
+    }
+    if(i == index) {
+      return str;
+    }
+  }
+  return NULL;
+}
+
+size_t symbolizer::parseLines(elfObject* object, bool isCounting) {
+  section* s = &object->debugLine;
+  dwarfReader tables(s->data, s->data + s->size);
+  size_t numRows = 0;
+  unsigned int numFiles = 0;
+  size_t numTables = 0;
+
+  while(!tables.atEnd()) {
+    const unsigned char* tableStart = tables.position();
+    bool is64;
+    uint64_t length = tables.length(&is64);
+    const unsigned char* start = tables.position();
+
+    if(length > (uint64_t)(s->data + s->size - start)) {
+      break;
+    }
+
+    const unsigned char* end = start + length;
+    tables.skip(length);
+
+    unitInfo unit;
+    memset(&unit, 0, sizeof(unit));
+    unit.object = object;
+    unit.is64 = is64;
+    unit.addrSize = sizeof(void*);
+
+    dwarfReader r(start, end);
+    unit.version = r.u16();
+    if(unit.version < 2 || unit.version > 5) {
+      continue;
+    }
+
+    if(unit.version >= 5) {
+      unit.addrSize = r.u8();
+      r.u8();
+    }
+
+    uint64_t headerLength = r.offset(is64);
+    if(headerLength > (uint64_t)(end - r.position())) {
+      continue;
+    }
+    const unsigned char* program = r.position() + headerLength;
+
+    unsigned int minLength = r.u8();
+    if(unit.version >= 4) {
+      r.u8();
+    }
+    r.u8();
+    int lineBase = (int8_t)r.u8();
+    unsigned int lineRange = r.u8();
+    unsigned int opcodeBase = r.u8();
+    const unsigned char* opcodeLengths = r.position();
+    r.skip(opcodeBase > 0 ? opcodeBase - 1 : 0);
+
+    if(lineRange == 0 || opcodeBase == 0) {
+      continue;
+    }
+
+    // Files are numbered from 1 before DWARF 5, and from 0 since then.
+    // Directory 0 is the directory of the compilation, which is only in the table
+    // since DWARF 5. Before that, it is set by the compilation unit in parseUnits().
+    unsigned int firstFile = numFiles;
+    if(unit.version < 5) {
+      const unsigned char* dirs = r.position();
+      const char* str;
+
+      while((str = r.string()) != NULL && *str != 0) {
+      }
+
+      while((str = r.string()) != NULL && *str != 0) {
+        uint64_t dir = r.uleb();
+        r.uleb();
+        r.uleb();
+
+        if(!isCounting && numFiles < object->numFiles) {
+          object->files[numFiles].name = str;
+          object->files[numFiles].dir = (dir == 0) ? NULL : getListString(dirs, end, dir - 1);
+          object->files[numFiles].compDir = NULL;
+        }
+        numFiles++;
+      }
+    } else {
+      int numDirFormats = r.u8();
+      const unsigned char* dirFormats = r.position();
+      for(int i = 0; i < numDirFormats; i++) {
+        r.uleb();
+        r.uleb();
+      }
+
+      uint64_t numDirs = r.uleb();
+      const unsigned char* dirs = r.position();
+      uint64_t dirIndex;
+      for(uint64_t i = 0; i < numDirs && !r.atEnd(); i++) {
+        readLineEntry(r, dirFormats, numDirFormats, end, &unit, &dirIndex);
+      }
+
+      int numFileFormats = r.u8();
+      const unsigned char* fileFormats = r.position();
+      for(int i = 0; i < numFileFormats; i++) {
+        r.uleb();
+        r.uleb();
+      }
+
+      // The directory of the compilation is the first one.
+      const char* compDir = NULL;
+      if(numDirs > 0) {
+        dwarfReader d(dirs, end);
+        compDir = readLineEntry(d, dirFormats, numDirFormats, end, &unit, &dirIndex);
+      }
+
+      uint64_t count = r.uleb();
+      for(uint64_t i = 0; i < count && !r.atEnd(); i++) {
+        const char* name = readLineEntry(r, fileFormats, numFileFormats, end, &unit, &dirIndex);
+
+        if(!isCounting && numFiles < object->numFiles) {
+          const char* dir = NULL;
+
+          if(dirIndex < numDirs) {
+            dwarfReader d(dirs, end);
+            for(uint64_t j = 0; j <= dirIndex; j++) {
+              uint64_t unused;
+              dir = readLineEntry(d, dirFormats, numDirFormats, end, &unit, &unused);
+            }
+          }
+
+          object->files[numFiles].name = (name != NULL) ? name : "??";
+          object->files[numFiles].dir = dir;
+          object->files[numFiles].compDir = compDir;
+        }
+        numFiles++;
+      }
+    }
+
+    unsigned int tableFiles = numFiles - firstFile;
+    if(!isCounting && numTables < object->numTables) {
+      object->tables[numTables].offset = tableStart - s->data;
+      object->tables[numTables].firstFile = firstFile;
+      object->tables[numTables].files = tableFiles;
+      object->tables[numTables].version = unit.version;
+    }
+    numTables++;
+
+    // Run the line number program. Sequences of discarded functions start at
+    // address 0, and they are dropped.
+    dwarfReader p(program, end);
+    uintptr_t addr = 0;
+    uint64_t file = 1;
+    int64_t line = 1;
+    bool hasAddress = false;
+
+    auto addRow = [&](bool isEnd) {
+      if(!hasAddress) {
+        return;
+      }
+
+      if(!isCounting && numRows < object->numRows) {
+        uint64_t index = (unit.version >= 5) ? file : file - 1;
+        lineRow* row = &object->rows[numRows];
+
+        row->addr = addr;
+        row->file = isEnd ? NO_FILE : (index < tableFiles ? firstFile + index : UNKNOWN_FILE);
+        row->line = (unsigned int)line;
+        row->index = numRows;
+      }
+      numRows++;
+    };
+
+    while(!p.atEnd()) {
+      unsigned int opcode = p.u8();
+
+      if(opcode >= opcodeBase) {
+        unsigned int adjusted = opcode - opcodeBase;
+        addr += (adjusted / lineRange) * minLength;
+        line += lineBase + (int)(adjusted % lineRange);
+        addRow(false);
+      } else if(opcode == 0) {
+        uint64_t size = p.uleb();
+        const unsigned char* next = p.position();
+        unsigned int subOpcode = p.u8();
+
+        if(subOpcode == DW_LNE_end_sequence) {
+          addRow(true);
+          addr = 0;
+          file = 1;
+          line = 1;
+          hasAddress = false;
+        } else if(subOpcode == DW_LNE_set_address && size > 1 && size <= 9) {
+          addr = p.fixed(size - 1);
+          hasAddress = (addr != 0);
+        }
+
+        if(size > (uint64_t)(p.position() - next)) {
+          p.skip(size - (p.position() - next));
+        }
+      } else {
+        switch(opcode) {
+        case DW_LNS_copy:
+          addRow(false);
+          break;
+        case DW_LNS_advance_pc:
+          addr += p.uleb() * minLength;
+          break;
+        case DW_LNS_advance_line:
+          line += p.sleb();
+          break;
+        case DW_LNS_set_file:
+          file = p.uleb();
+          break;
+        case DW_LNS_const_add_pc:
+          addr += ((255 - opcodeBase) / lineRange) * minLength;
+          break;
+        case DW_LNS_fixed_advance_pc:
+          addr += p.u16();
+          break;
+        default:
+          for(unsigned int i = 0; i < opcodeLengths[opcode - 1]; i++) {
+            p.uleb();
+          }
+          break;
+        }
+      }
+    }
+  }
+
+  if(isCounting) {
+    object->numFiles = numFiles;
+    object->numTables = numTables;
+  }
+  return numRows;
+}
+
+const char* symbolizer::readLineEntry(dwarfReader& r, const unsigned char* formats, int numFormats,
+                                      const unsigned char* end, unitInfo* unit, uint64_t* dirIndex) {
+  dwarfReader f(formats, end);
+  const char* path = NULL;
+
+  *dirIndex = 0;
+  for(int i = 0; i < numFormats; i++) {
+    uint64_t type = f.uleb();
+    uint64_t form = f.uleb();
+    attrValue attr;
+
+    if(!readAttribute(r, form, 0, unit, &attr)) {
+      r.skip((uint64_t)-1);
+      return NULL;
+    }
+
+    if(type == DW_LNCT_path) {
+      path = getString(unit, &attr);
+    } else if(type == DW_LNCT_directory_index) {
+      *dirIndex = attr.value;
+    }
+  }
+
+  return path;
+}
+
+bool symbolizer::readAttribute(dwarfReader& r, uint64_t form, int64_t implicitConst, unitInfo* unit,
+                               attrValue* attr) {
+  elfObject* object = unit->object;
+
+  attr->form = form;
+  attr->value = 0;
+  attr->string = NULL;
+
+  switch(form) {
+  case DW_FORM_addr:
+    attr->value = r.fixed(unit->addrSize);
+    break;
+  case DW_FORM_block2:
+    r.skip(r.u16());
+    break;
+  case DW_FORM_block4:
+    r.skip(r.u32());
+    break;
+  case DW_FORM_block:
+  case DW_FORM_exprloc:
+    r.skip(r.uleb());
+    break;
+  case DW_FORM_block1:
+    r.skip(r.u8());
+    break;
+  case DW_FORM_data16:
+    r.skip(16);
+    break;
+  case DW_FORM_data1:
+  case DW_FORM_flag:
+  case DW_FORM_ref1:
+  case DW_FORM_strx1:
+  case DW_FORM_addrx1:
+    attr->value = r.u8();
+    break;
+  case DW_FORM_data2:
+  case DW_FORM_ref2:
+  case DW_FORM_strx2:
+  case DW_FORM_addrx2:
+    attr->value = r.u16();
+    break;
+  case DW_FORM_strx3:
+  case DW_FORM_addrx3:
+    attr->value = r.fixed(3);
+    break;
+  case DW_FORM_data4:
+  case DW_FORM_ref4:
+  case DW_FORM_ref_sup4:
+  case DW_FORM_strx4:
+  case DW_FORM_addrx4:
+    attr->value = r.u32();
+    break;
+  case DW_FORM_data8:
+  case DW_FORM_ref8:
+  case DW_FORM_ref_sig8:
+  case DW_FORM_ref_sup8:
+    attr->value = r.u64();
+    break;
+  case DW_FORM_sdata:
+    attr->value = (uint64_t)r.sleb();
+    break;
+  case DW_FORM_udata:
+  case DW_FORM_ref_udata:
+  case DW_FORM_strx:
+  case DW_FORM_addrx:
+  case DW_FORM_loclistx:
+  case DW_FORM_rnglistx:
+  case DW_FORM_GNU_addr_index:
+  case DW_FORM_GNU_str_index:
+    attr->value = r.uleb();
+    break;
+  case DW_FORM_string:
+    attr->string = r.string();
+    break;
+  case DW_FORM_strp:
+    attr->value = r.offset(unit->is64);
+    if(attr->value < object->debugStr.size) {
+      attr->string = (const char*)object->debugStr.data + attr->value;
+    }
+    break;
+  case DW_FORM_line_strp:
+    attr->value = r.offset(unit->is64);
+    if(attr->value < object->debugLineStr.size) {
+      attr->string = (const char*)object->debugLineStr.data + attr->value;
+    }
+    break;
+  case DW_FORM_ref_addr:
+    attr->value = (unit->version <= 2) ? r.fixed(unit->addrSize) : r.offset(unit->is64);
+    break;
+  case DW_FORM_sec_offset:
+  case DW_FORM_strp_sup:
+  case DW_FORM_GNU_ref_alt:
+  case DW_FORM_GNU_strp_alt:
+    attr->value = r.offset(unit->is64);
+    break;
+  case DW_FORM_flag_present:
+    attr->value = 1;
+    break;
+  case DW_FORM_implicit_const:
+    attr->value = (uint64_t)implicitConst;
+    break;
+  case DW_FORM_indirect:
+    return readAttribute(r, r.uleb(), implicitConst, unit, attr);
+  default:
+    // The size of an unknown form is unknown, so nothing after it can be read.
+    return false;
+  }
+
+  return true;
+}
+
+const char* symbolizer::getString(unitInfo* unit, attrValue* attr) {
+  if(attr->string != NULL) {
+    return attr->string;
+  }
+
+  switch(attr->form) {
+  case DW_FORM_strx:
+  case DW_FORM_strx1:
+  case DW_FORM_strx2:
+  case DW_FORM_strx3:
+  case DW_FORM_strx4:
+  case DW_FORM_GNU_str_index: {
+    section* offsets = &unit->object->debugStrOffsets;
+    uint64_t position = unit->strOffsetsBase + attr->value * (unit->is64 ? 8 : 4);
+
+    if(position >= offsets->size) {
+      return NULL;
+    }
+
+    dwarfReader r(offsets->data + position, offsets->data + offsets->size);
+    uint64_t offset = r.offset(unit->is64);
+    if(offset < unit->object->debugStr.size) {
+      return (const char*)unit->object->debugStr.data + offset;
+    }
+    return NULL;
+  }
+  default:
+    return NULL;
+  }
+}
+
+bool symbolizer::getIndexedAddress(unitInfo* unit, uint64_t index, uintptr_t* addr) {
+  section* addrs = &unit->object->debugAddr;
+  uint64_t position = unit->addrBase + index * unit->addrSize;
+
+  if(position >= addrs->size) {
+    return false;
+  }
+
+  dwarfReader r(addrs->data + position, addrs->data + addrs->size);
+  *addr = r.fixed(unit->addrSize);
+  return true;
+}
+
+bool symbolizer::getAddress(unitInfo* unit, attrValue* attr, uintptr_t* addr) {
+  switch(attr->form) {
+  case DW_FORM_addr:
+    *addr = attr->value;
+    return true;
+  case DW_FORM_addrx:
+  case DW_FORM_addrx1:
+  case DW_FORM_addrx2:
+  case DW_FORM_addrx3:
+  case DW_FORM_addrx4:
+  case DW_FORM_GNU_addr_index:
+    return getIndexedAddress(unit, attr->value, addr);
+  default:
+    return false;
+  }
+}
+
+size_t symbolizer::getReference(unitInfo* unit, attrValue* attr) {
+  switch(attr->form) {
+  case DW_FORM_ref1:
+  case DW_FORM_ref2:
+  case DW_FORM_ref4:
+  case DW_FORM_ref8:
+  case DW_FORM_ref_udata:
+    return (unit->start - unit->object->debugInfo.data) + attr->value;
+  case DW_FORM_ref_addr:
+    return attr->value;
+  default:
+    return NO_UNIT;
+  }
+}
+
+template <typename Visitor> void symbolizer::visitRanges(unitInfo* unit, dieInfo* die, Visitor visit) {
+  elfObject* object = unit->object;
+  uintptr_t low, high;
+
+  if(die->lowPc.form != 0 && die->highPc.form != 0 && getAddress(unit, &die->lowPc, &low)) {
+    // The high address is an offset from the low one, unless it is an address.
+    if(!getAddress(unit, &die->highPc, &high)) {
+      if(die->highPc.form == DW_FORM_addr) {
+        return;
+      }
+      high = low + die->highPc.value;
+    }
+    visit(low, high);
+    return;
+  }
+
+  if(die->ranges.form == 0) {
+    return;
+  }
+
+  uintptr_t base = unit->base;
+  if(unit->version < 5) {
+    section* s = &object->debugRanges;
+    uint64_t maxAddr = (unit->addrSize == 8) ? ~(uint64_t)0 : 0xffffffffUL;
+
+    if(die->ranges.value >= s->size) {
+      return;
+    }
+
+    dwarfReader r(s->data + die->ranges.value, s->data + s->size);
+    while(!r.atEnd()) {
+      uint64_t start = r.fixed(unit->addrSize);
+      uint64_t end = r.fixed(unit->addrSize);
+
+      if(start == 0 && end == 0) {
+        break;
+      } else if(start == maxAddr) {
+        base = end;
+      } else {
+        visit(base + start, base + end);
+      }
+    }
+    return;
+  }
+
+  section* s = &object->debugRnglists;
+  uint64_t offset = die->ranges.value;
+
+  // Indices are resolved through the table of offsets at DW_AT_rnglists_base.
+  if(die->ranges.form == DW_FORM_rnglistx) {
+    uint64_t position = unit->rnglistsBase + offset * (unit->is64 ? 8 : 4);
+    if(position >= s->size) {
+      return;
+    }
+    dwarfReader r(s->data + position, s->data + s->size);
+    offset = unit->rnglistsBase + r.offset(unit->is64);
+  }
+
+  if(offset >= s->size) {
+    return;
+  }
+
+  dwarfReader r(s->data + offset, s->data + s->size);
+  while(!r.atEnd()) {
+    uintptr_t start, end;
+
+    switch(r.u8()) {
+    case DW_RLE_end_of_list:
+      return;
+    case DW_RLE_base_addressx:
+      if(!getIndexedAddress(unit, r.uleb(), &base)) {
+        return;
+      }
+      break;
+    case DW_RLE_startx_endx:
+      if(getIndexedAddress(unit, r.uleb(), &start) && getIndexedAddress(unit, r.uleb(), &end)) {
+        visit(start, end);
+      }
+      break;
+    case DW_RLE_startx_length:
+      if(getIndexedAddress(unit, r.uleb(), &start)) {
+        visit(start, start + r.uleb());
+      }
+      break;
+    case DW_RLE_offset_pair:
+      start = base + r.uleb();
+      end = base + r.uleb();
+      visit(start, end);
+      break;
+    case DW_RLE_base_address:
+      base = r.fixed(unit->addrSize);
+      break;
+    case DW_RLE_start_end:
+      start = r.fixed(unit->addrSize);
+      end = r.fixed(unit->addrSize);
+      visit(start, end);
+      break;
+    case DW_RLE_start_length:
+      start = r.fixed(unit->addrSize);
+      visit(start, start + r.uleb());
+      break;
+    default:
+      return;
+    }
+  }
+}
+
+bool symbolizer::readAbbrevs(elfObject* object, size_t offset) {
+  section* s = &object->debugAbbrev;
+
+  if(_abbrevObject == object && _abbrevOffset == offset) {
+    return true;
+  }
+
+  _abbrevObject = NULL;
+  _numAbbrevs = 0;
+  if(offset >= s->size) {
+    return false;
+  }
+
+  dwarfReader r(s->data + offset, s->data + s->size);
+  while(!r.atEnd()) {
+    uint64_t code = r.uleb();
+    if(code == 0) {
+      break;
+    }
+
+    uint64_t tag = r.uleb();
+    bool hasChildren = (r.u8() != 0);
+    const unsigned char* specs = r.position();
+
+    while(!r.atEnd()) {
+      uint64_t name = r.uleb();
+      uint64_t form = r.uleb();
+
+      if(form == DW_FORM_implicit_const) {
+        r.sleb();
+      }
+      if(name == 0 && form == 0) {
+        break;
+      }
+    }
+
+    if(_numAbbrevs == _maxAbbrevs) {
+      size_t maxAbbrevs = (_maxAbbrevs == 0) ? 1024 : _maxAbbrevs * 2;
+      abbrevEntry* abbrevs = (abbrevEntry*)MM::mmapAllocatePrivate(maxAbbrevs * sizeof(abbrevEntry));
+
+      if(_abbrevs != NULL) {
+        memcpy(abbrevs, _abbrevs, _numAbbrevs * sizeof(abbrevEntry));
+        MM::mmapDeallocate(_abbrevs, _maxAbbrevs * sizeof(abbrevEntry));
+      }
+      _abbrevs = abbrevs;
+      _maxAbbrevs = maxAbbrevs;
+    }
+
+    abbrevEntry* abbrev = &_abbrevs[_numAbbrevs++];
+    abbrev->code = code;
+    abbrev->tag = tag;
+    abbrev->hasChildren = hasChildren;
+    abbrev->specs = specs;
+  }
+
+  _abbrevObject = object;
+  _abbrevOffset = offset;
+  return true;
+}
+
+symbolizer::abbrevEntry* symbolizer::findAbbrev(uint64_t code) {
+  // Codes are normally numbered from 1.
+  if(code >= 1 && code <= _numAbbrevs && _abbrevs[code - 1].code == code) {
+    return &_abbrevs[code - 1];
+  }
+
+  for(size_t i = 0; i < _numAbbrevs; i++) {
+    if(_abbrevs[i].code == code) {
+      return &_abbrevs[i];
+    }
+  }
+  return NULL;
+}
+
+int symbolizer::readDie(unitInfo* unit, dwarfReader& r, dieInfo* die) {
+  uint64_t code = r.uleb();
+  if(code == 0) {
+    return 0;
+  }
+
+  abbrevEntry* abbrev = findAbbrev(code);
+  if(abbrev == NULL) {
+    return -1;
+  }
+
+  memset(die, 0, sizeof(dieInfo));
+  die->tag = abbrev->tag;
+  die->hasChildren = abbrev->hasChildren;
+
+  section* s = &unit->object->debugAbbrev;
+  dwarfReader specs(abbrev->specs, s->data + s->size);
+  while(!specs.atEnd()) {
+    uint64_t name = specs.uleb();
+    uint64_t form = specs.uleb();
+    int64_t implicitConst = (form == DW_FORM_implicit_const) ? specs.sleb() : 0;
+    attrValue attr;
+
+    if(name == 0 && form == 0) {
+      break;
+    }
+
+    if(!readAttribute(r, form, implicitConst, unit, &attr)) {
+      return -1;
+    }
+
+    switch(name) {
+    case DW_AT_name:
+      die->name = attr;
+      break;
+    case DW_AT_stmt_list:
+      die->stmtList = attr;
+      break;
+    case DW_AT_low_pc:
+      die->lowPc = attr;
+      break;
+    case DW_AT_high_pc:
+      die->highPc = attr;
+      break;
+    case DW_AT_abstract_origin:
+      die->origin = attr;
+      break;
+    case DW_AT_specification:
+      die->specification = attr;
+      break;
+    case DW_AT_ranges:
+      die->ranges = attr;
+      break;
+    case DW_AT_comp_dir:
+      die->compDir = attr;
+      break;
+    case DW_AT_call_file:
+      die->callFile = attr;
+      break;
+    case DW_AT_call_line:
+      die->callLine = attr;
+      break;
+    case DW_AT_linkage_name:
+    case DW_AT_MIPS_linkage_name:
+      die->linkageName = attr;
+      break;
+    case DW_AT_str_offsets_base:
+      die->strOffsetsBase = attr;
+      break;
+    case DW_AT_addr_base:
+      die->addrBase = attr;
+      break;
+    case DW_AT_rnglists_base:
+      die->rnglistsBase = attr;
+      break;
+    default:
+      break;
+    }
+  }
+
+  return 1;
+}
+
+bool symbolizer::readUnit(elfObject* object, size_t offset, unitInfo* unit, dieInfo* root) {
+  section* s = &object->debugInfo;
+
+  memset(unit, 0, sizeof(unitInfo));
+  unit->object = object;
+  if(offset >= s->size) {
+    return false;
+  }
+
+  dwarfReader r(s->data + offset, s->data + s->size);
+  uint64_t length = r.length(&unit->is64);
+  if(length > (uint64_t)(s->data + s->size - r.position())) {
+    return false;
+  }
+
+  unit->start = s->data + offset;
+  unit->end = r.position() + length;
+
+  dwarfReader header(r.position(), unit->end);
+  uint64_t type = DW_UT_compile;
+  uint64_t abbrevOffset;
+
+  unit->version = header.u16();
+  if(unit->version < 2 || unit->version > 5) {
+    return false;
+  }
+
+  if(unit->version >= 5) {
+    type = header.u8();
+    unit->addrSize = header.u8();
+    abbrevOffset = header.offset(unit->is64);
+  } else {
+    abbrevOffset = header.offset(unit->is64);
+    unit->addrSize = header.u8();
+  }
+
+  // Type units and split units have no code.
+  if((type != DW_UT_compile && type != DW_UT_partial) || unit->addrSize == 0 ||
+     unit->addrSize > 8 || !readAbbrevs(object, abbrevOffset)) {
+    return false;
+  }
+
+  unit->dies = header.position();
+
+  // The attributes of the unit are needed to read the others.
+  dwarfReader dies(unit->dies, unit->end);
+  if(readDie(unit, dies, root) != 1) {
+    return false;
+  }
+
+  unit->strOffsetsBase = root->strOffsetsBase.value;
+  unit->addrBase = root->addrBase.value;
+  unit->rnglistsBase = root->rnglistsBase.value;
+
+  uintptr_t base;
+  if(getAddress(unit, &root->lowPc, &base)) {
+    unit->base = base;
+  }
+
+  if(root->stmtList.form != 0) {
+    unit->table = findTable(object, root->stmtList.value);
+  }
+  return true;
+}
+
+symbolizer::lineTable* symbolizer::findTable(elfObject* object, size_t offset) {
+  lineTable* tables = object->tables;
+  size_t low = 0;
+  size_t high = object->numTables;
+
+  // Tables are parsed in the order of their offsets.
+  while(low < high) {
+    size_t mid = (low + high) / 2;
+
+    if(tables[mid].offset == offset) {
+      return &tables[mid];
+    } else if(tables[mid].offset < offset) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return NULL;
+}
+
+size_t symbolizer::parseUnits(elfObject* object, bool isCounting) {
+  section* s = &object->debugInfo;
+  size_t offset = 0;
+  size_t numRanges = 0;
+
+  while(offset < s->size) {
+    unitInfo unit;
+    dieInfo root;
+    bool isValid = readUnit(object, offset, &unit, &root);
+
+    if(unit.end == NULL) {
+      break;
+    }
+
+    // Relative directories before DWARF 5 are in the directory of the compilation.
+    if(isValid && !isCounting && unit.table != NULL && unit.table->version < 5) {
+      const char* compDir = getString(&unit, &root.compDir);
+
+      for(unsigned int i = 0; i < unit.table->files; i++) {
+        object->files[unit.table->firstFile + i].compDir = compDir;
+      }
+    }
+
+    if(isValid) {
+      visitRanges(&unit, &root, [&](uintptr_t start, uintptr_t end) {
+        if(start >= end) {
+          return;
+        }
+
+        if(!isCounting && numRanges < object->numUnits) {
+          object->units[numRanges].start = start;
+          object->units[numRanges].end = end;
+          object->units[numRanges].offset = offset;
+        }
+        numRanges++;
+      });
+    }
+
+    offset = unit.end - s->data;
+  }
+
+  return numRanges;
+}
+
+void symbolizer::symbolizeObject(elfObject* object, frameInfo* frames, int numFrames) {
+  for(int i = 0; i < numFrames; i++) {
+    if(frames[i].object == object) {
+      findLine(object, &frames[i]);
+    }
+  }
+
+  // Walk a compilation unit once for all frames in it.
+  for(int i = 0; i < numFrames; i++) {
+    bool isDone = (frames[i].object != object || frames[i].unit == NO_UNIT);
+
+    for(int j = 0; j < i && !isDone; j++) {
+      isDone = (frames[j].object == object && frames[j].unit == frames[i].unit);
+    }
+
+    if(!isDone) {
+      findInlines(object, frames[i].unit, frames, numFrames);
+    }
+  }
+}
+
+void symbolizer::findLine(elfObject* object, frameInfo* frame) {
+  uintptr_t pc = frame->pc;
+
+  // The symbol is the last one starting at or before the pc.
+  symbolEntry* symbol = std::upper_bound(object->symbols, object->symbols + object->numSymbols, pc,
+                                         [](uintptr_t pc, const symbolEntry& s) { return pc < s.addr; });
+  if(symbol != object->symbols) {
+    symbol--;
+    if(symbol->size == 0 || pc < symbol->addr + symbol->size) {
+      frame->function = symbol->name;
+    }
+  }
+
+  lineRow* row = std::upper_bound(object->rows, object->rows + object->numRows, pc,
+                                  [](uintptr_t pc, const lineRow& r) { return pc < r.addr; });
+  if(row != object->rows) {
+    row--;
+    if(row->file != NO_FILE) {
+      frame->file = (row->file != UNKNOWN_FILE) ? &object->files[row->file] : NULL;
+      frame->line = row->line;
+    }
+  }
+
+  unitRange* unit = std::upper_bound(object->units, object->units + object->numUnits, pc,
+                                     [](uintptr_t pc, const unitRange& u) { return pc < u.start; });
+  if(unit != object->units) {
+    unit--;
+    if(pc < unit->end) {
+      frame->unit = unit->offset;
+    }
+  }
+}
+
+void symbolizer::findInlines(elfObject* object, size_t unitOffset, frameInfo* frames, int numFrames) {
+  unitInfo unit;
+  dieInfo die;
+
+  if(!readUnit(object, unitOffset, &unit, &die)) {
+    return;
+  }
+
+  dwarfReader r(unit.dies, unit.end);
+  int depth = 0;
+
+  // Every subprogram and inlined subroutine containing a pc is put on the chain
+  // of its frame. They are nested, thus the chain goes from the outermost one.
+  while(!r.atEnd()) {
+    size_t offset = r.position() - object->debugInfo.data;
+    int result = readDie(&unit, r, &die);
+
+    if(result < 0) {
+      break;
+    } else if(result == 0) {
+      if(--depth <= 0) {
+        break;
+      }
+      continue;
+    }
+
+    if((die.tag == DW_TAG_subprogram || die.tag == DW_TAG_inlined_subroutine) &&
+       (die.lowPc.form != 0 || die.ranges.form != 0)) {
+      visitRanges(&unit, &die, [&](uintptr_t start, uintptr_t end) {
+        for(int i = 0; i < numFrames; i++) {
+          frameInfo* frame = &frames[i];
+
+          if(frame->object != object || frame->unit != unitOffset || frame->pc < start ||
+             frame->pc >= end) {
+            continue;
+          }
+
+          while(frame->inlines > 0 && frame->chain[frame->inlines - 1].depth >= depth) {
+            frame->inlines--;
+          }
+
+          // The innermost functions are kept when the chain is too long.
+          if(frame->inlines == xdefines::SYMBOLIZER_MAX_INLINES) {
+            memmove(&frame->chain[0], &frame->chain[1], (frame->inlines - 1) * sizeof(inlineEntry));
+            frame->inlines--;
+          }
+
+          inlineEntry* entry = &frame->chain[frame->inlines++];
+          entry->depth = depth;
+          entry->origin = offset;
+          entry->function = NULL;
+          entry->callFile = UNKNOWN_FILE;
+          entry->callLine = die.callLine.value;
+
+          if(die.callFile.form != 0 && unit.table != NULL) {
+            uint64_t index = (unit.table->version >= 5) ? die.callFile.value : die.callFile.value - 1;
+            if(index < unit.table->files) {
+              entry->callFile = unit.table->firstFile + index;
+            }
+          }
+        }
+      });
+    }
+
+    if(die.hasChildren) {
+      depth++;
+    }
+  }
+
+  for(int i = 0; i < numFrames; i++) {
+    if(frames[i].object == object && frames[i].unit == unitOffset) {
+      for(int j = 0; j < frames[i].inlines; j++) {
+        frames[i].chain[j].function = getName(&unit, frames[i].chain[j].origin, 0);
+      }
+    }
+  }
+}
+
+const char* symbolizer::getName(unitInfo* unit, size_t offset, int hops) {
+  section* s = &unit->object->debugInfo;
+  dieInfo die;
+
+  // Only references inside the unit are followed.
+  if(hops > 4 || offset < (size_t)(unit->dies - s->data) || offset >= (size_t)(unit->end - s->data)) {
+    return NULL;
+  }
+
+  dwarfReader r(s->data + offset, unit->end);
+  if(readDie(unit, r, &die) != 1) {
+    return NULL;
+  }
+
+  const char* name = getString(unit, &die.name);
+  if(name == NULL) {
+    name = getString(unit, &die.linkageName);
+  }
+
+  if(name == NULL && die.origin.form != 0) {
+    name = getName(unit, getReference(unit, &die.origin), hops + 1);
+  }
+  if(name == NULL && die.specification.form != 0) {
+    name = getName(unit, getReference(unit, &die.specification), hops + 1);
+  }
+  return name;
+}
+
+void symbolizer::getLocation(elfObject* object, unsigned int file, unsigned int line, char* buf,
+                             size_t size) {
+  if(file == UNKNOWN_FILE || file >= object->numFiles) {
+    snprintf(buf, size, "??:%u", line);
+    return;
+  }
+
+  // A relative file is in its directory, and a relative directory is in the
+  // directory of the compilation.
+  sourceFile* source = &object->files[file];
+  const char* dir = (source->name[0] == '/') ? NULL : source->dir;
+  const char* compDir = (source->name[0] == '/' || (dir != NULL && dir[0] == '/')) ? NULL : source->compDir;
+
+  snprintf(buf, size, "%s%s%s%s%s:%u", (compDir != NULL) ? compDir : "", (compDir != NULL) ? "/" : "",
+           (dir != NULL) ? dir : "", (dir != NULL) ? "/" : "", source->name, line);
+}
+
+// Print a frame like "addr2line -a -i -p": the innermost function at the pc,
+// and then every function that it is inlined into, at the place of the call.
+void symbolizer::printFrame(frameInfo* frame) {
+  elfObject* object = frame->object;
+  const char* function = frame->function;
+  char location[PATH_MAX];
+
+  if(frame->inlines > 0 && frame->chain[frame->inlines - 1].function != NULL) {
+    function = frame->chain[frame->inlines - 1].function;
+  }
+  if(function == NULL) {
+    function = "??";
+  }
+
+  if(object == NULL) {
+    PRINT("0x%016lx: %s", (unsigned long)frame->addr, function);
+    return;
+  }
+
+  if(frame->file != NULL) {
+    getLocation(object, frame->file - object->files, frame->line, location, sizeof(location));
+    PRINT("0x%016lx: %s at %s", (unsigned long)frame->addr, function, location);
+  } else if(object->numRows == 0) {
+    PRINT("0x%016lx: %s in %s", (unsigned long)frame->addr, function, object->file);
+  } else {
+    PRINT("0x%016lx: %s at ??:0", (unsigned long)frame->addr, function);
+  }
+
+  for(int i = frame->inlines - 1; i > 0; i--) {
+    const char* caller = frame->chain[i - 1].function;
+
+    getLocation(object, frame->chain[i].callFile, frame->chain[i].callLine, location,
+                sizeof(location));
+    PRINT(" (inlined by) %s at %s", (caller != NULL) ? caller : "??", location);
+  }
+}
@@ -0,0 +1,82 @@
+/*
+ * @file   uafverifier.cpp
+ * @brief  A background thread that checks the canaries of quarantined objects.
+ * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
+ */
+
+#include "uafverifier.hh"
+
+#include <signal.h>
+#include <time.h>
+
+#include "globalinfo.hh"
+#include "log.hh"
+#include "quarantine.hh"
+#include "real.hh"
+#include "threadstruct.hh"
+#include "xthread.hh"
+
+void uafverifier::initialize() {
+  if(Real::pthread_create(&_thread, NULL, uafverifier::verifierThread, NULL) != 0) {
+    PRWRN("DoubleTake: Failed to start the use-after-free verifier.\n");
+  }
+}
+
+bool uafverifier::checkCorruption() {
+  // Only one thread handles the corrupted object.
+  if(!__atomic_exchange_n(&_hasCorruption, false, __ATOMIC_ACQ_REL)) {
+    return false;
+  }
+
+  return hasUsageAfterFree(&_corrupted);
+}
+
+void uafverifier::handleCorruption() {
+  if(global_isRollback()) {
+    return;
+  }
+
+  if(checkCorruption()) {
+    PRINF("DoubleTake: Use-after-free on object %p found by the verifier.\n", _corrupted.ptr);
+    xthread::invokeCommit();
+  }
+}
+
+void* uafverifier::verifierThread(void* /* arg */) {
+  sigset_t mask;
+
+  // This thread is not managed by DoubleTake. Any signal should go to the
+  // application threads instead.
+  sigfillset(&mask);
+  Real::sigprocmask(SIG_BLOCK, &mask, NULL);
+
+  struct timespec interval;
+  interval.tv_sec = 0;
+  interval.tv_nsec = xdefines::UAF_VERIFIER_INTERVAL;
+
+  while(true) {
+    Real::nanosleep(&interval, NULL);
+    uafverifier::getInstance().sweep();
+  }
+
+  return NULL;
+}
+
+void uafverifier::sweep() {
+  for(int i = 0; i < xdefines::MAX_ALIVE_THREADS; i++) {
+    // Quarantine lists are checkpointed, restored or checked at epoch ends.
+    // Skip the remaining lists in those phases, and also when a corrupted
+    // object is still waiting to be handled.
+    if(!global_isEpochBegin() || global_isRollback() || hasCorruption()) {
+      return;
+    }
+
+    freeObject corrupted;
+    thread_t* thread = xthread::getInstance().getThreadByIndex(i);
+
+    if(thread->qlist.verifyObjects(&_cursors[i], xdefines::UAF_VERIFIER_BATCH, &corrupted)) {
+      _corrupted = corrupted;
+      __atomic_store_n(&_hasCorruption, true, __ATOMIC_RELEASE);
+    }
+  }
+}
@@ -0,0 +1,189 @@
+/*
+ * @file   unwinder.cpp
+ * @brief  Get call stacks by walking the chain of frame pointers.
+ * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
+ */
+
+#include "unwinder.hh"
+
+#include <execinfo.h>
+#include <string.h>
+
+#include "selfmap.hh"
+#include "threadstruct.hh"
+#include "xdefines.hh"
+#include "xthread.hh"
+
+// The stack pointer at the entry of the program, from the dynamic linker.
+extern "C" void* __libc_stack_end;
+
+void unwinder::initialize() {
+  void* frames[1];
+  backtrace(frames, 1);
+}
+
+int unwinder::getCallStack(void** frames, int maxDepth) {
+  bool isComplete;
+  int depth = walk((uintptr_t)__builtin_frame_address(0), (uintptr_t)&depth, frames, 0, maxDepth,
+                   &isComplete);
+
+  if(!isComplete) {
+    depth = getBacktrace(frames, maxDepth, NULL);
+  }
+  return depth;
+}
+
+int unwinder::getCallStackFast(void** frames, int maxDepth) {
+  bool isComplete;
+  return walk((uintptr_t)__builtin_frame_address(0), (uintptr_t)&isComplete, frames, 0, maxDepth,
+              &isComplete);
+}
+
+// The interrupted function may not have set up its frame yet, or be a leaf function
+// without one, like memcpy(). Then the frame pointer is still the one of its caller,
+// and the walk would silently drop the caller, which is the most important frame of a
+// report. In that case the word at the stack pointer is the return address into the
+// caller, which is put in front of the frames found by the walk.
+// backtrace() takes the lock of the dynamic linker, so it is only used when the
+// walk is broken.
+int unwinder::getCallStack(ucontext_t* context, void** frames, int maxDepth) {
+  uintptr_t ip = (uintptr_t)context->uc_mcontext.gregs[REG_RIP];
+  uintptr_t fp = (uintptr_t)context->uc_mcontext.gregs[REG_RBP];
+  uintptr_t sp = (uintptr_t)context->uc_mcontext.gregs[REG_RSP];
+  bool isComplete;
+  int depth = 1;
+
+  if(maxDepth <= 0) {
+    return 0;
+  }
+
+  frames[0] = (void*)(ip + 1);
+  if(depth < maxDepth && isOnStack(sp)) {
+    uintptr_t leaf = *(uintptr_t*)sp;
+
+    // Unless it is the return address of the frame that the walk starts with.
+    if(isReturnAddress(leaf) &&
+       !(fp >= sp && isOnStack(fp + sizeof(void*)) && leaf == ((uintptr_t*)fp)[1])) {
+      frames[depth++] = (void*)leaf;
+    }
+  }
+
+  depth = walk(fp, sp, frames, depth, maxDepth, &isComplete);
+  if(!isComplete) {
+    // backtrace() finds the interrupted instruction as the first frame, unless it
+    // can not unwind through the signal frame.
+    int traced = getBacktrace(frames, maxDepth, (void*)ip);
+    if(traced > 0) {
+      depth = traced;
+      frames[0] = (void*)(ip + 1);
+    }
+  }
+
+  return depth;
+}
+
+// Whether a word at addr is inside the stack of the current thread.
+bool unwinder::isOnStack(uintptr_t addr) {
+  return current != NULL && current->stackTop != NULL && (addr & (sizeof(void*) - 1)) == 0 &&
+         addr >= (uintptr_t)current->stackBottom &&
+         addr + sizeof(void*) <= (uintptr_t)current->stackTop;
+}
+
+// Whether addr follows a call instruction in a text segment: "call rel32", or an
+// indirect "call" (opcode 0xff with reg 2 in its ModRM byte) of 2, 3, 6 or 7 bytes.
+bool unwinder::isReturnAddress(uintptr_t addr) {
+  static const int CALL_LENGTHS[] = {2, 3, 6, 7};
+  const mapping* m = selfmap::getInstance().findMapping((void*)addr);
+
+  if(m == NULL || !m->isText() || addr < m->getBase() + 7 || addr > m->getLimit()) {
+    return false;
+  }
+
+  const unsigned char* code = (const unsigned char*)addr;
+  if(code[-5] == 0xe8) {
+    return true;
+  }
+  for(int length : CALL_LENGTHS) {
+    if(code[-length] == 0xff && (code[-length + 1] & 0x38) == 0x10) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Walk the frames until the chain ends, is broken or there are maxDepth frames.
+int unwinder::walk(uintptr_t fp, uintptr_t sp, void** frames, int depth, int maxDepth,
+                   bool* isComplete) {
+  *isComplete = false;
+  if(current == NULL || current->stackTop == NULL) {
+    return depth;
+  }
+
+  uintptr_t top = (uintptr_t)current->stackTop;
+
+  while(depth < maxDepth) {
+    // The outermost frame of a thread.
+    if(fp == 0) {
+      break;
+    }
+
+    // Every frame is aligned, inside the stack and above the last frame.
+    if((fp & (sizeof(void*) - 1)) != 0 || fp < sp || fp + 2 * sizeof(void*) > top) {
+      // The frame of main() is called by __libc_start_main() without a frame
+      // pointer, right below the stack pointer at the entry of the program.
+      if(sp <= (uintptr_t)__libc_stack_end &&
+         (uintptr_t)__libc_stack_end - sp < xdefines::PageSize) {
+        break;
+      }
+      return depth;
+    }
+
+    uintptr_t* frame = (uintptr_t*)fp;
+    if(frame[1] < xdefines::PageSize) {
+      return depth;
+    }
+
+    frames[depth++] = (void*)frame[1];
+    sp = fp + 2 * sizeof(void*);
+    fp = frame[0];
+  }
+
+  *isComplete = true;
+  return depth;
+}
+
+// Unwind with backtrace(), and drop the frames up to the caller of getCallStack(),
+// or up to the interrupted instruction when unwinding through a signal frame.
+int unwinder::getBacktrace(void** frames, int maxDepth, void* ip) {
+  void* stack[xdefines::UNWINDER_MAX_FRAMES];
+  int skip = 2;
+  int depth;
+  bool isDisabled = (current != NULL && current->disablecheck);
+
+  if(current != NULL && !isDisabled) {
+    xthread::disableCheck();
+  }
+  depth = backtrace(stack, xdefines::UNWINDER_MAX_FRAMES);
+  if(current != NULL && !isDisabled) {
+    xthread::enableCheck();
+  }
+
+  if(ip != NULL) {
+    for(skip = 0; skip < depth && stack[skip] != ip; skip++) {
+    }
+    if(skip == depth) {
+      return -1;
+    }
+  }
+
+  depth -= skip;
+  if(depth > maxDepth) {
+    depth = maxDepth;
+  }
+  if(depth <= 0) {
+    return 0;
+  }
+  memcpy(frames, &stack[skip], depth * sizeof(void*));
+
+  return depth;
+}
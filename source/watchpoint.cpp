@@ -17,6 +17,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <syscall.h>
 #include <ucontext.h>
 #include <unistd.h>
@@ -25,7 +26,11 @@
 #include "memtrack.hh"
 #include "real.hh"
 #include "selfmap.hh"
+#include "sitemap.hh"
+#include "threadmap.hh"
+#include "threadstruct.hh"
 #include "xdefines.hh"
+#include "xmemory.hh"
 
 long perf_event_open(struct perf_event_attr* hw_event, pid_t pid, int cpu, int group_fd,
                      unsigned long flags) {
@@ -41,6 +46,12 @@ bool watchpoint::addWatchpoint(void* addr, size_t value, faultyObjectType objtyp
                                void* objectstart, size_t objectsize) {
   bool hasWatchpoint = true;
 
+  // This corruption has been diagnosed in an earlier re-execution, or is found
+  // again before the rollback, e.g., by the re-execution itself.
+  if(isKnownFault(addr, value) || isWatched(addr, value)) {
+    return false;
+  }
+
 #ifndef EVALUATING_PERF
   if(objtype == OBJECT_TYPE_OVERFLOW) {
     PRINT("DoubleTake: Buffer overflow detected at address %p: value=0x%zx, size=%zx, start=%p\n",
@@ -51,9 +62,16 @@ bool watchpoint::addWatchpoint(void* addr, size_t value, faultyObjectType objtyp
    // assert(objtype == OBJECT_TYPE_USEAFTERFREE);
     PRINT("DoubleTake: Use-after-free error detected at address %p.", addr);
   }
+
+#if defined(DETECT_ALLOCATION_SITES)
+  // Report the allocation site now, in case the re-execution diverges.
+  if(objectstart != NULL) {
+    sitemap::getInstance().printSite(objectstart);
+  }
+#endif
 #endif
 
-  if(_numWatchpoints < xdefines::MAX_WATCHPOINTS) {
+  if(_numWatchpoints < xdefines::MAX_WATCHPOINTS + xdefines::MAX_SOFTWARE_WATCHPOINTS) {
     // Record watch point information
     _wp[_numWatchpoints].faultyaddr = addr;
     _wp[_numWatchpoints].objectstart = objectstart;
@@ -61,6 +79,9 @@ bool watchpoint::addWatchpoint(void* addr, size_t value, faultyObjectType objtyp
     //  _wp[_numWatchpoints].objectsize = objectsize;
     _wp[_numWatchpoints].faultyvalue = value;
     _wp[_numWatchpoints].currentvalue = value;
+    _wp[_numWatchpoints].faultySite = CallSite();
+    _wp[_numWatchpoints].isDiagnosed = false;
+    _wp[_numWatchpoints].hasRegister = false;
     _numWatchpoints++;
   } else {
     hasWatchpoint = false;
@@ -70,20 +91,20 @@ bool watchpoint::addWatchpoint(void* addr, size_t value, faultyObjectType objtyp
 	if(objtype != OBJECT_TYPE_WATCHONLY)
   	memtrack::getInstance().insert(objectstart, objectsize, objtype);
 
-  return !hasWatchpoint;
+  return hasWatchpoint;
 }
 
 bool watchpoint::findFaultyObject(faultyObject** object) {
   int trigPoints = 0;
 
   PRINF("findFaultyObject: _numWatchpoints %d\n", _numWatchpoints);
-  for(int i = 0; i < _numWatchpoints; i++) {
+  for(int i = 0; i < _numHardwareWatchpoints; i++) {
     unsigned long value = *((unsigned long*)_wp[i].faultyaddr);
 #ifndef EVALUATING_PERF
     PRINT("DoubleTake: checking %d point: address %p currentvalue %lx value %lx\n", i, _wp[i].faultyaddr, _wp[i].currentvalue, value);
 #endif
     // Check whether now overflow actually happens
-    if(value != _wp[i].currentvalue || _numWatchpoints == 1) {
+    if(value != _wp[i].currentvalue || _numHardwareWatchpoints == 1) {
       //				PRINT("WARNING: we %d points, currentvalue %lx value %lx\n", trigPoints,
       //_wp[i].currentvalue, value);
       _wp[i].currentvalue = value;
@@ -116,14 +137,16 @@ void watchpoint::installWatchpoints() {
   trap_action.sa_flags = SA_SIGINFO | SA_RESTART | SA_NODEFER;
   Real::sigaction(SIGTRAP, &trap_action, NULL);
 
+  // Choose the watch points in debug registers.
+  assignWatchpoints();
+
   // Setup the watchpoints information and notify the daemon (my parent)
   struct watchpointsInfo wpinfo;
-  wpinfo.count = _numWatchpoints;
-  int perffd;
+  wpinfo.count = _numHardwareWatchpoints;
 
   //  PRINT("Install watchpoints: _numWatchpoints %d\n", _numWatchpoints);
   // Get the initial value of different watchpoints.
-  for(int i = 0; i < _numWatchpoints; i++) {
+  for(int i = 0; i < _numHardwareWatchpoints; i++) {
     // PRINT("Watchpoint %d: addr %p. _numWatchpoints %d\n", i, _wp[i].faultyaddr, _numWatchpoints);
     wpinfo.wp[i] = (unsigned long)_wp[i].faultyaddr;
     // PRINT("Watchpoint %d: addr %p\n", i, _wp[i].faultyaddr);
@@ -131,15 +154,329 @@ void watchpoint::installWatchpoints() {
     // we can compare those values to find out which watchpoint
     // are accessed since we don't want to check the debug status register
     _wp[i].currentvalue = *((unsigned long*)_wp[i].faultyaddr);
+  }
+  // We actually don't care about what content.
 
+  // The debug registers are armed by every thread in installThreadWatchpoints().
+  protectPages();
+}
+
+void watchpoint::installThreadWatchpoints() {
+  for(int i = 0; i < _numHardwareWatchpoints; i++) {
     // install this watch point.
-    perffd = install_watchpoint((uintptr_t)_wp[i].faultyaddr, SIGTRAP, -1);
+    int perffd = install_watchpoint((uintptr_t)_wp[i].faultyaddr, SIGTRAP, -1);
     // PRINT("Watchpoint %d: addr %p done\n", i, _wp[i].faultyaddr);
+
+    // Now we can start this watchpoint.
+    enable_watchpoints(perffd);
+    current->watchFds[i] = perffd;
   }
+  current->numWatchFds = _numHardwareWatchpoints;
+}
 
-  // Now we can start those watchpoints.
-  enable_watchpoints(perffd);
-  // We actually don't care about what content.
+void watchpoint::uninstallWatchpoints() {
+  threadmap::aliveThreadIterator i;
+
+  // All threads are stopped, and a thread stopped in a step clears its trap flag
+  // on the next trap.
+  for(i = threadmap::getInstance().begin(); i != threadmap::getInstance().end(); i++) {
+    thread_t* thread = i.getThread();
+
+    for(int j = 0; j < thread->numWatchFds; j++) {
+      disable_watchpoint(thread->watchFds[j]);
+      Real::close(thread->watchFds[j]);
+    }
+    thread->numWatchFds = 0;
+    thread->watchedPage = NULL;
+  }
+  _numHardwareWatchpoints = 0;
+
+  for(int j = 0; j < _numPages; j++) {
+    Real::mprotect(_pages[j].page, xdefines::PageSize, PROT_READ | PROT_WRITE);
+  }
+  _numPages = 0;
+  _numActiveWatchpoints = 0;
+}
+
+bool watchpoint::hasNextBatch() {
+  for(int i = 0; i < _numWatchpoints; i++) {
+    if(!_wp[i].isDiagnosed && !_wp[i].hasRegister) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void watchpoint::clearWatchpoints() {
+  for(int i = 0; i < _numWatchpoints; i++) {
+    if(_numKnownFaults < xdefines::MAX_WATCHPOINTS + xdefines::MAX_SOFTWARE_WATCHPOINTS) {
+      _knownFaults[_numKnownFaults].addr = _wp[i].faultyaddr;
+      _knownFaults[_numKnownFaults].value = _wp[i].faultyvalue;
+      _numKnownFaults++;
+    }
+  }
+  _numWatchpoints = 0;
+}
+
+bool watchpoint::isKnownFault(void* addr, unsigned long value) {
+  for(int i = 0; i < _numKnownFaults; i++) {
+    if(_knownFaults[i].addr == addr && _knownFaults[i].value == value) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool watchpoint::isWatched(void* addr, unsigned long value) {
+  for(int i = 0; i < _numWatchpoints; i++) {
+    if(_wp[i].faultyaddr == addr && _wp[i].faultyvalue == value) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void watchpoint::assignWatchpoints() {
+  unsigned long heapBegin = (unsigned long)xmemory::getInstance().getHeapBegin();
+  unsigned long heapEnd = (unsigned long)xmemory::getInstance().getHeapEnd();
+  int sharers[xdefines::MAX_WATCHPOINTS + xdefines::MAX_SOFTWARE_WATCHPOINTS];
+  int count = 0;
+
+  // Only faults without call stacks, which have not been in a debug register
+  // yet, are watched. Move them to the front.
+  for(int i = 0; i < _numWatchpoints; i++) {
+    if(!_wp[i].isDiagnosed && !_wp[i].hasRegister) {
+      swapWatchpoints(count++, i, NULL);
+    }
+  }
+
+  // A debug register is most useful for a watch point outside the heap, whose page
+  // can't be protected, and then for one alone on its page, since every write on
+  // a protected page traps, even if it is not on the watched word.
+  for(int i = 0; i < count; i++) {
+    unsigned long addr = (unsigned long)_wp[i].faultyaddr;
+
+    if(addr < heapBegin || addr >= heapEnd) {
+      sharers[i] = -1;
+      continue;
+    }
+
+    sharers[i] = 0;
+    for(int j = 0; j < count; j++) {
+      if(j != i && aligndown((unsigned long)_wp[j].faultyaddr, xdefines::PageSize) ==
+                       aligndown(addr, xdefines::PageSize)) {
+        sharers[i]++;
+      }
+    }
+  }
+
+  // Move the chosen ones to the front.
+  _numHardwareWatchpoints = 0;
+  while(_numHardwareWatchpoints < count && _numHardwareWatchpoints < xdefines::MAX_WATCHPOINTS) {
+    int best = _numHardwareWatchpoints;
+
+    for(int i = best + 1; i < count; i++) {
+      if(sharers[i] < sharers[best]) {
+        best = i;
+      }
+    }
+
+    swapWatchpoints(_numHardwareWatchpoints, best, sharers);
+    _wp[_numHardwareWatchpoints].hasRegister = true;
+    _numHardwareWatchpoints++;
+  }
+
+  // The rest in the heap are watched in software, and others wait for a debug
+  // register in the next re-execution.
+  _numActiveWatchpoints = _numHardwareWatchpoints;
+  for(int i = _numHardwareWatchpoints; i < count; i++) {
+    if(sharers[i] != -1) {
+      swapWatchpoints(_numActiveWatchpoints++, i, sharers);
+    }
+  }
+}
+
+void watchpoint::swapWatchpoints(int i, int j, int* sharers) {
+  if(i == j) {
+    return;
+  }
+
+  faultyObject object = _wp[i];
+  _wp[i] = _wp[j];
+  _wp[j] = object;
+
+  if(sharers != NULL) {
+    int sharer = sharers[i];
+    sharers[i] = sharers[j];
+    sharers[j] = sharer;
+  }
+}
+
+void watchpoint::protectPages() {
+  _numPages = 0;
+
+  for(int i = _numHardwareWatchpoints; i < _numActiveWatchpoints; i++) {
+    void* page = (void*)aligndown((unsigned long)_wp[i].faultyaddr, xdefines::PageSize);
+
+    _wp[i].currentvalue = *((unsigned long*)_wp[i].faultyaddr);
+    if(findPage(page) != NULL) {
+      continue;
+    }
+
+    // Insert this page in order.
+    int j = _numPages;
+    while(j > 0 && _pages[j - 1].page > page) {
+      _pages[j] = _pages[j - 1];
+      j--;
+    }
+    _pages[j].page = page;
+    _pages[j].writers = 0;
+    _numPages++;
+  }
+
+  // Reads are not watched, so the pages stay readable.
+  for(int i = 0; i < _numPages; i++) {
+    Real::mprotect(_pages[i].page, xdefines::PageSize, PROT_READ);
+  }
+
+  if(_numPages > 0) {
+    PRINF("Watch %d addresses on %d protected pages\n",
+          _numActiveWatchpoints - _numHardwareWatchpoints, _numPages);
+  }
+}
+
+watchpoint::protectedPage* watchpoint::findPage(void* addr) {
+  void* page = (void*)aligndown((unsigned long)addr, xdefines::PageSize);
+  int low = 0;
+  int high = _numPages - 1;
+
+  while(low <= high) {
+    int mid = (low + high) / 2;
+
+    if(_pages[mid].page == page) {
+      return &_pages[mid];
+    } else if(_pages[mid].page < page) {
+      low = mid + 1;
+    } else {
+      high = mid - 1;
+    }
+  }
+
+  return NULL;
+}
+
+bool watchpoint::handleFault(void* addr, void* context) {
+  protectedPage* page = findPage(addr);
+  ucontext_t* faultcontext = (ucontext_t*)context;
+
+  if(page == NULL || current == NULL) {
+    return false;
+  }
+
+  // An instruction like "rep movs" may fault on another page before its step ends.
+  if(current->watchedPage != NULL) {
+    finishStep(faultcontext);
+  }
+
+  __atomic_add_fetch(&page->writers, 1, __ATOMIC_SEQ_CST);
+  Real::mprotect(page->page, xdefines::PageSize, PROT_READ | PROT_WRITE);
+
+  // Trap after this instruction is executed again.
+  current->watchedPage = page;
+  current->watchedAddr = addr;
+  faultcontext->uc_mcontext.gregs[REG_EFL] |= EFLAGS_TF;
+  return true;
+}
+
+bool watchpoint::handleStep(siginfo_t* siginfo, ucontext_t* context) {
+  if(siginfo->si_code != TRAP_TRACE || !(context->uc_mcontext.gregs[REG_EFL] & EFLAGS_TF)) {
+    return false;
+  }
+
+  if(current != NULL && current->watchedPage != NULL) {
+    finishStep(context);
+  } else {
+    // The watch points were removed while this thread was stopped in a step.
+    context->uc_mcontext.gregs[REG_EFL] &= ~EFLAGS_TF;
+  }
+  return true;
+}
+
+void watchpoint::finishStep(ucontext_t* context) {
+  protectedPage* page = (protectedPage*)current->watchedPage;
+  unsigned long addr = (unsigned long)current->watchedAddr;
+
+  current->watchedPage = NULL;
+  context->uc_mcontext.gregs[REG_EFL] &= ~EFLAGS_TF;
+
+  for(int i = _numHardwareWatchpoints; i < _numActiveWatchpoints; i++) {
+    faultyObject* object = &_wp[i];
+    unsigned long faultyaddr = (unsigned long)object->faultyaddr;
+
+    if(aligndown(faultyaddr, xdefines::PageSize) != (unsigned long)page->page) {
+      continue;
+    }
+
+    // The width of the write is not known, so a write of a word that overlaps the
+    // watched word, or any write that changes it, is an access.
+    unsigned long value = *((unsigned long*)faultyaddr);
+    if(value != object->currentvalue ||
+       (addr + xdefines::WORD_SIZE > faultyaddr && addr < faultyaddr + xdefines::WORD_SIZE)) {
+      object->currentvalue = value;
+      reportAccess(object, context);
+    }
+  }
+
+  if(__atomic_sub_fetch(&page->writers, 1, __ATOMIC_SEQ_CST) == 0) {
+    Real::mprotect(page->page, xdefines::PageSize, PROT_READ);
+  }
+}
+
+void watchpoint::beginSystemCall(void* start, size_t size) {
+  unsigned long begin = aligndown((unsigned long)start, xdefines::PageSize);
+  unsigned long end = (unsigned long)start + size;
+
+  for(int i = 0; i < _numPages; i++) {
+    protectedPage* page = &_pages[i];
+
+    if((unsigned long)page->page >= begin && (unsigned long)page->page < end) {
+      __atomic_add_fetch(&page->writers, 1, __ATOMIC_SEQ_CST);
+      Real::mprotect(page->page, xdefines::PageSize, PROT_READ | PROT_WRITE);
+    }
+  }
+}
+
+void watchpoint::endSystemCall(void* start, size_t size) {
+  unsigned long begin = aligndown((unsigned long)start, xdefines::PageSize);
+  unsigned long end = (unsigned long)start + size;
+
+  for(int i = 0; i < _numPages; i++) {
+    protectedPage* page = &_pages[i];
+
+    if((unsigned long)page->page < begin || (unsigned long)page->page >= end) {
+      continue;
+    }
+
+    // Only a changed value tells that the system call wrote a watched word.
+    for(int j = _numHardwareWatchpoints; j < _numActiveWatchpoints; j++) {
+      faultyObject* object = &_wp[j];
+      unsigned long value = *((unsigned long*)object->faultyaddr);
+
+      if(aligndown((unsigned long)object->faultyaddr, xdefines::PageSize) ==
+             (unsigned long)page->page &&
+         value != object->currentvalue) {
+        void* callsites[xdefines::CALLSITE_MAXIMUM_LENGTH];
+        int depth = selfmap::getCallStack((void**)&callsites);
+
+        object->currentvalue = value;
+        reportAccess(object, depth, (void**)&callsites);
+      }
+    }
+
+    if(__atomic_sub_fetch(&page->writers, 1, __ATOMIC_SEQ_CST) == 0) {
+      Real::mprotect(page->page, xdefines::PageSize, PROT_READ);
+    }
+  }
 }
 
 int watchpoint::install_watchpoint(uintptr_t address, int sig, int group) {
@@ -176,9 +513,11 @@ int watchpoint::install_watchpoint(uintptr_t address, int sig, int group) {
     abort();
   }
 
-  // Deliver the signal to this thread
-  //   if(Real::fcntl(perf_fd, F_SETOWN, syscall(__NR_gettid)) == -1) {
-  if(Real::fcntl(perf_fd, F_SETOWN, getpid()) == -1) {
+  // Deliver the signal to this thread, which does the write.
+  struct f_owner_ex owner;
+  owner.type = F_OWNER_TID;
+  owner.pid = syscall(__NR_gettid);
+  if(Real::fcntl(perf_fd, F_SETOWN_EX, &owner) == -1) {
     fprintf(stderr, "Failed to set the owner of the perf event file: %s\n", strerror(errno));
     abort();
   }
@@ -207,9 +546,13 @@ bool watchpoint::checkAndSaveCallsite(faultyObject* object, int depth, void** ca
 }
 
 // Handle those traps on watchpoints now.
-void watchpoint::trapHandler(int /* sig */, siginfo_t* /* siginfo */, void* context) {
+void watchpoint::trapHandler(int /* sig */, siginfo_t* siginfo, void* context) {
   ucontext_t* trapcontext = (ucontext_t*)context;
-  size_t* addr = (size_t*)trapcontext->uc_mcontext.gregs[REG_IP]; // address of access
+
+  // A single-stepped write on a page of software watch points.
+  if(watchpoint::getInstance().handleStep(siginfo, trapcontext)) {
+    return;
+  }
 
   // Find faulty object.
   faultyObject* object;
@@ -221,14 +564,27 @@ void watchpoint::trapHandler(int /* sig */, siginfo_t* /* siginfo */, void* cont
     return;
   }
 
+  reportAccess(object, trapcontext);
+}
+
+void watchpoint::reportAccess(faultyObject* object, ucontext_t* context) {
+  void* ip = (void*)context->uc_mcontext.gregs[REG_IP];
+
   // Check whether this trap is caused by libdoubletake library.
   // If yes, then we don't care it since libdoubletake can fill the canaries.
-  if(selfmap::getInstance().isDoubleTakeLibrary(addr)) {
+  if(selfmap::getInstance().isDoubleTakeLibrary(ip)) {
     return;
   }
 
   //  PRINF("CAPTURING write at %p: ip %lx. signal pointer %p, code %d. \n", addr,
   // trapcontext->uc_mcontext.gregs[REG_RIP], siginfo->si_ptr, siginfo->si_code);
+  void* callsites[xdefines::CALLSITE_MAXIMUM_LENGTH];
+  int depth = selfmap::getCallStack(context, (void**)&callsites);
+
+  reportAccess(object, depth, (void**)&callsites);
+}
+
+void watchpoint::reportAccess(faultyObject* object, int depth, void** callsites) {
   faultyObjectType faultType;
 	if(object->objtype != OBJECT_TYPE_WATCHONLY) {
   	faultType = memtrack::getInstance().getFaultType(object->objectstart, object->faultyaddr);
@@ -237,19 +593,17 @@ void watchpoint::trapHandler(int /* sig */, siginfo_t* /* siginfo */, void* cont
   	}
 	}
 	else {
+    object->isDiagnosed = true;
     PRINT("\nWatch a memory access on %p (value %lx) with call stack:\n", object->faultyaddr, *((unsigned long *)object->faultyaddr));
-  	selfmap::getInstance().printCallStack();
+  	selfmap::getInstance().printCallStack(depth, callsites);
 		return;
 	}
 
-  // Check whether this callsite is the same as the previous callsite.
-  void* callsites[xdefines::CALLSITE_MAXIMUM_LENGTH];
-  int depth = selfmap::getCallStack((void**)&callsites);
-
   // If current callsite is the same as the previous one, we do not want to report again.
-  if(watchpoint::getInstance().checkAndSaveCallsite(object, depth, (void**)&callsites)) {
+  if(watchpoint::getInstance().checkAndSaveCallsite(object, depth, callsites)) {
     return;
   }
+  object->isDiagnosed = true;
 
   // Now we should check whether objectstart is existing or not.
   if(faultType == OBJECT_TYPE_OVERFLOW) {
@@ -257,7 +611,7 @@ void watchpoint::trapHandler(int /* sig */, siginfo_t* /* siginfo */, void* cont
   } else if(faultType == OBJECT_TYPE_USEAFTERFREE) {
     PRINT("\nCaught a use-after-free error at %p. Current call stack:\n", object->faultyaddr);
   }
-  selfmap::getInstance().printCallStack(depth, (void**)&callsites);
+  selfmap::getInstance().printCallStack(depth, callsites);
 
   // Check its allocation or deallocation inf
   if(object->objectstart != NULL) {
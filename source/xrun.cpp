@@ -8,14 +8,20 @@
 
 #include <assert.h>
 #include <pthread.h>
+#include <stdlib.h>
 #include <ucontext.h>
+#include <unistd.h>
 
 #include "globalinfo.hh"
 #include "internalsyncs.hh"
 #include "leakcheck.hh"
+#include "leaksnapshot.hh"
+#include "memtrack.hh"
+#include "quarantinebudget.hh"
 #include "syscalls.hh"
 #include "threadmap.hh"
 #include "threadstruct.hh"
+#include "uafverifier.hh"
 
 int getThreadIndex() {
   return xrun::getInstance().getThreadIndex();
@@ -30,12 +36,16 @@ void xrun::syscallsInitialize() { syscalls::getInstance().initialize(); }
 void xrun::rollback() {
   PRINT("DoubleTake: Activating rollback to isolate error.\n");
   //PRINT("ROLLBACK now!\n");
-  // If this is the first time to rollback,
-  // then we should rollback now.
-  if(global_hasRollbacked()) {
+  // An epoch is only re-executed for a limited number of times.
+  if(_reexecutions == xdefines::MAX_REEXECUTIONS) {
     // PRINF("HAS rolled back, now exiting.\n");
     abort();
   }
+  _reexecutions++;
+
+#if defined(DETECT_MEMORY_LEAKS)
+  memtrack::getInstance().clearLeaks();
+#endif
 
   // Rollback all memory before rolling back the context.
   _memory.rollback();
@@ -68,6 +78,9 @@ void xrun::epochBegin() {
 
     lock_thread(thread);
 
+    // Heap magazines must be empty at the checkpoint.
+    _memory.flushThreadCache(thread);
+
     if(thread != current && thread->hasJoined) {
       PRINF("xrun, joining thread %d\n", thread->index);
       thread->status = E_THREAD_EXITING;
@@ -103,6 +116,8 @@ void xrun::epochBegin() {
 
   // Save the context of this thread
   saveContext();
+
+  _reexecutions = 0;
 }
 
 /// @brief End a transaction, aborting it if necessary.
@@ -117,31 +132,65 @@ void xrun::epochEnd(bool endOfProgram) {
   // Tell other threads to stop and save context.
   stopAllThreads();
 
-  // To avoid endless rollback
+  // The re-execution reaches the end of this epoch.
   if(global_isRollback()) {
     // PRINF("in the end of an epoch, endOfProgram %d. global_isRollback true\n", endOfProgram);
-    while(1)
-      ;
+    endRollback();
+    return;
   }
 
+#if defined(DETECT_USAGE_AFTER_FREE_BACKGROUND)
+  // Install watchpoints for a corrupted object that the verifier has found,
+  // so that the check below rolls back.
+  uafverifier::getInstance().checkCorruption();
+#endif
+
 #if defined(DETECT_OVERFLOW)
   bool hasOverflow = false;
   hasOverflow = _memory.checkHeapOverflow();
 #endif
 
 #if defined(DETECT_MEMORY_LEAKS)
+#if defined(DETECT_USAGE_AFTER_FREE)
+  // The leak checks read the headers of all objects, also of quarantined ones.
+  pagequarantine::getInstance().unprotectAll();
+#endif
+
+  // A snapshot only reports unreachable objects, and never rolls back.
+  if(leaksnapshot::getInstance().isRequested()) {
+    leaksnapshot::getInstance().begin();
+    leakcheck::getInstance().doSnapshotCheck(_memory.getHeapBegin(), _memory.getHeapEnd());
+    leaksnapshot::getInstance().report();
+  }
+
   bool hasMemoryLeak = false;
   if(endOfProgram) {
     //  PRINF("DETECTING MEMORY LEAKAGE in the end of program!!!!\n");
     hasMemoryLeak =
         leakcheck::getInstance().doFastLeakCheck(_memory.getHeapBegin(), _memory.getHeapEnd());
-  } else {
+  }
+#if !defined(DETECT_MEMORY_LEAKS_ON_DEMAND)
+  else {
     // PRINF("DETECTING MEMORY LEAKAGE inside a program!!!!\n");
     hasMemoryLeak =
       leakcheck::getInstance().doSlowLeakCheck(_memory.getHeapBegin(), _memory.getHeapEnd());
   }
 #endif
 
+#if defined(DETECT_USAGE_AFTER_FREE)
+  pagequarantine::getInstance().protectAll();
+#endif
+
+#if defined(DETECT_ALLOCATION_SITES)
+  // Leaks are reported by their stamped allocation sites, without a re-execution.
+  if(hasMemoryLeak) {
+    memtrack::getInstance().reportLeaks();
+    memtrack::getInstance().clearLeaks();
+    hasMemoryLeak = false;
+  }
+#endif
+#endif
+
 #ifndef EVALUATING_PERF
 // First, attempt to commit.
 #if defined(DETECT_OVERFLOW) && defined(DETECT_MEMORY_LEAKS)
@@ -162,7 +211,11 @@ void xrun::epochEnd(bool endOfProgram) {
   } else {
 #endif
 #endif
-    
+
+#ifdef DETECT_USAGE_AFTER_FREE
+    trimQuarantines();
+#endif
+
 		PRINF("before calling syscalls epochEndWell\n");
     syscalls::getInstance().epochEndWell();
 
@@ -176,6 +229,43 @@ void xrun::epochEnd(bool endOfProgram) {
   //PRINF("in the end of an epoch, hasOverflow %d hasMemoryLeak %d\n", hasOverflow, hasMemoryLeak);
 }
 
+void xrun::endRollback() {
+  // Re-execute it again with the watch points left.
+  if(_watchpoint.hasNextBatch() && _reexecutions < xdefines::MAX_REEXECUTIONS) {
+    PRINT("DoubleTake: Re-executing the epoch to watch more addresses.\n");
+    rollback();
+  }
+
+#if defined(DETECT_MEMORY_LEAKS)
+  memtrack::getInstance().reportLeaks();
+#endif
+
+  _watchpoint.uninstallWatchpoints();
+  _watchpoint.clearWatchpoints();
+
+  // The replayed threads can not continue normally: they own no real mutexes, may
+  // still wait on semaphores, and skip the cleanup of sentinels. Thus the epoch is run
+  // once more from its checkpoint, where the diagnosed faults are not reported again.
+  // Otherwise the program stops after the reports, with a status telling that it
+  // has not run to its end. Other threads are parked, so exit() could hang in
+  // their locks, and the buffers of stdio hold data of the re-execution.
+  if(!_thread.canRunAgain()) {
+    PRINT("DoubleTake: The epoch can not be run again with other threads or resources, "
+          "exiting now.\n");
+    _exit(EXIT_FAILURE);
+  }
+
+  PRINT("DoubleTake: Running the epoch again in the normal execution.\n");
+  _memory.rollback();
+
+  // Files are read again from their positions at the checkpoint.
+  syscalls::getInstance().prepareRollback();
+  _thread.prepareRunAgain();
+  _thread.rollbackCurrent();
+
+  assert(0);
+}
+
 #ifdef DETECT_USAGE_AFTER_FREE
 void xrun::finalUAFCheck() {
   threadmap::aliveThreadIterator i;
@@ -183,10 +273,44 @@ void xrun::finalUAFCheck() {
   for(i = threadmap::getInstance().begin(); i != threadmap::getInstance().end(); i++) {
     thread_t* thread = i.getThread();
 
-    if(thread->qlist.finalUAFCheck()) {
-      rollback();
+    thread->qlist.finalUAFCheck();
+  }
+
+  // Faults diagnosed in an earlier re-execution don't add watch points.
+  if(_watchpoint.hasToRollback()) {
+    rollback();
+  }
+}
+#endif
+
+#ifdef DETECT_USAGE_AFTER_FREE
+// Threads only evict their objects in their own free(). Thus, when the epoch is
+// committed, the lists of all threads are trimmed to their share of the new
+// budget, so that idle threads don't hold most of it.
+void xrun::trimQuarantines() {
+  threadmap::aliveThreadIterator i;
+  quarantinebudget& budget = quarantinebudget::getInstance();
+  int threads = 0;
+
+  budget.adjust();
+
+  for(i = threadmap::getInstance().begin(); i != threadmap::getInstance().end(); i++) {
+    threads++;
+  }
+
+  size_t share = budget.getShare(threads);
+  for(i = threadmap::getInstance().begin(); i != threadmap::getInstance().end(); i++) {
+    thread_t* thread = i.getThread();
+
+    if(!thread->qlist.trim(share)) {
+      break;
     }
   }
+
+  // An object with a use-after-free error is diagnosed before the checkpoint is moved.
+  if(_watchpoint.hasToRollback()) {
+    rollback();
+  }
 }
 #endif
 
@@ -265,9 +389,16 @@ void jumpToFunction(ucontext_t* cxt, unsigned long funcaddr) {
   // current thread is going to stop execution in order to commit or rollback.
   assert(global_isEpochEnd() == true);
 
+  // The committer may scan the registers and the stack of this thread.
+  // This thread may be just about to wait inside DoubleTake, keep that context.
+  ucontext_t* blockedContext = current->stopContext;
+  current->stopContext = (ucontext_t*)context;
+
   // Wait for notification from the commiter
   global_waitForNotification();
 
+  current->stopContext = blockedContext;
+
   // Check what is the current phase
   if(global_isEpochBegin()) {
     // Current thread is going to enter a new phase
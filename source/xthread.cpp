@@ -55,8 +55,8 @@ void xthread::epochBegin(thread_t * thread) {
 	// Now we should not have the pending synchronization events.	
 	listInit(&thread->pendingSyncevents);
 
-	// Handle the quarantine list of memory.
-  thread->qlist.restore();
+	// Take a checkpoint of the quarantine list.
+  thread->qlist.backup();
 
 	//PRINF("Cleanup all synchronization events for this thread\n");
 	// cleanup the synchronization events of this thread
@@ -73,13 +73,22 @@ void xthread::prepareRollbackAlivethreads() {
 	for(i = threadmap::getInstance().begin(); i != threadmap::getInstance().end(); i++) {
     thread_t* thread = i.getThread();
       
-		// Initialize the semaphore for this thread.
+		// Initialize the semaphore for this thread. The one of an earlier
+    // re-execution is removed first.
+    destroyThreadSemaphore(thread);
     initThreadSemaphore(thread);
 
     // Set the entry of each thread to the first synchronization event.
    	thread->syscalls.prepareRollback();
 	  thread->syncevents.prepareRollback();
 		SysRecord::prepareRollback(thread);	
+
+    // Cached heap blocks belong to the recovered free lists now.
+    thread->heapcache.reset();
+
+    // The quarantine list is outside of the heap, thus not recovered with it.
+    // The objects freed after the checkpoint will be freed again.
+    thread->qlist.restore();
   }
 }
   
@@ -139,6 +148,38 @@ void xthread::prepareRollback() {
 	global_wakeup();	
 }
 
+// Other threads are parked by the re-execution, and files or synchronization
+// variables would be opened or destroyed twice. Thus only an epoch without them
+// can be run again from its checkpoint.
+bool xthread::canRunAgain() {
+	threadmap::aliveThreadIterator i;
+
+	for(i = threadmap::getInstance().begin(); i != threadmap::getInstance().end(); i++) {
+    if(i.getThread() != current) {
+      return false;
+    }
+  }
+
+  return !current->isNewlySpawned && !_sync.hasDeferredSyncs() &&
+         !SysRecord::hasOpenedResources(current);
+}
+
+void xthread::prepareRunAgain() {
+  // Semaphores are only used in the re-execution.
+  destroyAllSemaphores();
+
+  // The events of this epoch are recorded again.
+  listInit(&current->pendingSyncevents);
+  current->syncevents.cleanup();
+  SysRecord::cleanup(current);
+  epochEndWell();
+
+  current->qlist.restore();
+  current->heapcache.reset();
+
+  global_endRollback();
+}
+
 void xthread::wakeupOldWaitingThreads() {
 	threadmap::aliveThreadIterator i;
 
@@ -197,7 +238,9 @@ void xthread::rollbackCurrent() {
 	// Setting the current status
   current->status = E_THREAD_RUNNING;
 
-  current->qlist.restore();
+  // Debug registers are per thread.
+  watchpoint::getInstance().installThreadWatchpoints();
+
   PRINF("xthread::rollback now\n");
   // Recover the context for current thread.
   restoreContext();
@@ -0,0 +1,170 @@
+#include <string.h>
+
+#include <new>
+
+#include "gtest.h"
+
+#include "blockmap.hh"
+#include "mm.hh"
+#include "objectheader.hh"
+#include "real.hh"
+#include "xdefines.hh"
+
+// The same layout as in blockmap.
+enum { SLOT_SIZE = 2 * xdefines::WORD_SIZE };
+enum { GRANULE_SIZE = 64 * SLOT_SIZE };
+enum { BLOCK_OVERHEAD = sizeof(objectHeader) + 2 * xdefines::SENTINEL_SIZE };
+enum { HEAP_SIZE = 64 * GRANULE_SIZE };
+
+class BlockmapTest : public ::testing::Test {
+protected:
+  static void SetUpTestCase() { Real::initializer(); }
+
+  virtual void SetUp() {
+    _heap = (char *)MM::mmapAllocatePrivate(HEAP_SIZE);
+    ASSERT_NE(_heap, nullptr);
+    _map.initialize(_heap, HEAP_SIZE);
+  }
+
+  virtual void TearDown() { MM::mmapDeallocate(_heap, HEAP_SIZE); }
+
+  // Carve a block of sz bytes of object at offset, as the heap does.
+  objectHeader *carve(size_t offset, size_t sz) {
+    objectHeader *o = new (_heap + offset) objectHeader(sz);
+    _map.setBlock(o, sz + BLOCK_OVERHEAD);
+    return o;
+  }
+
+  // Check that every byte of the block, from its header to its last sentinel, is found.
+  void expectCovered(objectHeader *o) {
+    unsigned long start = (unsigned long)o;
+    unsigned long end = start + BLOCK_OVERHEAD + o->getSize();
+
+    for (unsigned long addr = start; addr < end; addr++) {
+      unsigned long objectStart = 0;
+      ASSERT_TRUE(_map.findObjectStart((void *)addr, &objectStart)) << "offset " << addr - start;
+      ASSERT_EQ(objectStart, (unsigned long)(o + 1)) << "offset " << addr - start;
+    }
+  }
+
+  bool isFound(size_t offset) {
+    unsigned long objectStart;
+    return _map.findObjectStart(_heap + offset, &objectStart);
+  }
+
+  char *_heap;
+  blockmap _map;
+};
+
+TEST_F(BlockmapTest, Empty) {
+  unsigned long objectStart;
+  unsigned long cursor = (unsigned long)_heap;
+
+  ASSERT_FALSE(isFound(0));
+  ASSERT_FALSE(isFound(HEAP_SIZE / 2));
+  ASSERT_FALSE(_map.findObjectStart(_heap - 1, &objectStart));
+  ASSERT_FALSE(_map.findObjectStart(_heap + HEAP_SIZE, &objectStart));
+
+  ASSERT_EQ(_map.findNextBlock(&cursor, (unsigned long)_heap + HEAP_SIZE), nullptr);
+  ASSERT_EQ(cursor, (unsigned long)_heap + HEAP_SIZE);
+}
+
+TEST_F(BlockmapTest, SmallBlocks) {
+  objectHeader *blocks[3];
+
+  blocks[0] = carve(SLOT_SIZE, 16);
+  blocks[1] = carve(SLOT_SIZE + BLOCK_OVERHEAD + 16, 32);
+  // The bytes between the second and the third block do not belong to any of them.
+  blocks[2] = carve(10 * SLOT_SIZE, 64);
+
+  for (int i = 0; i < 3; i++) {
+    expectCovered(blocks[i]);
+  }
+  ASSERT_FALSE(isFound(0));
+  ASSERT_FALSE(isFound(SLOT_SIZE + 2 * BLOCK_OVERHEAD + 48));
+  ASSERT_FALSE(isFound(10 * SLOT_SIZE - 1));
+  ASSERT_FALSE(isFound(10 * SLOT_SIZE + BLOCK_OVERHEAD + 64));
+}
+
+TEST_F(BlockmapTest, GranuleBoundaries) {
+  // Starting in the last slot of a granule, and spanning three more.
+  objectHeader *large = carve(GRANULE_SIZE - SLOT_SIZE, 3 * GRANULE_SIZE);
+  size_t largeEnd = GRANULE_SIZE - SLOT_SIZE + BLOCK_OVERHEAD + 3 * GRANULE_SIZE;
+
+  // Ending exactly at a granule boundary, and right after it.
+  objectHeader *exact = carve(largeEnd, 5 * GRANULE_SIZE - largeEnd - BLOCK_OVERHEAD);
+  objectHeader *next = carve(5 * GRANULE_SIZE, 16);
+
+  // In the first slot of a granule, after the first granule it covers.
+  objectHeader *first = carve(6 * GRANULE_SIZE, 2 * GRANULE_SIZE);
+
+  expectCovered(large);
+  expectCovered(exact);
+  expectCovered(next);
+  expectCovered(first);
+
+  ASSERT_FALSE(isFound(GRANULE_SIZE - SLOT_SIZE - 1));
+  ASSERT_FALSE(isFound(5 * GRANULE_SIZE + BLOCK_OVERHEAD + 16));
+  ASSERT_FALSE(isFound(6 * GRANULE_SIZE - 1));
+  ASSERT_FALSE(isFound(8 * GRANULE_SIZE + BLOCK_OVERHEAD));
+  ASSERT_FALSE(isFound(9 * GRANULE_SIZE));
+}
+
+// Memory rolled back to an earlier epoch is carved again with other blocks.
+TEST_F(BlockmapTest, Recarve) {
+  carve(SLOT_SIZE, 4 * GRANULE_SIZE);
+
+  memset(_heap, 0, 5 * GRANULE_SIZE);
+  objectHeader *small = carve(SLOT_SIZE, 16);
+  objectHeader *middle = carve(2 * GRANULE_SIZE + 3 * SLOT_SIZE, 100 * SLOT_SIZE);
+
+  expectCovered(small);
+  expectCovered(middle);
+
+  // The granules still covered by the discarded block.
+  ASSERT_FALSE(isFound(GRANULE_SIZE));
+  ASSERT_FALSE(isFound(2 * GRANULE_SIZE));
+  ASSERT_FALSE(isFound(4 * GRANULE_SIZE));
+
+  unsigned long cursor = (unsigned long)_heap;
+  unsigned long end = (unsigned long)_heap + HEAP_SIZE;
+  ASSERT_EQ(_map.findNextBlock(&cursor, end), small);
+  ASSERT_EQ(_map.findNextBlock(&cursor, end), middle);
+  ASSERT_EQ(_map.findNextBlock(&cursor, end), nullptr);
+}
+
+TEST_F(BlockmapTest, FindNextBlock) {
+  objectHeader *blocks[] = {
+      carve(SLOT_SIZE, 16),
+      carve(63 * SLOT_SIZE, 16),
+      carve(66 * SLOT_SIZE, 2 * GRANULE_SIZE),
+      carve(20 * GRANULE_SIZE + 5 * SLOT_SIZE, 48),
+      carve(63 * GRANULE_SIZE, GRANULE_SIZE - BLOCK_OVERHEAD),
+  };
+  const int BLOCKS = sizeof(blocks) / sizeof(blocks[0]);
+  unsigned long end = (unsigned long)_heap + HEAP_SIZE;
+
+  // All blocks, including the ones starting in the first and the last slot of a granule.
+  unsigned long cursor = (unsigned long)_heap;
+  for (int i = 0; i < BLOCKS; i++) {
+    ASSERT_EQ(_map.findNextBlock(&cursor, end), blocks[i]) << "block " << i;
+    ASSERT_EQ(cursor, (unsigned long)blocks[i] + BLOCK_OVERHEAD + blocks[i]->getSize());
+  }
+  ASSERT_EQ(_map.findNextBlock(&cursor, end), nullptr);
+  ASSERT_EQ(cursor, end);
+
+  // A cursor inside a block skips to the next start.
+  cursor = (unsigned long)blocks[2] + 1;
+  ASSERT_EQ(_map.findNextBlock(&cursor, end), blocks[3]);
+
+  // Only blocks starting before the end are found.
+  cursor = (unsigned long)_heap;
+  unsigned long limit = (unsigned long)blocks[2];
+  ASSERT_EQ(_map.findNextBlock(&cursor, limit), blocks[0]);
+  ASSERT_EQ(_map.findNextBlock(&cursor, limit), blocks[1]);
+  ASSERT_EQ(_map.findNextBlock(&cursor, limit), nullptr);
+  ASSERT_EQ(cursor, limit);
+
+  cursor = (unsigned long)blocks[2];
+  ASSERT_EQ(_map.findNextBlock(&cursor, limit + 1), blocks[2]);
+}
@@ -0,0 +1,75 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gtest.h"
+
+#include "objectheader.hh"
+#include "xmemory.hh"
+
+enum { GUARD_BYTES = 16 };
+
+TEST(CallocTest, Overflow) {
+  size_t size;
+
+  ASSERT_TRUE(xmemory::getArraySize(10, 16, &size));
+  ASSERT_EQ(size, 160u);
+  ASSERT_TRUE(xmemory::getArraySize(0, SIZE_MAX, &size));
+  ASSERT_EQ(size, 0u);
+  ASSERT_TRUE(xmemory::getArraySize(SIZE_MAX, 0, &size));
+  ASSERT_EQ(size, 0u);
+  ASSERT_TRUE(xmemory::getArraySize(SIZE_MAX, 1, &size));
+  ASSERT_EQ(size, SIZE_MAX);
+
+  // The products do not fit into a size_t.
+  ASSERT_FALSE(xmemory::getArraySize(SIZE_MAX, 16, &size));
+  ASSERT_FALSE(xmemory::getArraySize(16, SIZE_MAX, &size));
+  ASSERT_FALSE(xmemory::getArraySize(SIZE_MAX / 2 + 1, 2, &size));
+  ASSERT_FALSE(xmemory::getArraySize((size_t)1 << 32, (size_t)1 << 32, &size));
+}
+
+TEST(CallocTest, ClearMemory) {
+  const size_t sizes[] = {1, 7, 8, 100, 4095, 4096, 4097, 3 * 4096 + 5};
+
+  for (size_t size : sizes) {
+    unsigned char *buf = (unsigned char *)malloc(size + 2 * GUARD_BYTES);
+    ASSERT_NE(buf, nullptr);
+    memset(buf, 0xAB, size + 2 * GUARD_BYTES);
+
+    // Both the small and the "rep stosb" paths clear exactly size bytes.
+    xmemory::clearMemory(buf + GUARD_BYTES, size);
+
+    for (size_t i = 0; i < size + 2 * GUARD_BYTES; i++) {
+      if (i < GUARD_BYTES || i >= GUARD_BYTES + size) {
+        ASSERT_EQ(buf[i], 0xAB) << "size " << size << " offset " << i;
+      } else {
+        ASSERT_EQ(buf[i], 0) << "size " << size << " offset " << i;
+      }
+    }
+    free(buf);
+  }
+}
+
+TEST(CallocTest, FreshBlock) {
+  objectHeader o(64);
+
+  ASSERT_FALSE(o.isObjectFresh());
+  o.markObjectFresh();
+  ASSERT_TRUE(o.isObjectFresh());
+  ASSERT_EQ(o.getSize(), 64u);
+
+  // The fresh bit and the checked bit are independent of each other and of the size.
+  ASSERT_TRUE(o.markObjectChecked());
+  ASSERT_TRUE(o.isObjectFresh());
+  ASSERT_EQ(o.getSize(), 64u);
+
+  o.setSize(128);
+  ASSERT_EQ(o.getSize(), 128u);
+  ASSERT_TRUE(o.isObjectFresh());
+  ASSERT_TRUE(o.isObjectChecked());
+
+  o.cleanObjectFresh();
+  ASSERT_FALSE(o.isObjectFresh());
+  ASSERT_TRUE(o.isObjectChecked());
+  ASSERT_EQ(o.getSize(), 128u);
+}
@@ -0,0 +1,225 @@
+#include <pthread.h>
+
+#include "gtest.h"
+
+#include "callsitetable.hh"
+#include "hashfuncs.hh"
+#include "real.hh"
+#include "xdefines.hh"
+
+enum { MASK = xdefines::CALLSITE_TABLE_SIZE - 1 };
+enum { MAXIMUM_SITES = xdefines::CALLSITE_TABLE_SIZE / 4 * 3 };
+enum { THREADS = 4 };
+
+// A call stack of depth made-up return addresses, which differ by seed.
+static void makeStack(void **frames, int depth, unsigned long seed) {
+  for (int i = 0; i < depth; i++) {
+    frames[i] = (void *)(0x400000UL + seed * 0x1000 + i * 0x10);
+  }
+}
+
+static unsigned long getIndex(void **frames, int depth) {
+  size_t hash = HashFuncs::hashCallStack(frames, depth);
+  return (hash == 0 ? 1 : hash) & MASK;
+}
+
+class CallsitetableTest : public ::testing::Test {
+protected:
+  static void SetUpTestCase() { Real::initializer(); }
+
+  virtual void SetUp() { _table.initialize(); }
+
+  callsitetable _table;
+};
+
+TEST_F(CallsitetableTest, Intern) {
+  void *frames[xdefines::CALLSITE_MAXIMUM_LENGTH];
+
+  makeStack(frames, 5, 1);
+  unsigned int id = _table.intern(5, frames);
+
+  // The id is the slot the stack hashes to, plus one.
+  ASSERT_NE(id, (unsigned int)callsitetable::NO_CALLSITE);
+  ASSERT_EQ(id, getIndex(frames, 5) + 1);
+  ASSERT_EQ(_table.getDepth(id), 5);
+  for (int i = 0; i < 5; i++) {
+    ASSERT_EQ(_table.getFrames(id)[i], frames[i]);
+  }
+
+  // The frames are copied into the table.
+  makeStack(frames, 5, 2);
+  ASSERT_EQ(_table.getFrames(id)[0], (void *)(0x400000UL + 0x1000));
+}
+
+TEST_F(CallsitetableTest, Dedup) {
+  void *frames[xdefines::CALLSITE_MAXIMUM_LENGTH + 2];
+  void *copy[xdefines::CALLSITE_MAXIMUM_LENGTH + 2];
+
+  makeStack(frames, 4, 1);
+  makeStack(copy, 4, 1);
+  unsigned int id = _table.intern(4, frames);
+  ASSERT_EQ(_table.intern(4, copy), id);
+  ASSERT_EQ(_table.intern(4, frames), id);
+
+  // A prefix, or a stack with one different frame, is another site.
+  unsigned int prefix = _table.intern(3, frames);
+  ASSERT_NE(prefix, id);
+  copy[3] = (void *)0x1234;
+  unsigned int other = _table.intern(4, copy);
+  ASSERT_NE(other, id);
+  ASSERT_NE(other, prefix);
+
+  // Only the first frames of deep stacks are kept.
+  makeStack(frames, xdefines::CALLSITE_MAXIMUM_LENGTH + 2, 3);
+  makeStack(copy, xdefines::CALLSITE_MAXIMUM_LENGTH + 2, 3);
+  copy[xdefines::CALLSITE_MAXIMUM_LENGTH] = (void *)0x1234;
+  id = _table.intern(xdefines::CALLSITE_MAXIMUM_LENGTH + 2, frames);
+  ASSERT_EQ(_table.intern(xdefines::CALLSITE_MAXIMUM_LENGTH + 1, copy), id);
+  ASSERT_EQ(_table.intern(xdefines::CALLSITE_MAXIMUM_LENGTH, frames), id);
+  ASSERT_EQ(_table.getDepth(id), (int)xdefines::CALLSITE_MAXIMUM_LENGTH);
+}
+
+TEST_F(CallsitetableTest, NoCallsite) {
+  callsitetable table;
+  void *frames[1] = {(void *)0x400000};
+
+  // Before the table is initialized, and for empty stacks.
+  ASSERT_EQ(table.intern(1, frames), (unsigned int)callsitetable::NO_CALLSITE);
+  ASSERT_EQ(_table.intern(0, frames), (unsigned int)callsitetable::NO_CALLSITE);
+  ASSERT_EQ(_table.intern(-1, frames), (unsigned int)callsitetable::NO_CALLSITE);
+
+  // Nothing is kept for unknown or unused ids.
+  _table.addObject(callsitetable::NO_CALLSITE, 16);
+  ASSERT_EQ(_table.getDepth(callsitetable::NO_CALLSITE), 0);
+  ASSERT_EQ(_table.getFrames(callsitetable::NO_CALLSITE), nullptr);
+  ASSERT_EQ(_table.getObjects(callsitetable::NO_CALLSITE), 0u);
+  ASSERT_EQ(_table.getDepth(1), 0);
+  ASSERT_EQ(_table.getFrames(xdefines::CALLSITE_TABLE_SIZE + 1), nullptr);
+}
+
+TEST_F(CallsitetableTest, Collisions) {
+  void *stacks[3][2];
+  int found = 0;
+
+  // Find stacks that hash to the same slot.
+  makeStack(stacks[0], 2, 0);
+  unsigned long index = getIndex(stacks[0], 2);
+  for (unsigned long seed = 1; found < 2; seed++) {
+    makeStack(stacks[found + 1], 2, seed);
+    if (getIndex(stacks[found + 1], 2) == index) {
+      found++;
+    }
+  }
+
+  // They are put into the following slots, and are found there.
+  unsigned int ids[3];
+  for (int i = 0; i < 3; i++) {
+    ids[i] = _table.intern(2, stacks[i]);
+    ASSERT_EQ(ids[i], ((index + i) & MASK) + 1) << "stack " << i;
+  }
+  for (int i = 2; i >= 0; i--) {
+    ASSERT_EQ(_table.intern(2, stacks[i]), ids[i]) << "stack " << i;
+    ASSERT_EQ(_table.getFrames(ids[i])[1], stacks[i][1]);
+  }
+}
+
+TEST_F(CallsitetableTest, WrapAround) {
+  void *stacks[2][1];
+  int found = 0;
+
+  // Stacks that hash to the last slot go on at the first one.
+  for (unsigned long seed = 0; found < 2; seed++) {
+    makeStack(stacks[found], 1, seed);
+    if (getIndex(stacks[found], 1) == MASK) {
+      found++;
+    }
+  }
+
+  ASSERT_EQ(_table.intern(1, stacks[0]), (unsigned int)xdefines::CALLSITE_TABLE_SIZE);
+  ASSERT_EQ(_table.intern(1, stacks[1]), 1u);
+  ASSERT_EQ(_table.intern(1, stacks[1]), 1u);
+  ASSERT_EQ(_table.getFrames(1)[0], stacks[1][0]);
+}
+
+TEST_F(CallsitetableTest, Full) {
+  void *frames[3];
+
+  for (unsigned long seed = 0; seed < MAXIMUM_SITES; seed++) {
+    makeStack(frames, 3, seed);
+    ASSERT_NE(_table.intern(3, frames), (unsigned int)callsitetable::NO_CALLSITE) << "site " << seed;
+  }
+
+  // New stacks are unknown once the table is three quarters full.
+  makeStack(frames, 3, MAXIMUM_SITES);
+  ASSERT_EQ(_table.intern(3, frames), (unsigned int)callsitetable::NO_CALLSITE);
+  makeStack(frames, 2, MAXIMUM_SITES + 1);
+  ASSERT_EQ(_table.intern(2, frames), (unsigned int)callsitetable::NO_CALLSITE);
+
+  // Known ones are still found.
+  for (unsigned long seed = 0; seed < MAXIMUM_SITES; seed += 1000) {
+    makeStack(frames, 3, seed);
+    unsigned int id = _table.intern(3, frames);
+    ASSERT_NE(id, (unsigned int)callsitetable::NO_CALLSITE) << "site " << seed;
+    ASSERT_EQ(_table.getFrames(id)[2], frames[2]);
+  }
+}
+
+TEST_F(CallsitetableTest, Objects) {
+  void *frames[2];
+
+  makeStack(frames, 2, 1);
+  unsigned int first = _table.intern(2, frames);
+  makeStack(frames, 2, 2);
+  unsigned int second = _table.intern(2, frames);
+
+  _table.addObject(first, 16);
+  _table.addObject(first, 48);
+  _table.addObject(second, 1024);
+  ASSERT_EQ(_table.getObjects(first), 2u);
+  ASSERT_EQ(_table.getBytes(first), 64u);
+  ASSERT_EQ(_table.getObjects(second), 1u);
+  ASSERT_EQ(_table.getBytes(second), 1024u);
+
+  // The counts are cleared, but the sites are kept.
+  _table.clearObjects();
+  ASSERT_EQ(_table.getObjects(first), 0u);
+  ASSERT_EQ(_table.getBytes(second), 0u);
+  ASSERT_EQ(_table.intern(2, frames), second);
+}
+
+struct Interning {
+  callsitetable *table;
+  unsigned int ids[1000];
+};
+
+static void *internStacks(void *arg) {
+  Interning *interning = (Interning *)arg;
+  void *frames[4];
+
+  for (unsigned long seed = 0; seed < 1000; seed++) {
+    makeStack(frames, 4, seed);
+    interning->ids[seed] = interning->table->intern(4, frames);
+  }
+  return NULL;
+}
+
+// Threads interning the same stacks at the same time get the same ids.
+TEST_F(CallsitetableTest, Concurrent) {
+  pthread_t threads[THREADS];
+  static Interning interning[THREADS];
+
+  for (int i = 0; i < THREADS; i++) {
+    interning[i].table = &_table;
+    ASSERT_EQ(pthread_create(&threads[i], NULL, internStacks, &interning[i]), 0);
+  }
+  for (int i = 0; i < THREADS; i++) {
+    ASSERT_EQ(pthread_join(threads[i], NULL), 0);
+  }
+
+  for (unsigned long seed = 0; seed < 1000; seed++) {
+    ASSERT_NE(interning[0].ids[seed], (unsigned int)callsitetable::NO_CALLSITE);
+    for (int i = 1; i < THREADS; i++) {
+      ASSERT_EQ(interning[i].ids[seed], interning[0].ids[seed]) << "stack " << seed;
+    }
+  }
+}
@@ -0,0 +1,79 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gtest.h"
+
+#include "canary.hh"
+#include "xdefines.hh"
+
+enum { MAX_WORDS = 40 };
+
+TEST(CanaryTest, Fill) {
+  // One more word on both sides, and an odd offset for unaligned vector stores.
+  unsigned char buf[(MAX_WORDS + 2) * sizeof(unsigned long) + 1];
+
+  for (size_t words = 0; words <= MAX_WORDS; words++) {
+    memset(buf, 0, sizeof(buf));
+    unsigned long *addr = (unsigned long *)(buf + 1 + sizeof(unsigned long));
+
+    fillCanary(addr, words);
+
+    for (size_t i = 0; i < words; i++) {
+      unsigned long word;
+      memcpy(&word, &addr[i], sizeof(word));
+      ASSERT_EQ(word, (unsigned long)xdefines::SENTINEL_WORD) << "words " << words << " index " << i;
+    }
+
+    // Nothing outside of the words is written.
+    for (size_t i = 0; i < 1 + sizeof(unsigned long); i++) {
+      ASSERT_EQ(buf[i], 0);
+    }
+    for (size_t i = 1 + (words + 1) * sizeof(unsigned long); i < sizeof(buf); i++) {
+      ASSERT_EQ(buf[i], 0) << "words " << words << " byte " << i;
+    }
+  }
+}
+
+TEST(CanaryTest, Intact) {
+  unsigned long addr[MAX_WORDS];
+
+  for (size_t words = 0; words <= MAX_WORDS; words++) {
+    fillCanary(addr, words);
+    ASSERT_EQ(findCanaryMismatch(addr, 0, words), words);
+  }
+}
+
+TEST(CanaryTest, Mismatch) {
+  unsigned long addr[MAX_WORDS];
+
+  // Every byte of every word is caught, in the vector loop and in the scalar tail.
+  for (size_t i = 0; i < MAX_WORDS; i++) {
+    for (size_t byte = 0; byte < sizeof(unsigned long); byte++) {
+      fillCanary(addr, MAX_WORDS);
+      ((unsigned char *)&addr[i])[byte] ^= 0x1;
+
+      ASSERT_EQ(findCanaryMismatch(addr, 0, MAX_WORDS), i) << "byte " << byte;
+    }
+  }
+}
+
+TEST(CanaryTest, FirstMismatch) {
+  unsigned long addr[MAX_WORDS];
+
+  fillCanary(addr, MAX_WORDS);
+  addr[3] = 0;
+  addr[20] = 0;
+  addr[37] = 0;
+
+  ASSERT_EQ(findCanaryMismatch(addr, 0, MAX_WORDS), 3u);
+
+  // The words before start are not checked.
+  ASSERT_EQ(findCanaryMismatch(addr, 4, MAX_WORDS), 20u);
+  ASSERT_EQ(findCanaryMismatch(addr, 21, MAX_WORDS), 37u);
+  ASSERT_EQ(findCanaryMismatch(addr, 38, MAX_WORDS), (size_t)MAX_WORDS);
+
+  // Nor are the words after the end.
+  ASSERT_EQ(findCanaryMismatch(addr, 4, 20), 20u);
+  ASSERT_EQ(findCanaryMismatch(addr, 4, 19), 19u);
+}
@@ -0,0 +1,27 @@
+#include "internalheap.hh"
+#include "log.hh"
+#include "mm.hh"
+#include "xdefines.hh"
+
+// libdoubletake gets these from xrun and xmemory. Unit tests run without the
+// runtime, so that they are not linked with the whole of it.
+
+// The log messages are formatted into a buffer of the current thread.
+char *getCurrentThreadBuffer() {
+  static __thread char buffer[LOG_SIZE];
+  return buffer;
+}
+
+// Tests set the index of their threads here.
+__thread int unitThreadIndex;
+
+int getThreadIndex() { return unitThreadIndex; }
+
+// Internal containers, like the mappings of selfmap, use the internal heap directly.
+void *InternalHeapAllocator::malloc(size_t sz) { return InternalHeap::getInstance().malloc(sz); }
+
+void InternalHeapAllocator::free(void *ptr) { InternalHeap::getInstance().free(ptr); }
+
+void *InternalHeapAllocator::allocate(size_t sz) { return InternalHeap::getInstance().malloc(sz); }
+
+void InternalHeapAllocator::deallocate(void *ptr) { InternalHeap::getInstance().free(ptr); }
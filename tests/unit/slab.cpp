@@ -0,0 +1,254 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "gtest.h"
+
+#include "slab.hh"
+#include "xdefines.hh"
+
+extern __thread int unitThreadIndex;
+
+// A source heap that counts the slabs and arrays it gives out.
+class CountingHeap {
+public:
+  static void *allocate(size_t sz) {
+    if (sz == xdefines::SLAB_SIZE) {
+      slabs++;
+    } else {
+      arrays++;
+      arrayBytes += sz;
+    }
+    return ::malloc(sz);
+  }
+
+  static void deallocate(void *ptr) {
+    arrays--;
+    ::free(ptr);
+  }
+
+  static void reset() {
+    slabs = 0;
+    arrays = 0;
+    arrayBytes = 0;
+  }
+
+  static int slabs;
+  static int arrays;
+  static size_t arrayBytes;
+};
+
+int CountingHeap::slabs;
+int CountingHeap::arrays;
+size_t CountingHeap::arrayBytes;
+
+struct Record {
+  unsigned long words[5];
+};
+
+// As large as a slab holds exactly PER_SLAB of them.
+enum { PER_SLAB = 64 };
+struct Large {
+  char bytes[xdefines::SLAB_SIZE / PER_SLAB];
+};
+
+class SlabTest : public ::testing::Test {
+protected:
+  virtual void SetUp() {
+    CountingHeap::reset();
+    unitThreadIndex = 0;
+  }
+};
+
+TEST_F(SlabTest, AllocFree) {
+  slab<Record, CountingHeap> *records = new slab<Record, CountingHeap>();
+
+  Record *first = records->alloc();
+  Record *second = records->alloc();
+  ASSERT_EQ(CountingHeap::slabs, 1);
+  ASSERT_EQ((char *)second - (char *)first, (long)sizeof(Record));
+  ASSERT_EQ((uintptr_t)first % sizeof(void *), 0u);
+
+  // Objects freed by a thread are taken again by it, the last one first.
+  records->free(first);
+  records->free(second);
+  ASSERT_EQ(records->alloc(), second);
+  ASSERT_EQ(records->alloc(), first);
+  ASSERT_EQ(CountingHeap::slabs, 1);
+
+  delete records;
+}
+
+TEST_F(SlabTest, BumpRefill) {
+  slab<Large, CountingHeap> *larges = new slab<Large, CountingHeap>();
+  std::set<Large *> objects;
+
+  for (int i = 0; i < PER_SLAB; i++) {
+    objects.insert(larges->alloc());
+  }
+  ASSERT_EQ(CountingHeap::slabs, 1);
+
+  // The next object does not fit, so another slab is carved.
+  Large *next = larges->alloc();
+  ASSERT_EQ(CountingHeap::slabs, 2);
+  objects.insert(next);
+  ASSERT_EQ(objects.size(), (size_t)PER_SLAB + 1);
+
+  for (int i = 1; i < PER_SLAB; i++) {
+    objects.insert(larges->alloc());
+  }
+  ASSERT_EQ(CountingHeap::slabs, 2);
+  ASSERT_EQ(objects.size(), 2u * PER_SLAB);
+
+  // No object overlaps another one.
+  Large *last = NULL;
+  for (Large *object : objects) {
+    if (last != NULL) {
+      ASSERT_GE((char *)object - (char *)last, (long)sizeof(Large));
+    }
+    last = object;
+  }
+
+  delete larges;
+}
+
+TEST_F(SlabTest, CacheOverflow) {
+  const int EXTRA = 10;
+  slab<Record, CountingHeap> *records = new slab<Record, CountingHeap>();
+  Record *objects[xdefines::SLAB_CACHE_SIZE + EXTRA];
+
+  for (int i = 0; i < xdefines::SLAB_CACHE_SIZE + EXTRA; i++) {
+    objects[i] = records->alloc();
+  }
+  for (int i = 0; i < xdefines::SLAB_CACHE_SIZE + EXTRA; i++) {
+    records->free(objects[i]);
+  }
+
+  // The objects beyond the cache of thread 0 went to the shared list, where
+  // another thread finds them.
+  unitThreadIndex = 1;
+  for (int i = xdefines::SLAB_CACHE_SIZE + EXTRA - 1; i >= xdefines::SLAB_CACHE_SIZE; i--) {
+    ASSERT_EQ(records->alloc(), objects[i]);
+  }
+
+  // Then it carves new ones.
+  Record *fresh = records->alloc();
+  ASSERT_EQ(fresh, objects[xdefines::SLAB_CACHE_SIZE + EXTRA - 1] + 1);
+
+  // Thread 0 still has its own cache.
+  unitThreadIndex = 0;
+  for (int i = xdefines::SLAB_CACHE_SIZE - 1; i >= 0; i--) {
+    ASSERT_EQ(records->alloc(), objects[i]);
+  }
+  ASSERT_EQ(records->alloc(), fresh + 1);
+  ASSERT_EQ(CountingHeap::slabs, 1);
+
+  delete records;
+}
+
+struct Churn {
+  slab<Record, CountingHeap> *records;
+  int index;
+  std::vector<Record *> kept;
+};
+
+static void *churn(void *arg) {
+  Churn *work = (Churn *)arg;
+  Record *objects[3 * xdefines::SLAB_CACHE_SIZE];
+
+  unitThreadIndex = work->index;
+  for (int round = 0; round < 200; round++) {
+    for (int i = 0; i < 3 * xdefines::SLAB_CACHE_SIZE; i++) {
+      objects[i] = work->records->alloc();
+      objects[i]->words[0] = work->index;
+    }
+    for (int i = 0; i < 3 * xdefines::SLAB_CACHE_SIZE; i++) {
+      if (objects[i]->words[0] != (unsigned long)work->index) {
+        return (void *)1;
+      }
+      work->records->free(objects[i]);
+    }
+  }
+
+  for (int i = 0; i < xdefines::SLAB_CACHE_SIZE; i++) {
+    work->kept.push_back(work->records->alloc());
+  }
+  return NULL;
+}
+
+// Threads going through the shared list never get the same object at once.
+TEST_F(SlabTest, Concurrent) {
+  const int THREADS = 4;
+  slab<Record, CountingHeap> *records = new slab<Record, CountingHeap>();
+  pthread_t threads[THREADS];
+  Churn work[THREADS];
+  std::set<Record *> kept;
+
+  for (int i = 0; i < THREADS; i++) {
+    work[i].records = records;
+    work[i].index = i;
+    ASSERT_EQ(pthread_create(&threads[i], NULL, churn, &work[i]), 0);
+  }
+  for (int i = 0; i < THREADS; i++) {
+    void *result;
+    ASSERT_EQ(pthread_join(threads[i], &result), 0);
+    ASSERT_EQ(result, nullptr) << "thread " << i;
+    kept.insert(work[i].kept.begin(), work[i].kept.end());
+  }
+  ASSERT_EQ(kept.size(), (size_t)THREADS * xdefines::SLAB_CACHE_SIZE);
+
+  delete records;
+}
+
+TEST_F(SlabTest, Allocator) {
+  slabAllocator<Record, CountingHeap> allocator;
+
+  // Single objects come from the slab of their type.
+  Record *single = allocator.allocate(1);
+  ASSERT_EQ(CountingHeap::slabs, 1);
+  ASSERT_EQ(CountingHeap::arrays, 0);
+  allocator.deallocate(single, 1);
+  ASSERT_EQ(allocator.allocate(1), single);
+
+  // Arrays come from the source heap and go back there.
+  Record *array = allocator.allocate(5);
+  ASSERT_EQ(CountingHeap::arrays, 1);
+  ASSERT_EQ(CountingHeap::arrayBytes, 5 * sizeof(Record));
+  for (int i = 0; i < 5; i++) {
+    array[i].words[0] = i;
+  }
+  allocator.deallocate(array, 5);
+  ASSERT_EQ(CountingHeap::arrays, 0);
+  ASSERT_EQ(CountingHeap::slabs, 1);
+
+  allocator.deallocate(single, 1);
+}
+
+TEST_F(SlabTest, Containers) {
+  typedef std::map<int, int, std::less<int>, slabAllocator<std::pair<const int, int>, CountingHeap>>
+      slabMap;
+  typedef std::vector<int, slabAllocator<int, CountingHeap>> slabVector;
+
+  {
+    slabMap map;
+    slabVector vector;
+
+    for (int i = 0; i < 1000; i++) {
+      map[i] = 2 * i;
+      vector.push_back(i);
+    }
+    for (int i = 0; i < 1000; i += 2) {
+      map.erase(i);
+    }
+    for (int i = 0; i < 1000; i++) {
+      ASSERT_EQ(map.count(i), (size_t)(i % 2));
+      ASSERT_EQ(vector[i], i);
+    }
+  }
+
+  // All arrays of the vector were given back.
+  ASSERT_EQ(CountingHeap::arrays, 0);
+}
@@ -0,0 +1,152 @@
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "gtest.h"
+
+#include "internalheap.hh"
+#include "real.hh"
+#include "selfmap.hh"
+#include "symbolizer.hh"
+
+// The fixture, with the lines that the tests look up.
+enum { LINE_CALL = 8, LINE_INNER = 13, LINE_INLINED = 19 };
+static const char *FIXTURE_SOURCE =
+    "/* A fixture of the symbolizer test. */\n"
+    "__attribute__((noinline)) void *fixture_pc(void) {\n"
+    "  return __builtin_return_address(0);\n"
+    "}\n"
+    "\n"
+    "void *fixture_line(void) {\n"
+    "  void *pc;\n"
+    "  pc = fixture_pc();\n"
+    "  __asm__ volatile(\"\" : : : \"memory\");\n"
+    "  return pc;\n"
+    "}\n"
+    "static inline __attribute__((always_inline)) void *fixture_inner(void) {\n"
+    "  void *pc = fixture_pc();\n"
+    "  __asm__ volatile(\"\" : : : \"memory\");\n"
+    "  return pc;\n"
+    "}\n"
+    "\n"
+    "void *fixture_inlined(void) {\n"
+    "  void *pc = fixture_inner();\n"
+    "  __asm__ volatile(\"\" : : : \"memory\");\n"
+    "  return pc;\n"
+    "}\n";
+
+typedef void *(*fixtureFunction)(void);
+
+// Build the fixture with debug information, and a stripped copy of it, and load
+// both before selfmap reads the mappings of the process.
+class SymbolizerTest : public ::testing::Test {
+protected:
+  static void SetUpTestCase() {
+    Real::initializer();
+    InternalHeap::getInstance().initialize();
+
+    ASSERT_NE(mkdtemp(_dir), nullptr);
+    _source = std::string(_dir) + "/fixture.c";
+    _debug = std::string(_dir) + "/fixture.so";
+    _stripped = std::string(_dir) + "/stripped.so";
+
+    FILE *file = fopen(_source.c_str(), "w");
+    ASSERT_NE(file, nullptr);
+    fputs(FIXTURE_SOURCE, file);
+    fclose(file);
+
+    std::string command = "cc -g -O2 -fPIC -shared -Wl,--build-id=none -o " + _debug + " " +
+                          _source + " && strip -o " + _stripped + " " + _debug;
+    ASSERT_EQ(system(command.c_str()), 0) << command;
+
+    _debugHandle = dlopen(_debug.c_str(), RTLD_NOW);
+    _strippedHandle = dlopen(_stripped.c_str(), RTLD_NOW);
+    ASSERT_NE(_debugHandle, nullptr) << dlerror();
+    ASSERT_NE(_strippedHandle, nullptr) << dlerror();
+
+    void *line = dlsym(_debugHandle, "fixture_line");
+    ASSERT_NE(selfmap::getInstance().findMapping(line), nullptr)
+        << "selfmap was read before the fixture was loaded";
+  }
+
+  static void TearDownTestCase() {
+    unlink(_source.c_str());
+    unlink(_debug.c_str());
+    unlink(_stripped.c_str());
+    rmdir(_dir);
+  }
+
+  // Symbolize the frame that a function of the fixture returns.
+  std::string symbolize(void *handle, const char *function) {
+    fixtureFunction call = (fixtureFunction)dlsym(handle, function);
+    EXPECT_NE(call, nullptr) << function;
+    if (call == NULL) {
+      return "";
+    }
+    void *frames[1] = {call()};
+
+    // The report goes to stderr, so it is captured into a file.
+    char path[] = "/tmp/symbolizerXXXXXX";
+    int fd = mkstemp(path);
+    int saved = dup(STDERR_FILENO);
+    dup2(fd, STDERR_FILENO);
+    symbolizer::getInstance().printCallStack(1, frames);
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+
+    char buf[4096];
+    ssize_t size = pread(fd, buf, sizeof(buf) - 1, 0);
+    close(fd);
+    unlink(path);
+
+    return std::string(buf, size > 0 ? size : 0);
+  }
+
+  static char _dir[];
+  static std::string _source;
+  static std::string _debug;
+  static std::string _stripped;
+  static void *_debugHandle;
+  static void *_strippedHandle;
+};
+
+char SymbolizerTest::_dir[] = "/tmp/symbolizerXXXXXX";
+std::string SymbolizerTest::_source;
+std::string SymbolizerTest::_debug;
+std::string SymbolizerTest::_stripped;
+void *SymbolizerTest::_debugHandle;
+void *SymbolizerTest::_strippedHandle;
+
+TEST_F(SymbolizerTest, Line) {
+  std::string report = symbolize(_debugHandle, "fixture_line");
+
+  std::string expected = "fixture_line at " + _source + ":" + std::to_string(LINE_CALL);
+  ASSERT_NE(report.find(expected), std::string::npos) << report;
+  ASSERT_EQ(report.find("inlined by"), std::string::npos) << report;
+}
+
+TEST_F(SymbolizerTest, Inlines) {
+  std::string report = symbolize(_debugHandle, "fixture_inlined");
+
+  // The innermost function first, and then the one it is inlined into.
+  std::string inner = "fixture_inner at " + _source + ":" + std::to_string(LINE_INNER);
+  std::string outer =
+      " (inlined by) fixture_inlined at " + _source + ":" + std::to_string(LINE_INLINED);
+  size_t innerAt = report.find(inner);
+  size_t outerAt = report.find(outer);
+  ASSERT_NE(innerAt, std::string::npos) << report;
+  ASSERT_NE(outerAt, std::string::npos) << report;
+  ASSERT_LT(innerAt, outerAt) << report;
+}
+
+// Without .symtab and debug information, the name comes from .dynsym.
+TEST_F(SymbolizerTest, Stripped) {
+  std::string report = symbolize(_strippedHandle, "fixture_line");
+
+  ASSERT_NE(report.find("fixture_line in " + _stripped), std::string::npos) << report;
+  ASSERT_EQ(report.find(_source), std::string::npos) << report;
+}
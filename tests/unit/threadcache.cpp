@@ -0,0 +1,78 @@
+#include <stdint.h>
+
+#include "gtest.h"
+
+#include "threadcache.hh"
+#include "xdefines.hh"
+
+enum { SC = 3 };
+
+TEST(ThreadcacheTest, PutGet) {
+  threadcache cache;
+  char blocks[4][64];
+
+  ASSERT_TRUE(cache.isEmpty(SC));
+  ASSERT_EQ(cache.get(SC), nullptr);
+
+  for (int i = 0; i < 4; i++) {
+    cache.put(SC, blocks[i]);
+  }
+  ASSERT_EQ(cache.getCount(SC), 4);
+  ASSERT_TRUE(cache.isEmpty(SC + 1));
+
+  // The most recently cached block comes first.
+  for (int i = 3; i >= 0; i--) {
+    ASSERT_EQ(cache.get(SC), blocks[i]);
+  }
+  ASSERT_TRUE(cache.isEmpty(SC));
+}
+
+TEST(ThreadcacheTest, GetAligned) {
+  threadcache cache;
+  alignas(512) static char buf[1024];
+
+  // Blocks at 16, 64, 80, 256 and 272 bytes into an aligned buffer.
+  cache.put(SC, buf + 16);
+  cache.put(SC, buf + 64);
+  cache.put(SC, buf + 80);
+  cache.put(SC, buf + 256);
+  cache.put(SC, buf + 272);
+
+  ASSERT_EQ(cache.getAligned(SC, 512), nullptr);
+  ASSERT_EQ(cache.getAligned(SC, 64), buf + 256);
+  ASSERT_EQ(cache.getAligned(SC, 64), buf + 64);
+  ASSERT_EQ(cache.getAligned(SC, 64), nullptr);
+  ASSERT_EQ(cache.getCount(SC), 3);
+
+  // The other blocks keep their order.
+  ASSERT_EQ(cache.get(SC), buf + 272);
+  ASSERT_EQ(cache.get(SC), buf + 80);
+  ASSERT_EQ(cache.get(SC), buf + 16);
+  ASSERT_TRUE(cache.isEmpty(SC));
+}
+
+TEST(ThreadcacheTest, Drain) {
+  threadcache cache;
+  char blocks[xdefines::THREAD_CACHE_SIZE][16];
+  void *out[xdefines::THREAD_CACHE_SIZE];
+
+  for (int i = 0; i < xdefines::THREAD_CACHE_SIZE; i++) {
+    cache.put(SC, blocks[i]);
+  }
+  ASSERT_TRUE(cache.isFull(SC));
+
+  // The oldest blocks are drained.
+  ASSERT_EQ(cache.drain(SC, out, 4), 4);
+  for (int i = 0; i < 4; i++) {
+    ASSERT_EQ(out[i], blocks[i]);
+  }
+  ASSERT_EQ(cache.get(SC), blocks[xdefines::THREAD_CACHE_SIZE - 1]);
+
+  ASSERT_EQ(cache.drain(SC, out, xdefines::THREAD_CACHE_SIZE), xdefines::THREAD_CACHE_SIZE - 5);
+  ASSERT_EQ(out[0], blocks[4]);
+  ASSERT_TRUE(cache.isEmpty(SC));
+
+  cache.put(SC, blocks[0]);
+  cache.reset();
+  ASSERT_TRUE(cache.isEmpty(SC));
+}
@@ -0,0 +1,225 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gtest.h"
+
+#include "real.hh"
+#include "workdeque.hh"
+#include "xdefines.hh"
+
+enum { CAPACITY = xdefines::LEAK_MARK_DEQUE_SIZE };
+enum { THIEVES = 3 };
+
+class WorkdequeTest : public ::testing::Test {
+protected:
+  // The entries are mapped through the real mmap().
+  static void SetUpTestCase() { Real::initializer(); }
+};
+
+TEST_F(WorkdequeTest, PushPop) {
+  workdeque deque;
+  unsigned long value;
+
+  deque.initialize();
+  ASSERT_TRUE(deque.isEmpty());
+  ASSERT_FALSE(deque.pop(&value));
+
+  for (unsigned long i = 1; i <= 100; i++) {
+    ASSERT_TRUE(deque.push(i));
+  }
+  ASSERT_FALSE(deque.isEmpty());
+
+  // The owner takes the newest entries first.
+  for (unsigned long i = 100; i >= 1; i--) {
+    ASSERT_TRUE(deque.pop(&value));
+    ASSERT_EQ(value, i);
+  }
+  ASSERT_TRUE(deque.isEmpty());
+  ASSERT_FALSE(deque.pop(&value));
+  ASSERT_FALSE(deque.steal(&value));
+}
+
+TEST_F(WorkdequeTest, Steal) {
+  workdeque deque;
+  unsigned long value;
+
+  deque.initialize();
+  for (unsigned long i = 1; i <= 10; i++) {
+    ASSERT_TRUE(deque.push(i));
+  }
+
+  // Thieves take the oldest entries, and the owner still gets the newest ones.
+  ASSERT_TRUE(deque.steal(&value));
+  ASSERT_EQ(value, 1u);
+  ASSERT_TRUE(deque.steal(&value));
+  ASSERT_EQ(value, 2u);
+  ASSERT_TRUE(deque.pop(&value));
+  ASSERT_EQ(value, 10u);
+
+  for (unsigned long i = 3; i <= 9; i++) {
+    ASSERT_TRUE(deque.steal(&value));
+    ASSERT_EQ(value, i);
+  }
+  ASSERT_TRUE(deque.isEmpty());
+  ASSERT_FALSE(deque.steal(&value));
+  ASSERT_FALSE(deque.pop(&value));
+}
+
+TEST_F(WorkdequeTest, Full) {
+  workdeque deque;
+  unsigned long value;
+
+  deque.initialize();
+  for (unsigned long i = 0; i < CAPACITY; i++) {
+    ASSERT_TRUE(deque.push(i));
+  }
+  ASSERT_FALSE(deque.push(CAPACITY));
+
+  // A stolen entry makes room again.
+  ASSERT_TRUE(deque.steal(&value));
+  ASSERT_EQ(value, 0u);
+  ASSERT_TRUE(deque.push(CAPACITY));
+  ASSERT_FALSE(deque.push(CAPACITY + 1));
+
+  ASSERT_TRUE(deque.pop(&value));
+  ASSERT_EQ(value, (unsigned long)CAPACITY);
+
+  deque.reset();
+  ASSERT_TRUE(deque.isEmpty());
+}
+
+TEST_F(WorkdequeTest, WrapAround) {
+  workdeque deque;
+  unsigned long value;
+  unsigned long next = 0;
+
+  deque.initialize();
+
+  // The indexes run through the buffer several times, with half of it in use.
+  for (unsigned long i = 0; i < 5 * CAPACITY; i++) {
+    ASSERT_TRUE(deque.push(i));
+    if (i >= CAPACITY / 2) {
+      ASSERT_TRUE(deque.steal(&value));
+      ASSERT_EQ(value, next++);
+    }
+  }
+
+  while (deque.steal(&value)) {
+    ASSERT_EQ(value, next++);
+  }
+  ASSERT_EQ(next, 5ul * CAPACITY);
+}
+
+struct LastEntry {
+  workdeque deque;
+  volatile bool start;
+  volatile bool done;
+  volatile int stolen;
+};
+
+static void *stealLastEntry(void *arg) {
+  LastEntry *last = (LastEntry *)arg;
+  unsigned long value;
+
+  while (!__atomic_load_n(&last->start, __ATOMIC_ACQUIRE)) {
+  }
+
+  if (last->deque.steal(&value)) {
+    __atomic_store_n(&last->stolen, 1, __ATOMIC_RELEASE);
+  }
+  __atomic_store_n(&last->done, true, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+// The owner and a thief race for the only entry. Exactly one of them gets it.
+TEST_F(WorkdequeTest, ContendedLastEntry) {
+  LastEntry last;
+  unsigned long value;
+
+  last.deque.initialize();
+
+  for (int round = 0; round < 2000; round++) {
+    pthread_t thief;
+
+    last.start = false;
+    last.done = false;
+    last.stolen = 0;
+    ASSERT_TRUE(last.deque.push(round + 1));
+    ASSERT_EQ(pthread_create(&thief, NULL, stealLastEntry, &last), 0);
+
+    __atomic_store_n(&last.start, true, __ATOMIC_RELEASE);
+    int popped = last.deque.pop(&value) ? 1 : 0;
+    if (popped) {
+      ASSERT_EQ(value, (unsigned long)round + 1);
+    }
+
+    ASSERT_EQ(pthread_join(thief, NULL), 0);
+    ASSERT_EQ(popped + last.stolen, 1) << "round " << round;
+    ASSERT_TRUE(last.deque.isEmpty());
+  }
+}
+
+struct Stress {
+  workdeque deque;
+  unsigned char *taken;
+  volatile bool done;
+};
+
+static void *stealEntries(void *arg) {
+  Stress *stress = (Stress *)arg;
+  unsigned long value;
+
+  while (!__atomic_load_n(&stress->done, __ATOMIC_ACQUIRE) || !stress->deque.isEmpty()) {
+    if (stress->deque.steal(&value)) {
+      __atomic_add_fetch(&stress->taken[value], 1, __ATOMIC_RELAXED);
+    }
+  }
+  return NULL;
+}
+
+// Every entry is taken once, either by the owner or by one of the thieves.
+TEST_F(WorkdequeTest, Concurrent) {
+  const unsigned long ENTRIES = 200000;
+  Stress stress;
+  pthread_t thieves[THIEVES];
+  unsigned long value;
+
+  stress.deque.initialize();
+  stress.taken = (unsigned char *)calloc(ENTRIES, 1);
+  stress.done = false;
+  ASSERT_NE(stress.taken, nullptr);
+
+  for (int i = 0; i < THIEVES; i++) {
+    ASSERT_EQ(pthread_create(&thieves[i], NULL, stealEntries, &stress), 0);
+  }
+
+  for (unsigned long i = 0; i < ENTRIES; i++) {
+    while (!stress.deque.push(i)) {
+    }
+
+    // Pop some entries, sometimes down to the last one.
+    if (i % 3 == 0) {
+      while (stress.deque.pop(&value)) {
+        __atomic_add_fetch(&stress.taken[value], 1, __ATOMIC_RELAXED);
+        if (value % 2 == 0) {
+          break;
+        }
+      }
+    }
+  }
+
+  while (stress.deque.pop(&value)) {
+    __atomic_add_fetch(&stress.taken[value], 1, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&stress.done, true, __ATOMIC_RELEASE);
+
+  for (int i = 0; i < THIEVES; i++) {
+    ASSERT_EQ(pthread_join(thieves[i], NULL), 0);
+  }
+
+  for (unsigned long i = 0; i < ENTRIES; i++) {
+    ASSERT_EQ(stress.taken[i], 1) << "entry " << i;
+  }
+  free(stress.taken);
+}
@@ -0,0 +1,131 @@
+#include <sys/mman.h>
+
+#include "gtest.h"
+
+#include "real.hh"
+#include "worklist.hh"
+#include "xdefines.hh"
+
+// The same layout as in worklist: a link and a count before the entries.
+enum {
+  ENTRIES_PER_CHUNK =
+      (xdefines::LEAK_WORKLIST_CHUNK_SIZE - sizeof(void *) - sizeof(size_t)) / sizeof(unsigned long)
+};
+
+static decltype(::mmap) *realMmap;
+static int chunksMapped;
+
+static void *countingMmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
+  chunksMapped++;
+  return realMmap(addr, length, prot, flags, fd, offset);
+}
+
+// Count the chunks mapped by the worklist through the real mmap().
+class WorklistTest : public ::testing::Test {
+protected:
+  static void SetUpTestCase() { Real::initializer(); }
+
+  virtual void SetUp() {
+    realMmap = Real::mmap;
+    Real::mmap = countingMmap;
+    chunksMapped = 0;
+  }
+
+  virtual void TearDown() { Real::mmap = realMmap; }
+};
+
+TEST_F(WorklistTest, PushPop) {
+  worklist list;
+  unsigned long value;
+
+  ASSERT_TRUE(list.isEmpty());
+  ASSERT_FALSE(list.pop(&value));
+  ASSERT_EQ(chunksMapped, 0);
+
+  for (unsigned long i = 1; i <= 100; i++) {
+    list.push(i);
+  }
+  ASSERT_FALSE(list.isEmpty());
+  ASSERT_EQ(chunksMapped, 1);
+
+  for (unsigned long i = 100; i >= 1; i--) {
+    ASSERT_TRUE(list.pop(&value));
+    ASSERT_EQ(value, i);
+  }
+  ASSERT_TRUE(list.isEmpty());
+  ASSERT_FALSE(list.pop(&value));
+}
+
+TEST_F(WorklistTest, Spill) {
+  const unsigned long ENTRIES = 3 * ENTRIES_PER_CHUNK + 1;
+  worklist list;
+  unsigned long value;
+
+  // A full chunk spills into a new one on the next push only.
+  for (unsigned long i = 0; i < ENTRIES_PER_CHUNK; i++) {
+    list.push(i);
+  }
+  ASSERT_EQ(chunksMapped, 1);
+  list.push(ENTRIES_PER_CHUNK);
+  ASSERT_EQ(chunksMapped, 2);
+
+  for (unsigned long i = ENTRIES_PER_CHUNK + 1; i < ENTRIES; i++) {
+    list.push(i);
+  }
+  ASSERT_EQ(chunksMapped, 4);
+
+  // The entries come back in LIFO order across the chunk boundaries.
+  for (unsigned long i = ENTRIES; i-- > 0;) {
+    ASSERT_TRUE(list.pop(&value));
+    ASSERT_EQ(value, i);
+  }
+  ASSERT_TRUE(list.isEmpty());
+  ASSERT_FALSE(list.pop(&value));
+}
+
+TEST_F(WorklistTest, Reuse) {
+  const unsigned long ENTRIES = 3 * ENTRIES_PER_CHUNK;
+  worklist list;
+  unsigned long value;
+
+  for (unsigned long i = 0; i < ENTRIES; i++) {
+    list.push(i);
+  }
+  while (list.pop(&value)) {
+  }
+  ASSERT_EQ(chunksMapped, 3);
+
+  // Empty chunks are pushed onto again instead of being mapped.
+  for (int round = 0; round < 3; round++) {
+    for (unsigned long i = 0; i < ENTRIES; i++) {
+      list.push(i + round);
+    }
+    for (unsigned long i = ENTRIES; i-- > 0;) {
+      ASSERT_TRUE(list.pop(&value));
+      ASSERT_EQ(value, i + round);
+    }
+  }
+  ASSERT_EQ(chunksMapped, 3);
+
+  // Going up and down around a chunk boundary keeps the same chunks too.
+  for (unsigned long i = 0; i < ENTRIES_PER_CHUNK; i++) {
+    list.push(i);
+  }
+  for (int round = 0; round < 100; round++) {
+    list.push(round);
+    list.push(round + 1);
+    ASSERT_TRUE(list.pop(&value));
+    ASSERT_EQ(value, (unsigned long)round + 1);
+    ASSERT_TRUE(list.pop(&value));
+    ASSERT_EQ(value, (unsigned long)round);
+  }
+  ASSERT_TRUE(list.pop(&value));
+  ASSERT_EQ(value, ENTRIES_PER_CHUNK - 1ul);
+  ASSERT_EQ(chunksMapped, 3);
+
+  // Only a list longer than ever before maps another chunk.
+  for (unsigned long i = 0; i < ENTRIES + 1; i++) {
+    list.push(i);
+  }
+  ASSERT_EQ(chunksMapped, 4);
+}